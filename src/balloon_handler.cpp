@@ -0,0 +1,123 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "balloon_handler.hpp"
+
+#include "utility.hpp"
+
+#include <fast-lib/log.hpp>
+#include <libvirt/virterror.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+using namespace fast::msg::migfra;
+
+FASTLIB_LOG_INIT(balloon_guard_log, "Balloon_guard")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(balloon_guard_log, trace);
+
+// Time the guest gets to release memory to the balloon.
+static const std::chrono::seconds balloon_timeout(5);
+
+static void set_live_memory(virDomainPtr domain, unsigned long long memory)
+{
+	if (virDomainSetMemoryFlags(domain, memory, VIR_DOMAIN_AFFECT_LIVE) == -1)
+		throw std::runtime_error("Error setting amount of live memory to " + std::to_string(memory)
+				+ " KiB: " + virGetLastErrorMessage());
+}
+
+//
+// Balloon_guard implementation
+//
+
+Balloon_guard::Balloon_guard(std::shared_ptr<virDomain> domain,
+		unsigned long long headroom,
+		Time_measurement &time_measurement,
+		std::string tag_postfix) :
+	domain(domain),
+	time_measurement(time_measurement),
+	tag_postfix(std::move(tag_postfix))
+{
+	if (this->tag_postfix != "")
+		this->tag_postfix = "-" + this->tag_postfix;
+	tick_synchronized(time_measurement, "shrink-balloon" + this->tag_postfix);
+	try {
+		shrink(headroom);
+	} catch (...) {
+		// The destructor is not called if the constructor throws, so restore memory here.
+		try {
+			restore();
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(balloon_guard_log, warn) << "Exception while restoring memory: " << e.what();
+		}
+		throw;
+	}
+	tock_synchronized(time_measurement, "shrink-balloon" + this->tag_postfix);
+}
+
+Balloon_guard::~Balloon_guard() noexcept(false)
+{
+	try {
+		restore();
+	} catch (...) {
+		// Only log exception when unwinding stack, else rethrow exception.
+		if (std::uncaught_exception())
+			FASTLIB_LOG(balloon_guard_log, trace) << "Exception while restoring memory.";
+		else
+			throw;
+	}
+}
+
+void Balloon_guard::set_destination_domain(std::shared_ptr<virDomain> dest_domain)
+{
+	// override domain to restore memory on
+	domain = dest_domain;
+}
+
+unsigned long long Balloon_guard::get_shrunk_by() const
+{
+	return original_memory - shrunk_memory;
+}
+
+void Balloon_guard::shrink(unsigned long long headroom)
+{
+	Memory_stats mem_stats(domain.get());
+	// Without balloon driver in the guest the unused memory is not reported.
+	if (mem_stats.unused == 0) {
+		FASTLIB_LOG(balloon_guard_log, trace) << "No unused memory reported. Skip shrinking.";
+		return;
+	}
+	auto used = mem_stats.actual_balloon - std::min(mem_stats.unused, mem_stats.actual_balloon);
+	auto target = used + headroom;
+	if (target >= mem_stats.actual_balloon) {
+		FASTLIB_LOG(balloon_guard_log, trace) << "Not enough unused memory to shrink. " << mem_stats.str();
+		return;
+	}
+	FASTLIB_LOG(balloon_guard_log, trace) << "Shrink memory from " << mem_stats.actual_balloon << " KiB to " << target << " KiB.";
+	set_live_memory(domain.get(), target);
+	original_memory = mem_stats.actual_balloon;
+	shrunk_memory = target;
+	// The guest releases memory asynchronously.
+	auto deadline = std::chrono::steady_clock::now() + balloon_timeout;
+	while ((mem_stats.refresh(), mem_stats.actual_balloon > target) && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	if (mem_stats.actual_balloon > target)
+		FASTLIB_LOG(balloon_guard_log, trace) << "Guest did not reach target memory in time. " << mem_stats.str();
+}
+
+void Balloon_guard::restore()
+{
+	if (original_memory != 0) {
+		tick_synchronized(time_measurement, "restore-balloon" + tag_postfix);
+		FASTLIB_LOG(balloon_guard_log, trace) << "Restore memory to " << original_memory << " KiB.";
+		set_live_memory(domain.get(), original_memory);
+		tock_synchronized(time_measurement, "restore-balloon" + tag_postfix);
+	}
+}
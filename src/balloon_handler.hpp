@@ -0,0 +1,45 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef BALLOON_HANDLER_HPP
+#define BALLOON_HANDLER_HPP
+
+#include <fast-lib/message/migfra/time_measurement.hpp>
+
+#include <libvirt/libvirt.h>
+
+#include <memory>
+#include <string>
+
+// RAII-guard to shrink the memory of a domain to its used memory plus headroom in constructor
+// and to restore the former size in destructor, so that unused memory is not transferred during migration.
+// If no error occures during migration the domain on destination should be set.
+class Balloon_guard
+{
+public:
+	Balloon_guard(std::shared_ptr<virDomain> domain,
+			unsigned long long headroom,
+			fast::msg::migfra::Time_measurement &time_measurement,
+			std::string tag_postfix = "");
+	~Balloon_guard() noexcept(false);
+
+	void set_destination_domain(std::shared_ptr<virDomain> dest_domain);
+	// Returns the amount of memory in KiB the domain was shrunk by.
+	unsigned long long get_shrunk_by() const;
+private:
+	void shrink(unsigned long long headroom);
+	void restore();
+
+	std::shared_ptr<virDomain> domain;
+	fast::msg::migfra::Time_measurement &time_measurement;
+	std::string tag_postfix;
+	unsigned long long original_memory = 0;
+	unsigned long long shrunk_memory = 0;
+};
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "capacity_ledger.hpp"
+
+#include <fast-lib/log.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+FASTLIB_LOG_INIT(capacity_ledger_log, "Capacity_ledger")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(capacity_ledger_log, trace);
+
+Capacity_ledger::Reservation_id Capacity_ledger::reserve(const std::string &host, const Domain_demand &demand)
+{
+	std::lock_guard<std::mutex> lock(reservations_mutex);
+	auto id = next_id++;
+	reservations[id] = Reservation{host, demand};
+	FASTLIB_LOG(capacity_ledger_log, trace) << "Reserve " << demand.vcpus << " vcpus and " << demand.memory
+		<< " KiB on " << host << " for " << demand.name << " (" << id << ").";
+	return id;
+}
+
+void Capacity_ledger::commit(Reservation_id id)
+{
+	release(id, "Commit");
+}
+
+void Capacity_ledger::rollback(Reservation_id id)
+{
+	release(id, "Roll back");
+}
+
+void Capacity_ledger::release(Reservation_id id, const std::string &reason)
+{
+	std::lock_guard<std::mutex> lock(reservations_mutex);
+	auto it = reservations.find(id);
+	if (it == reservations.end())
+		throw std::logic_error("Unknown reservation " + std::to_string(id) + ".");
+	FASTLIB_LOG(capacity_ledger_log, trace) << reason << " reservation on " << it->second.host
+		<< " for " << it->second.demand.name << " (" << id << ").";
+	reservations.erase(it);
+}
+
+void Capacity_ledger::subtract_reserved(std::vector<Host_resources> &hosts) const
+{
+	std::lock_guard<std::mutex> lock(reservations_mutex);
+	for (const auto &id_reservation : reservations) {
+		const auto &reservation = id_reservation.second;
+		for (auto &host : hosts) {
+			if (host.name != reservation.host)
+				continue;
+			host.used_cpus += reservation.demand.vcpus;
+			host.free_memory -= std::min(host.free_memory, reservation.demand.memory);
+			// The NUMA node the domain will use is unknown, so the reservation is taken from the fullest fitting node.
+			auto node = std::min_element(host.numa_free_memory.begin(), host.numa_free_memory.end(),
+					[&reservation](unsigned long long lhs, unsigned long long rhs)
+					{
+						bool lhs_fits = lhs >= reservation.demand.memory;
+						bool rhs_fits = rhs >= reservation.demand.memory;
+						return lhs_fits != rhs_fits ? lhs_fits : lhs < rhs;
+					});
+			if (node != host.numa_free_memory.end())
+				*node -= std::min(*node, reservation.demand.memory);
+		}
+	}
+}
+
+unsigned int Capacity_ledger::reserved_domains(const std::string &host) const
+{
+	std::lock_guard<std::mutex> lock(reservations_mutex);
+	return std::count_if(reservations.begin(), reservations.end(),
+			[&host](const std::pair<const Reservation_id, Reservation> &id_reservation)
+			{return id_reservation.second.host == host;});
+}
+
+std::unique_lock<std::mutex> Capacity_ledger::lock_planning()
+{
+	return std::unique_lock<std::mutex>(planning_mutex);
+}
+
+Reservation_guard::Reservation_guard(std::shared_ptr<Capacity_ledger> ledger, Capacity_ledger::Reservation_id id) :
+	ledger(std::move(ledger)),
+	id(id)
+{
+}
+
+Reservation_guard::~Reservation_guard()
+{
+	if (!committed) {
+		try {
+			ledger->rollback(id);
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(capacity_ledger_log, trace) << "Exception while rolling back reservation: " << e.what();
+		}
+	}
+}
+
+void Reservation_guard::commit()
+{
+	ledger->commit(id);
+	committed = true;
+}
@@ -0,0 +1,94 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef CAPACITY_LEDGER_HPP
+#define CAPACITY_LEDGER_HPP
+
+#include "placement.hpp"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * \brief Tracks destination resources reserved by in-flight migrations across all evacuate requests.
+ *
+ * Probing a destination only shows domains which already arrived there.
+ * Reservations cover the time between choosing a destination and the end of the migration,
+ * so that concurrent evacuations do not place domains on the same free resources.
+ */
+class Capacity_ledger
+{
+public:
+	using Reservation_id = unsigned long long;
+
+	/**
+	 * \brief Reserve resources of a domain on host.
+	 */
+	Reservation_id reserve(const std::string &host, const Domain_demand &demand);
+	/**
+	 * \brief Release a reservation after the domain arrived on the host.
+	 *
+	 * From now on the domain is visible when probing the host.
+	 */
+	void commit(Reservation_id id);
+	/**
+	 * \brief Release a reservation of a domain which did not arrive on the host.
+	 */
+	void rollback(Reservation_id id);
+	/**
+	 * \brief Subtract resources reserved on the hosts from their probed free resources.
+	 */
+	void subtract_reserved(std::vector<Host_resources> &hosts) const;
+	/**
+	 * \brief Get the number of domains reserved on host.
+	 */
+	unsigned int reserved_domains(const std::string &host) const;
+	/**
+	 * \brief Serialize planning of evacuate requests.
+	 *
+	 * Holding the lock while probing, placing and reserving ensures that plans are based on the
+	 * reservations of all previously planned requests.
+	 */
+	std::unique_lock<std::mutex> lock_planning();
+private:
+	struct Reservation
+	{
+		std::string host;
+		Domain_demand demand;
+	};
+
+	void release(Reservation_id id, const std::string &reason);
+
+	std::unordered_map<Reservation_id, Reservation> reservations;
+	Reservation_id next_id = 1;
+	mutable std::mutex reservations_mutex;
+	std::mutex planning_mutex;
+};
+
+/**
+ * \brief RAII-guard which rolls back a reservation unless it was committed.
+ */
+class Reservation_guard
+{
+public:
+	Reservation_guard(std::shared_ptr<Capacity_ledger> ledger, Capacity_ledger::Reservation_id id);
+	~Reservation_guard();
+	Reservation_guard(const Reservation_guard &) = delete;
+	Reservation_guard & operator=(const Reservation_guard &) = delete;
+
+	void commit();
+private:
+	std::shared_ptr<Capacity_ledger> ledger;
+	Capacity_ledger::Reservation_id id;
+	bool committed = false;
+};
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "connection_pool.hpp"
+
+#include "utility.hpp"
+
+#include <fast-lib/log.hpp>
+#include <libvirt/virterror.h>
+
+#include <stdexcept>
+
+FASTLIB_LOG_INIT(connection_pool_log, "Connection_pool")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(connection_pool_log, trace);
+
+std::shared_ptr<virConnect> Connection_pool::get(const std::string &uri)
+{
+	std::shared_ptr<virConnect> dead_conn;
+	{
+		std::lock_guard<std::mutex> lock(connections_mutex);
+		auto it = connections.find(uri);
+		if (it != connections.end()) {
+			if (virConnectIsAlive(it->second.get()) == 1) {
+				FASTLIB_LOG(connection_pool_log, trace) << "Reuse pooled connection to " << uri << ".";
+				return it->second;
+			}
+			// Closed outside of the lock
+			dead_conn = std::move(it->second);
+			connections.erase(it);
+		}
+	}
+	dead_conn.reset();
+	// Open without holding the lock, so that an unreachable host does not block requests for other uris.
+	FASTLIB_LOG(connection_pool_log, trace) << "Open pooled connection to " << uri << ".";
+	std::shared_ptr<virConnect> conn(virConnectOpen(uri.c_str()), Deleter_virConnect());
+	if (!conn)
+		throw std::runtime_error("Failed to connect to libvirt with uri: " + uri);
+	std::lock_guard<std::mutex> lock(connections_mutex);
+	auto &pooled_conn = connections[uri];
+	// Prefer a connection pooled concurrently by another request, ours is closed when going out of scope.
+	if (pooled_conn && virConnectIsAlive(pooled_conn.get()) == 1)
+		return pooled_conn;
+	pooled_conn = conn;
+	return conn;
+}
+
+void Connection_pool::invalidate(const std::string &uri)
+{
+	std::lock_guard<std::mutex> lock(connections_mutex);
+	FASTLIB_LOG(connection_pool_log, trace) << "Invalidate pooled connection to " << uri << ".";
+	connections.erase(uri);
+}
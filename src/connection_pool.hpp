@@ -0,0 +1,47 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef CONNECTION_POOL_HPP
+#define CONNECTION_POOL_HPP
+
+#include <libvirt/libvirt.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * \brief Keeps libvirt connections open so that they can be reused by subsequent tasks.
+ *
+ * Connections are identified by their uri.
+ * A pooled connection which is not alive anymore is reopened on the next request.
+ * Libvirt connections may be shared by multiple threads.
+ */
+class Connection_pool
+{
+public:
+	/**
+	 * \brief Get an open connection to uri.
+	 *
+	 * Opens a new connection if none is pooled for this uri or if the pooled one is dead.
+	 * The connection is opened without holding the pool lock, so requests for other uris are not blocked.
+	 */
+	std::shared_ptr<virConnect> get(const std::string &uri);
+	/**
+	 * \brief Drop the pooled connection to uri.
+	 *
+	 * Should be called if an operation on the connection failed in a way suggesting a broken connection.
+	 */
+	void invalidate(const std::string &uri);
+private:
+	std::unordered_map<std::string, std::shared_ptr<virConnect>> connections;
+	std::mutex connections_mutex;
+};
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "device_ledger.hpp"
+
+#include <fast-lib/log.hpp>
+
+FASTLIB_LOG_INIT(device_ledger_log, "Device_ledger")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(device_ledger_log, trace);
+
+bool Device_ledger::is_loaded(const std::string &host_uri) const
+{
+	std::lock_guard<std::mutex> lock(reservations_mutex);
+	return loaded_hosts.count(host_uri) != 0;
+}
+
+void Device_ledger::load(const std::string &host_uri, const std::unordered_map<PCI_address, std::string> &attached)
+{
+	std::lock_guard<std::mutex> lock(reservations_mutex);
+	auto &host_reservations = reservations[host_uri];
+	for (const auto &address_domain : attached)
+		host_reservations.insert(address_domain);
+	loaded_hosts.insert(host_uri);
+	FASTLIB_LOG(device_ledger_log, trace) << "Loaded " << attached.size() << " attached devices on " << host_uri << ".";
+}
+
+std::shared_ptr<Device> Device_ledger::reserve_any(const std::string &host_uri, const std::vector<std::shared_ptr<Device>> &candidates, const std::string &domain_name,
+		bool pending)
+{
+	std::lock_guard<std::mutex> lock(reservations_mutex);
+	auto &host_reservations = reservations[host_uri];
+	for (const auto &device : candidates) {
+		if (host_reservations.emplace(device->address, domain_name).second) {
+			if (pending)
+				pending_reservations[host_uri].insert(device->address);
+			FASTLIB_LOG(device_ledger_log, trace) << "Reserved device " << device->address.str() << " on " << host_uri << " for " << domain_name
+				<< (pending ? " (pending)." : ".");
+			return device;
+		}
+	}
+	return nullptr;
+}
+
+bool Device_ledger::reserve(const std::string &host_uri, const PCI_address &address, const std::string &domain_name, bool pending)
+{
+	std::lock_guard<std::mutex> lock(reservations_mutex);
+	if (!reservations[host_uri].emplace(address, domain_name).second)
+		return false;
+	if (pending)
+		pending_reservations[host_uri].insert(address);
+	FASTLIB_LOG(device_ledger_log, trace) << "Reserved device " << address.str() << " on " << host_uri << " for " << domain_name
+		<< (pending ? " (pending)." : ".");
+	return true;
+}
+
+void Device_ledger::confirm(const std::string &host_uri, const PCI_address &address)
+{
+	std::lock_guard<std::mutex> lock(reservations_mutex);
+	auto it = pending_reservations.find(host_uri);
+	if (it != pending_reservations.end())
+		it->second.erase(address);
+}
+
+bool Device_ledger::is_reserved(const std::string &host_uri, const PCI_address &address) const
+{
+	std::lock_guard<std::mutex> lock(reservations_mutex);
+	auto it = reservations.find(host_uri);
+	return it != reservations.end() && it->second.count(address) != 0;
+}
+
+void Device_ledger::release(const std::string &host_uri, const PCI_address &address)
+{
+	std::lock_guard<std::mutex> lock(reservations_mutex);
+	FASTLIB_LOG(device_ledger_log, trace) << "Release device " << address.str() << " on " << host_uri << ".";
+	reservations[host_uri].erase(address);
+	pending_reservations[host_uri].erase(address);
+}
+
+size_t Device_ledger::release_stale(const std::string &host_uri, const std::function<bool(const std::string &)> &is_active)
+{
+	// Collect the owners under the lock, but ask libvirt after releasing it.
+	std::unordered_map<PCI_address, std::string> candidates;
+	{
+		std::lock_guard<std::mutex> lock(reservations_mutex);
+		auto it = reservations.find(host_uri);
+		if (it == reservations.end())
+			return 0;
+		candidates = it->second;
+		// Pending reservations belong to operations in progress, not to (possibly not yet existing) domains
+		for (const auto &address : pending_reservations[host_uri])
+			candidates.erase(address);
+	}
+	std::unordered_map<std::string, bool> active;
+	for (const auto &candidate : candidates) {
+		if (active.find(candidate.second) == active.end())
+			active[candidate.second] = is_active(candidate.second);
+	}
+	std::lock_guard<std::mutex> lock(reservations_mutex);
+	auto &host_reservations = reservations[host_uri];
+	size_t released = 0;
+	for (const auto &candidate : candidates) {
+		if (active[candidate.second])
+			continue;
+		auto it = host_reservations.find(candidate.first);
+		// Keep reservations which were released and reserved again meanwhile.
+		if (it == host_reservations.end() || it->second != candidate.second || pending_reservations[host_uri].count(candidate.first) != 0)
+			continue;
+		FASTLIB_LOG(device_ledger_log, trace) << "Release stale reservation of device " << it->first.str()
+			<< " on " << host_uri << " for " << it->second << ".";
+		host_reservations.erase(it);
+		++released;
+	}
+	return released;
+}
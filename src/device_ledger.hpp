@@ -0,0 +1,89 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef DEVICE_LEDGER_HPP
+#define DEVICE_LEDGER_HPP
+
+#include "pci_device_handler.hpp"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * \brief Tracks which domain a PCI device of a host is reserved for.
+ *
+ * A device is reserved atomically before it is attached, so that concurrent starts never try to attach the same
+ * device. Reservations are released on detach or if attaching failed.
+ * The reservations of a host are loaded from the hostdevs of its active domains on first access.
+ * Pending reservations belong to an operation in progress, e.g., resizing a VF pool, and are never released as stale.
+ */
+class Device_ledger
+{
+public:
+	/**
+	 * \brief Check if the reservations of host were already loaded.
+	 */
+	bool is_loaded(const std::string &host_uri) const;
+	/**
+	 * \brief Load reservations of devices which are already attached to domains.
+	 *
+	 * Reservations made in the meantime take precedence.
+	 * \param attached The name of the domain per attached device.
+	 */
+	void load(const std::string &host_uri, const std::unordered_map<PCI_address, std::string> &attached);
+	/**
+	 * \brief Reserve the first free device of candidates for domain.
+	 *
+	 * \param pending Exempt the reservation from release_stale until it is confirmed or released.
+	 * \returns The reserved device or nullptr if all candidates are reserved.
+	 */
+	std::shared_ptr<Device> reserve_any(const std::string &host_uri, const std::vector<std::shared_ptr<Device>> &candidates, const std::string &domain_name,
+			bool pending = false);
+	/**
+	 * \brief Reserve a certain device for domain.
+	 *
+	 * \param pending Exempt the reservation from release_stale until it is confirmed or released.
+	 * \returns False if the device is already reserved.
+	 */
+	bool reserve(const std::string &host_uri, const PCI_address &address, const std::string &domain_name, bool pending = false);
+	/**
+	 * \brief Turn a pending reservation into a regular one, which is released if its domain is not active.
+	 */
+	void confirm(const std::string &host_uri, const PCI_address &address);
+	/**
+	 * \brief Check if a device is reserved.
+	 */
+	bool is_reserved(const std::string &host_uri, const PCI_address &address) const;
+	/**
+	 * \brief Release the reservation of a device.
+	 */
+	void release(const std::string &host_uri, const PCI_address &address);
+	/**
+	 * \brief Release reservations of domains which are not active anymore, e.g., if a domain crashed.
+	 *
+	 * Pending reservations are kept. The owners are checked without holding the lock. Reservations which changed their owner meanwhile are kept.
+	 * \param is_active Checks if a domain is active on host.
+	 * \returns The number of released reservations.
+	 */
+	size_t release_stale(const std::string &host_uri, const std::function<bool(const std::string &)> &is_active);
+private:
+	// (hosturi : (address : domain name))
+	std::unordered_map<std::string, std::unordered_map<PCI_address, std::string>> reservations;
+	// (hosturi : addresses of pending reservations)
+	std::unordered_map<std::string, std::unordered_set<PCI_address>> pending_reservations;
+	// Hosts whose reservations were loaded. Reserving or releasing does not load a host.
+	std::unordered_set<std::string> loaded_hosts;
+	mutable std::mutex reservations_mutex;
+};
+
+#endif
@@ -12,10 +12,10 @@
 #include <libvirt/libvirt.h>
 #include <boost/property_tree/ptree.hpp>
 
-#include <iomanip>
+#include <algorithm>
 #include <stdexcept>
-#include <sstream>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 // Deleter to be used with smart pointers.
@@ -31,12 +31,25 @@ struct Deleter_virNodeDevice
 std::vector<std::unique_ptr<virNodeDevice, Deleter_virNodeDevice>> list_all_node_devices_wrapper(virConnectPtr conn, unsigned int flags);
 
 // Converts integer type numbers to string in hex format.
+// Formats digits directly, since this is called for every address in hostdev xml.
 template<typename T, typename std::enable_if<std::is_integral<T>{}>::type* = nullptr> 
 std::string to_hex_string(const T &integer, int digits, bool show_base = true)
 {
-	std::stringstream ss;
-	ss << (show_base ? "0x" : "") << std::hex << std::setfill('0') << std::setw(digits) << +integer;
-	return ss.str();
+	static const char hex_digits[] = "0123456789abcdef";
+	auto value = static_cast<typename std::make_unsigned<T>::type>(integer);
+	char buffer[2 * sizeof(T)];
+	int length = 0;
+	do {
+		buffer[length++] = hex_digits[value & 0xf];
+		value >>= 4;
+	} while (value != 0);
+	std::string str(show_base ? "0x" : "");
+	str.reserve(str.size() + std::max(digits, length));
+	if (digits > length)
+		str.append(digits - length, '0');
+	while (length != 0)
+		str += buffer[--length];
+	return str;
 }
 
 // Convert xml string to ptree.
@@ -0,0 +1,217 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "domain_inventory.hpp"
+
+#include "utility.hpp"
+#include "xml_scanner.hpp"
+
+#include <fast-lib/log.hpp>
+#include <libvirt/virterror.h>
+
+#include <stdexcept>
+
+FASTLIB_LOG_INIT(domain_inventory_log, "Domain_inventory")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(domain_inventory_log, trace);
+
+//
+// Domain_inventory implementation
+//
+
+Domain_inventory::Domain_inventory(const std::string &xml_desc)
+{
+	using Token = Xml_scanner::Token;
+	Xml_scanner scanner(xml_desc);
+	// Only PCI hostdevs have a PCI source address
+	bool pci_hostdev = false;
+	for (auto token = scanner.next(); token != Token::end_of_document; token = scanner.next()) {
+		if (token != Token::start_element)
+			continue;
+		if (scanner.path_is("domain/uuid")) {
+			uuid = scanner.read_text().str();
+		} else if (scanner.path_is("domain/name")) {
+			name = scanner.read_text().str();
+		} else if (scanner.path_is("domain/devices/hostdev")) {
+			pci_hostdev = is_pci_hostdev(scanner);
+		} else if (pci_hostdev && scanner.path_is("domain/devices/hostdev/source/address")) {
+			hostdevs.push_back(make_pci_address_from_xml(scanner));
+		} else if (scanner.path_is("domain/devices/shmem")) {
+			auto shmem = scanner.read_element();
+			shmems.emplace_back(shmem.data, shmem.size);
+		} else if (scanner.path_is("domain/devices/interface")) {
+			interfaces.emplace_back();
+			interfaces.back().type = scanner.attribute("type").str();
+		} else if (scanner.path_is("domain/devices/interface/mac")) {
+			interfaces.back().mac = scanner.attribute("address").str();
+		} else if (scanner.path_is("domain/devices/interface/source")) {
+			for (auto attribute : {"bridge", "network", "dev"}) {
+				auto source = scanner.attribute(attribute);
+				if (source.data) {
+					interfaces.back().source = source.str();
+					break;
+				}
+			}
+		} else if (scanner.path_is("domain/devices/interface/model")) {
+			interfaces.back().model = scanner.attribute("type").str();
+		} else if (scanner.path_is("domain/numatune/memory")) {
+			memory_nodeset = scanner.attribute("nodeset").str();
+			memory_mode = scanner.attribute("mode").str();
+		} else if (scanner.path_is("domain/vcpu")) {
+			vcpu_cpuset = scanner.attribute("cpuset").str();
+		} else if (scanner.path_is("domain/cputune/vcpupin")) {
+			vcpupins[scanner.attribute("vcpu").to_ulong()] = scanner.attribute("cpuset").str();
+		}
+	}
+}
+
+bool Domain_inventory::has_non_migratable_devices() const
+{
+	return !hostdevs.empty() || !shmems.empty();
+}
+
+//
+// Domain_inventory_cache implementation
+//
+
+Domain_inventory_cache::Domain_inventory_cache() :
+	event_target(std::make_shared<Event_target>())
+{
+	event_target->cache = this;
+}
+
+Domain_inventory_cache::~Domain_inventory_cache()
+{
+	{
+		// Wait for a callback in progress and ignore later ones.
+		std::lock_guard<std::mutex> lock(event_target->mutex);
+		event_target->cache = nullptr;
+	}
+	std::lock_guard<std::mutex> lock(inventories_mutex);
+	for (const auto &uri_subscription : subscriptions) {
+		const auto &subscription = *uri_subscription.second;
+		for (auto callback_id : {subscription.device_added_callback_id, subscription.device_removed_callback_id, subscription.lifecycle_callback_id}) {
+			if (callback_id != -1)
+				virConnectDomainEventDeregisterAny(subscription.connection.get(), callback_id);
+		}
+	}
+}
+
+bool Domain_inventory_cache::Subscription::is_registered() const
+{
+	return device_added_callback_id != -1 && device_removed_callback_id != -1 && lifecycle_callback_id != -1;
+}
+
+bool Domain_inventory_cache::Subscription::is_active() const
+{
+	return is_registered() && virConnectIsAlive(connection.get()) == 1;
+}
+
+void Domain_inventory_cache::device_callback(virConnectPtr connection, virDomainPtr domain, const char *dev_alias, void *opaque)
+{
+	(void) connection;
+	(void) dev_alias;
+	auto data = static_cast<const Callback_data *>(opaque);
+	std::lock_guard<std::mutex> lock(data->target->mutex);
+	if (data->target->cache)
+		data->target->cache->remove(data->host_uri, domain);
+}
+
+int Domain_inventory_cache::lifecycle_callback(virConnectPtr connection, virDomainPtr domain, int event, int detail, void *opaque)
+{
+	(void) connection;
+	(void) detail;
+	auto data = static_cast<const Callback_data *>(opaque);
+	std::lock_guard<std::mutex> lock(data->target->mutex);
+	if (!data->target->cache)
+		return 0;
+	if (event == VIR_DOMAIN_EVENT_STOPPED || event == VIR_DOMAIN_EVENT_UNDEFINED || event == VIR_DOMAIN_EVENT_DEFINED)
+		data->target->cache->remove(data->host_uri, domain);
+	return 0;
+}
+
+void Domain_inventory_cache::free_callback_data(void *opaque)
+{
+	delete static_cast<Callback_data *>(opaque);
+}
+
+std::unique_ptr<Domain_inventory_cache::Subscription> Domain_inventory_cache::subscribe(virConnectPtr host_connection, const std::string &host_uri) const
+{
+	FASTLIB_LOG(domain_inventory_log, trace) << "Subscribe to domain events of host " << host_uri << ".";
+	std::unique_ptr<Subscription> subscription(new Subscription);
+	// Keep connection open to receive events.
+	virConnectRef(host_connection);
+	subscription->connection.reset(host_connection, Deleter_virConnect());
+	// The callback data is freed by libvirt when the callback is deregistered or the connection is closed.
+	auto register_callback = [&](int event_id, virConnectDomainEventGenericCallback callback)
+	{
+		auto data = new Callback_data{event_target, host_uri};
+		auto callback_id = virConnectDomainEventRegisterAny(host_connection, nullptr, event_id, callback, data, free_callback_data);
+		if (callback_id == -1)
+			delete data;
+		return callback_id;
+	};
+	subscription->device_added_callback_id = register_callback(VIR_DOMAIN_EVENT_ID_DEVICE_ADDED, VIR_DOMAIN_EVENT_CALLBACK(device_callback));
+	subscription->device_removed_callback_id = register_callback(VIR_DOMAIN_EVENT_ID_DEVICE_REMOVED, VIR_DOMAIN_EVENT_CALLBACK(device_callback));
+	subscription->lifecycle_callback_id = register_callback(VIR_DOMAIN_EVENT_ID_LIFECYCLE, VIR_DOMAIN_EVENT_CALLBACK(lifecycle_callback));
+	if (!subscription->is_registered())
+		FASTLIB_LOG(domain_inventory_log, warn) << "Domain events of host " << host_uri << " are not available. "
+			<< "Domain inventories are not cached.";
+	return subscription;
+}
+
+void Domain_inventory_cache::remove(const std::string &host_uri, virDomainPtr domain) const
+{
+	char uuid[VIR_UUID_STRING_BUFLEN];
+	if (virDomainGetUUIDString(domain, uuid) != 0)
+		return;
+	std::lock_guard<std::mutex> lock(inventories_mutex);
+	++generations[host_uri];
+	auto it = inventories.find(host_uri);
+	if (it != inventories.end() && it->second.erase(uuid) != 0)
+		FASTLIB_LOG(domain_inventory_log, trace) << "Drop inventory of domain " << uuid << " on host " << host_uri << ".";
+}
+
+void Domain_inventory_cache::invalidate(virDomainPtr domain) const
+{
+	remove(convert_and_free_cstr(virConnectGetURI(virDomainGetConnect(domain))), domain);
+}
+
+std::shared_ptr<const Domain_inventory> Domain_inventory_cache::get(virDomainPtr domain) const
+{
+	auto connection = virDomainGetConnect(domain);
+	auto host_uri = convert_and_free_cstr(virConnectGetURI(connection));
+	char uuid[VIR_UUID_STRING_BUFLEN];
+	if (virDomainGetUUIDString(domain, uuid) != 0)
+		throw std::runtime_error(std::string("Error getting UUID of domain: ") + virGetLastErrorMessage());
+	std::unique_lock<std::mutex> lock(inventories_mutex);
+	auto &subscription = subscriptions[host_uri];
+	if (subscription && subscription->is_registered() && !subscription->is_active()) {
+		// Events might have been missed, so inventories have to be parsed again.
+		FASTLIB_LOG(domain_inventory_log, trace) << "Connection for domain events of host " << host_uri << " died.";
+		subscription.reset();
+		inventories.erase(host_uri);
+	}
+	// Subscribe before parsing, so that no change is missed.
+	if (!subscription)
+		subscription = subscribe(connection, host_uri);
+	bool cached = subscription->is_active();
+	if (cached) {
+		auto it = inventories[host_uri].find(uuid);
+		if (it != inventories[host_uri].end())
+			return it->second;
+	}
+	auto generation = generations[host_uri];
+	lock.unlock();
+	FASTLIB_LOG(domain_inventory_log, trace) << "Parse inventory of domain " << uuid << " on host " << host_uri << ".";
+	auto inventory = std::make_shared<const Domain_inventory>(get_domain_xml(domain));
+	lock.lock();
+	// Do not cache if an event arrived while parsing, since the inventory might be outdated.
+	if (cached && generation == generations[host_uri])
+		inventories[host_uri][uuid] = inventory;
+	return inventory;
+}
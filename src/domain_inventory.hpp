@@ -0,0 +1,129 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef DOMAIN_INVENTORY_HPP
+#define DOMAIN_INVENTORY_HPP
+
+#include "pci_device_handler.hpp"
+
+#include <libvirt/libvirt.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A network interface of a domain.
+struct Domain_interface
+{
+	std::string type;
+	std::string mac;
+	// Bridge, network or device the interface is connected to.
+	std::string source;
+	std::string model;
+};
+
+/**
+ * \brief The devices and NUMA settings of a domain parsed from its xml description in a single pass by Xml_scanner.
+ */
+struct Domain_inventory
+{
+	explicit Domain_inventory(const std::string &xml_desc);
+
+	/**
+	 * \brief Check for devices which have to be detached for migration (PCI hostdevs and ivshmem).
+	 */
+	bool has_non_migratable_devices() const;
+
+	std::string uuid;
+	std::string name;
+	// Source addresses of the PCI hostdevs.
+	std::vector<PCI_address> hostdevs;
+	// Xml descriptions of the shmem devices.
+	std::vector<std::string> shmems;
+	std::vector<Domain_interface> interfaces;
+	// Nodeset and mode of numatune memory ("" if not set).
+	std::string memory_nodeset;
+	std::string memory_mode;
+	// Cpuset of vcpu ("" if not set).
+	std::string vcpu_cpuset;
+	// (vcpu : cpuset) of cputune vcpupin
+	std::map<unsigned int, std::string> vcpupins;
+};
+
+/**
+ * \brief Caches the inventories of domains, so that all guards of a migration share a single snapshot.
+ *
+ * Inventories are keyed by host and domain UUID, since a domain keeps its UUID when migrated.
+ * An inventory is dropped on device added and device removed events of the domain and when the domain is
+ * stopped or undefined, e.g., after it migrated away. The connection the events are received on is kept open.
+ * If events are not available on a host, the xml description is parsed on every access.
+ * Events are dispatched by Libvirt_event_loop.
+ */
+class Domain_inventory_cache
+{
+public:
+	Domain_inventory_cache();
+	~Domain_inventory_cache();
+	Domain_inventory_cache(const Domain_inventory_cache &) = delete;
+	Domain_inventory_cache & operator=(const Domain_inventory_cache &) = delete;
+
+	/**
+	 * \brief Get the inventory of domain.
+	 */
+	std::shared_ptr<const Domain_inventory> get(virDomainPtr domain) const;
+	/**
+	 * \brief Drop the inventory of domain, e.g., after changing its devices without waiting for the event.
+	 */
+	void invalidate(virDomainPtr domain) const;
+private:
+	// The cache as seen by event callbacks. It is reset on destruction, since callbacks may still be dispatched.
+	struct Event_target
+	{
+		std::mutex mutex;
+		const Domain_inventory_cache *cache;
+	};
+	// Opaque data of a registered event callback, owned and freed by libvirt.
+	struct Callback_data
+	{
+		std::shared_ptr<Event_target> target;
+		std::string host_uri;
+	};
+	// Subscription to the domain events of a host.
+	struct Subscription
+	{
+		bool is_registered() const;
+		bool is_active() const;
+
+		std::shared_ptr<virConnect> connection;
+		int device_added_callback_id = -1;
+		int device_removed_callback_id = -1;
+		int lifecycle_callback_id = -1;
+	};
+
+	static void device_callback(virConnectPtr connection, virDomainPtr domain, const char *dev_alias, void *opaque);
+	static int lifecycle_callback(virConnectPtr connection, virDomainPtr domain, int event, int detail, void *opaque);
+	static void free_callback_data(void *opaque);
+
+	// Expects inventories_mutex to be locked.
+	std::unique_ptr<Subscription> subscribe(virConnectPtr host_connection, const std::string &host_uri) const;
+	void remove(const std::string &host_uri, virDomainPtr domain) const;
+
+	// (hosturi : (uuid : inventory))
+	mutable std::unordered_map<std::string, std::unordered_map<std::string, std::shared_ptr<const Domain_inventory>>> inventories;
+	// (hosturi : number of drops) to detect events which arrived while parsing
+	mutable std::unordered_map<std::string, unsigned long> generations;
+	// (hosturi : subscription)
+	mutable std::unordered_map<std::string, std::unique_ptr<Subscription>> subscriptions;
+	mutable std::mutex inventories_mutex;
+	std::shared_ptr<Event_target> event_target;
+};
+
+#endif
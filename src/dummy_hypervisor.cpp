@@ -29,16 +29,16 @@ void Dummy_hypervisor::stop(const fast::msg::migfra::Stop &task, fast::msg::migf
 		throw std::runtime_error("Dummy_hypervisor is set to throw always if called.");
 }
 
-void Dummy_hypervisor::migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm)
+void Dummy_hypervisor::migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm, Task_report &report)
 {
-	(void) task; (void) time_measurement; (void) comm;
+	(void) task; (void) time_measurement; (void) comm; (void) report;
 	if (!never_throw)
 		throw std::runtime_error("Dummy_hypervisor is set to throw always if called.");
 }
 
-void Dummy_hypervisor::evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm)
+void Dummy_hypervisor::evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm, Task_report &report)
 {
-	(void) task; (void) time_measurement; (void) comm;
+	(void) task; (void) time_measurement; (void) comm; (void) report;
 	if (!never_throw)
 		throw std::runtime_error("Dummy_hypervisor is set to throw always if called.");
 }
@@ -50,6 +50,13 @@ void Dummy_hypervisor::repin(const fast::msg::migfra::Repin &task, fast::msg::mi
 		throw std::runtime_error("Dummy_hypervisor is set to throw always if called.");
 }
 
+void Dummy_hypervisor::repin_threads(const Repin_threads &task, fast::msg::migfra::Time_measurement &time_measurement)
+{
+	(void) task; (void) time_measurement;
+	if (!never_throw)
+		throw std::runtime_error("Dummy_hypervisor is set to throw always if called.");
+}
+
 void Dummy_hypervisor::suspend(const fast::msg::migfra::Suspend &task, fast::msg::migfra::Time_measurement &time_measurement)
 {
 	(void) task; (void) time_measurement;
@@ -64,10 +71,32 @@ void Dummy_hypervisor::resume(const fast::msg::migfra::Resume &task, fast::msg::
 		throw std::runtime_error("Dummy_hypervisor is set to throw always if called.");
 }
 
-std::vector<std::shared_ptr<fast::msg::migfra::Task>> Dummy_hypervisor::get_evacuate_tasks(const fast::msg::migfra::Task_container &task_cont)
+std::vector<std::shared_ptr<fast::msg::migfra::Task>> Dummy_hypervisor::get_evacuate_tasks(const fast::msg::migfra::Task_container &task_cont, std::shared_ptr<fast::Communicator> comm)
 {
 	(void) task_cont;
+	(void) comm;
 	if (!never_throw)
 		throw std::runtime_error("Dummy_hypervisor is set to throw always if called.");
 	return std::vector<std::shared_ptr<fast::msg::migfra::Task>>();
 }
+
+void Dummy_hypervisor::consolidate(const Consolidate &task, std::shared_ptr<fast::Communicator> comm, Consolidation_result &result)
+{
+	(void) task; (void) comm; (void) result;
+	if (!never_throw)
+		throw std::runtime_error("Dummy_hypervisor is set to throw always if called.");
+}
+
+void Dummy_hypervisor::rebalance(const Rebalance &task, std::shared_ptr<fast::Communicator> comm, Rebalance_result &result)
+{
+	(void) task; (void) comm; (void) result;
+	if (!never_throw)
+		throw std::runtime_error("Dummy_hypervisor is set to throw always if called.");
+}
+
+void Dummy_hypervisor::permute(const Permute &task, std::shared_ptr<fast::Communicator> comm, Permutation_result &result)
+{
+	(void) task; (void) comm; (void) result;
+	if (!never_throw)
+		throw std::runtime_error("Dummy_hypervisor is set to throw always if called.");
+}
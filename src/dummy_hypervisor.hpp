@@ -57,11 +57,11 @@ public:
 	 * \param live_migration Enables live migration.
 	 * \param rdma_migration Enables rdma migration.
 	 */
-	void migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm) override;
+	void migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm, Task_report &report) override;
 	/**
 	 * \brief Method to evacuate a host.
 	 */
-	void evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm) override;
+	void evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm, Task_report &report) override;
 	/**
 	 * \brief Method to repin vcpus of a virtual machine.
 	 *
@@ -69,6 +69,13 @@ public:
 	 * Never throws if never_throw is true, else it throws.
 	 */
 	void repin(const fast::msg::migfra::Repin &task, fast::msg::migfra::Time_measurement &time_measurement) override;
+	/**
+	 * \brief Method to repin threads of a virtual machine.
+	 *
+	 * Dummy method that does not do anything.
+	 * Never throws if never_throw is true, else it throws.
+	 */
+	void repin_threads(const Repin_threads &task, fast::msg::migfra::Time_measurement &time_measurement) override;
 	/**
 	 * \brief Method to suspend the execution of a virtual machine.
 	 *
@@ -89,7 +96,28 @@ public:
 	 * Dummy mresume that does not do anything.
 	 * Never throws if never_throw is true, else it throws.
  	 */
-	std::vector<std::shared_ptr<fast::msg::migfra::Task>> get_evacuate_tasks(const fast::msg::migfra::Task_container &task_cont) override;
+	std::vector<std::shared_ptr<fast::msg::migfra::Task>> get_evacuate_tasks(const fast::msg::migfra::Task_container &task_cont, std::shared_ptr<fast::Communicator> comm) override;
+	/**
+	 * \brief Method to consolidate hosts.
+	 *
+	 * Dummy method that does not do anything.
+	 * Never throws if never_throw is true, else it throws.
+	 */
+	void consolidate(const Consolidate &task, std::shared_ptr<fast::Communicator> comm, Consolidation_result &result) override;
+	/**
+	 * \brief Method to rebalance hosts.
+	 *
+	 * Dummy method that does not do anything.
+	 * Never throws if never_throw is true, else it throws.
+	 */
+	void rebalance(const Rebalance &task, std::shared_ptr<fast::Communicator> comm, Rebalance_result &result) override;
+	/**
+	 * \brief Method to permute domains.
+	 *
+	 * Dummy method that does not do anything.
+	 * Never throws if never_throw is true, else it throws.
+	 */
+	void permute(const Permute &task, std::shared_ptr<fast::Communicator> comm, Permutation_result &result) override;
 private:
 	const bool never_throw;
 };
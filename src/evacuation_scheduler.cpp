@@ -0,0 +1,194 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "evacuation_scheduler.hpp"
+
+#include <fast-lib/log.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+FASTLIB_LOG_INIT(evacuation_scheduler_log, "Evacuation_scheduler")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(evacuation_scheduler_log, trace);
+
+Evacuation_scheduler::Evacuation_scheduler(const std::string &order, unsigned int max_per_destination, unsigned int max_per_nic) :
+	order(order),
+	max_per_destination(max_per_destination),
+	max_per_nic(max_per_nic),
+	start(std::chrono::steady_clock::now())
+{
+	if (order != "largest-first" && order != "smallest-first" && order != "none")
+		throw std::invalid_argument("Unknown evacuation order: " + order);
+}
+
+void Evacuation_scheduler::add(const std::string &domain, double predicted_duration, const std::string &destination)
+{
+	std::lock_guard<std::mutex> lock(entries_mutex);
+	Entry entry{domain, predicted_duration, destination, "", State::pending};
+	// Insert after all entries of equal priority to keep the order of registration for ties.
+	auto pos = entries.end();
+	if (order == "largest-first") {
+		pos = std::upper_bound(entries.begin(), entries.end(), entry,
+				[](const Entry &lhs, const Entry &rhs){return lhs.predicted_duration > rhs.predicted_duration;});
+	} else if (order == "smallest-first") {
+		pos = std::upper_bound(entries.begin(), entries.end(), entry,
+				[](const Entry &lhs, const Entry &rhs){return lhs.predicted_duration < rhs.predicted_duration;});
+	}
+	entries.insert(pos, std::move(entry));
+}
+
+double Evacuation_scheduler::predict_makespan() const
+{
+	std::lock_guard<std::mutex> lock(entries_mutex);
+	struct Running
+	{
+		double end;
+		std::string destination;
+	};
+	std::vector<bool> started(entries.size(), false);
+	std::vector<Running> running;
+	std::unordered_map<std::string, unsigned int> per_destination;
+	size_t remaining = entries.size();
+	double time = 0;
+	while (remaining != 0) {
+		// Start domains in order of priority, skipping those without free slot
+		for (size_t i = 0; i != entries.size(); ++i) {
+			const auto &entry = entries[i];
+			if (started[i])
+				continue;
+			if (max_per_nic != 0 && running.size() >= max_per_nic)
+				break;
+			bool destination_limited = max_per_destination != 0 && entry.destination != "";
+			if (destination_limited && per_destination[entry.destination] >= max_per_destination)
+				continue;
+			started[i] = true;
+			--remaining;
+			running.push_back(Running{time + entry.predicted_duration, entry.destination});
+			if (destination_limited)
+				++per_destination[entry.destination];
+		}
+		// Advance to the next migration finishing
+		auto next = std::min_element(running.begin(), running.end(),
+				[](const Running &lhs, const Running &rhs){return lhs.end < rhs.end;});
+		if (next == running.end())
+			break;
+		time = next->end;
+		if (max_per_destination != 0 && next->destination != "")
+			--per_destination[next->destination];
+		running.erase(next);
+	}
+	for (const auto &r : running)
+		time = std::max(time, r.end);
+	return time;
+}
+
+std::vector<std::string> Evacuation_scheduler::get_domains() const
+{
+	std::lock_guard<std::mutex> lock(entries_mutex);
+	std::vector<std::string> domains;
+	for (const auto &entry : entries)
+		domains.push_back(entry.domain);
+	return domains;
+}
+
+bool Evacuation_scheduler::has_free_slot(const Entry &entry) const
+{
+	auto destination = running_per_destination.find(entry.destination);
+	auto nic = running_per_nic.find(entry.nic);
+	return (max_per_destination == 0 || destination == running_per_destination.end() || destination->second < max_per_destination) &&
+		(max_per_nic == 0 || nic == running_per_nic.end() || nic->second < max_per_nic);
+}
+
+bool Evacuation_scheduler::may_start(const Entry &entry) const
+{
+	if (!has_free_slot(entry))
+		return false;
+	for (const auto &other : entries) {
+		if (&other == &entry)
+			return true;
+		// A waiting domain of higher priority competing for the same slot has precedence.
+		// Domains which did not request a slot yet do not hold back others.
+		bool competing = other.destination == entry.destination || other.nic == entry.nic;
+		if (other.state == State::waiting && competing && has_free_slot(other))
+			return false;
+	}
+	return true;
+}
+
+std::vector<Evacuation_scheduler::Entry>::iterator Evacuation_scheduler::find(const std::string &domain)
+{
+	auto it = std::find_if(entries.begin(), entries.end(),
+			[&domain](const Entry &entry){return entry.domain == domain;});
+	if (it == entries.end())
+		throw std::logic_error("Domain " + domain + " is not scheduled.");
+	return it;
+}
+
+void Evacuation_scheduler::acquire(const std::string &domain, const std::string &destination, const std::string &nic)
+{
+	std::unique_lock<std::mutex> lock(entries_mutex);
+	auto it = find(domain);
+	auto &entry = *it;
+	entry.destination = destination;
+	entry.nic = nic;
+	entry.state = State::waiting;
+	// Arrival may allow domains of lower priority to start.
+	entries_cv.notify_all();
+	FASTLIB_LOG(evacuation_scheduler_log, trace) << "Domain " << domain << " waits for slot on " << destination << " via " << nic << ".";
+	entries_cv.wait(lock, [this, &entry]{return may_start(entry);});
+	entry.state = State::running;
+	++running_per_destination[destination];
+	++running_per_nic[nic];
+	FASTLIB_LOG(evacuation_scheduler_log, trace) << "Domain " << domain << " starts after " << get_elapsed() << " s.";
+}
+
+bool Evacuation_scheduler::finish(const std::string &domain)
+{
+	std::lock_guard<std::mutex> lock(entries_mutex);
+	auto &entry = *find(domain);
+	if (entry.state == State::running) {
+		--running_per_destination[entry.destination];
+		--running_per_nic[entry.nic];
+	}
+	entry.state = State::done;
+	entries_cv.notify_all();
+	return std::all_of(entries.begin(), entries.end(), [](const Entry &e){return e.state == State::done;});
+}
+
+double Evacuation_scheduler::get_elapsed() const
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+Evacuation_slot::Evacuation_slot(Evacuation_scheduler &scheduler, std::string domain) :
+	scheduler(scheduler),
+	domain(std::move(domain))
+{
+}
+
+Evacuation_slot::~Evacuation_slot()
+{
+	if (!finished) {
+		try {
+			scheduler.finish(domain);
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(evacuation_scheduler_log, trace) << "Exception while finishing domain: " << e.what();
+		}
+	}
+}
+
+void Evacuation_slot::acquire(const std::string &destination, const std::string &nic)
+{
+	scheduler.acquire(domain, destination, nic);
+}
+
+bool Evacuation_slot::finish()
+{
+	finished = true;
+	return scheduler.finish(domain);
+}
@@ -0,0 +1,122 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef EVACUATION_SCHEDULER_HPP
+#define EVACUATION_SCHEDULER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * \brief Decides when the migrations of an evacuation may start.
+ *
+ * Domains are prioritized by their predicted migration time ("largest-first" minimizes the makespan,
+ * "smallest-first" relieves the node of as many domains as early as possible, "none" keeps the order of registration).
+ * A migration starts as soon as its destination and the source NIC it uses have a free slot,
+ * regardless of domains of higher priority which did not request a slot yet.
+ * The priority only decides which of the waiting domains competing for a free slot starts first.
+ */
+class Evacuation_scheduler
+{
+public:
+	/**
+	 * \param order One of "largest-first", "smallest-first" or "none".
+	 * \param max_per_destination Concurrent migrations per destination (0: unlimited).
+	 * \param max_per_nic Concurrent migrations per source NIC (0: unlimited).
+	 */
+	Evacuation_scheduler(const std::string &order, unsigned int max_per_destination, unsigned int max_per_nic);
+
+	/**
+	 * \brief Register a domain with its predicted migration time in seconds.
+	 *
+	 * All domains have to be registered before the first one acquires a slot.
+	 * \param destination The planned destination or an empty string if it is chosen later.
+	 */
+	void add(const std::string &domain, double predicted_duration, const std::string &destination = "");
+	/**
+	 * \brief Simulate the schedule of all registered domains assuming the predicted migration times.
+	 *
+	 * All migrations are assumed to use the same NIC. Domains without planned destination are only limited by the NIC.
+	 */
+	double predict_makespan() const;
+	/**
+	 * \brief Get the registered domains in order of priority.
+	 */
+	std::vector<std::string> get_domains() const;
+	/**
+	 * \brief Block until the domain may migrate to destination using nic.
+	 */
+	void acquire(const std::string &domain, const std::string &destination, const std::string &nic);
+	/**
+	 * \brief Mark the migration of domain as done (successful or not) and free its slot.
+	 *
+	 * Also called for domains which never acquired a slot, so that they do not block others.
+	 * \returns True if this was the last domain of the evacuation.
+	 */
+	bool finish(const std::string &domain);
+	/**
+	 * \brief Get the time since the scheduler was created in seconds.
+	 */
+	double get_elapsed() const;
+private:
+	enum class State {pending, waiting, running, done};
+
+	struct Entry
+	{
+		std::string domain;
+		double predicted_duration;
+		std::string destination;
+		std::string nic;
+		State state;
+	};
+
+	bool has_free_slot(const Entry &entry) const;
+	bool may_start(const Entry &entry) const;
+	std::vector<Entry>::iterator find(const std::string &domain);
+
+	std::string order;
+	unsigned int max_per_destination;
+	unsigned int max_per_nic;
+	// Sorted by priority
+	std::vector<Entry> entries;
+	std::unordered_map<std::string, unsigned int> running_per_destination;
+	std::unordered_map<std::string, unsigned int> running_per_nic;
+	std::chrono::steady_clock::time_point start;
+	mutable std::mutex entries_mutex;
+	std::condition_variable entries_cv;
+};
+
+/**
+ * \brief RAII-guard which finishes a domain in the scheduler on destruction.
+ */
+class Evacuation_slot
+{
+public:
+	Evacuation_slot(Evacuation_scheduler &scheduler, std::string domain);
+	~Evacuation_slot();
+	Evacuation_slot(const Evacuation_slot &) = delete;
+	Evacuation_slot & operator=(const Evacuation_slot &) = delete;
+
+	void acquire(const std::string &destination, const std::string &nic);
+	/**
+	 * \brief Finish the domain now.
+	 *
+	 * \returns True if this was the last domain of the evacuation.
+	 */
+	bool finish();
+private:
+	Evacuation_scheduler &scheduler;
+	std::string domain;
+	bool finished = false;
+};
+
+#endif
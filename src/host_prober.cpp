@@ -0,0 +1,162 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "host_prober.hpp"
+
+#include "utility.hpp"
+
+#include <fast-lib/log.hpp>
+
+#include <exception>
+#include <future>
+#include <memory>
+#include <thread>
+
+FASTLIB_LOG_INIT(host_prober_log, "Host_prober")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(host_prober_log, trace);
+
+static std::string get_cache_key(const std::string &scope, const std::string &host)
+{
+	return scope + "|" + host;
+}
+
+// Probes of a host still running after their timeout, beyond which the host is dropped without probing.
+static const unsigned int max_timed_out_probes_per_host = 2;
+
+// State of a single probe shared between the caller and the probe thread.
+struct Probe_state
+{
+	std::promise<Host_resources> promise;
+	// Both guarded by the mutex of Timed_out_probes
+	bool finished;
+	bool timed_out;
+};
+
+Host_prober::Host_prober(std::chrono::milliseconds timeout, std::chrono::milliseconds ttl, unsigned int max_parallel) :
+	timeout(timeout),
+	ttl(ttl),
+	max_parallel(max_parallel),
+	timed_out_probes(std::make_shared<Timed_out_probes>())
+{
+}
+
+std::vector<Host_resources> Host_prober::probe_all(const std::vector<std::string> &hosts, const Probe &probe, const std::string &scope,
+		std::chrono::milliseconds probe_duration)
+{
+	auto now = clock::now();
+	auto deadline = now + timeout + probe_duration;
+	// Start probes of hosts without valid cache entry
+	std::vector<std::future<Host_resources>> futures(hosts.size());
+	std::vector<bool> cached(hosts.size(), false);
+	std::vector<Host_resources> results(hosts.size());
+	std::vector<unsigned long long> probe_generations(hosts.size(), 0);
+	{
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		for (size_t i = 0; i != hosts.size(); ++i) {
+			auto it = cache.find(get_cache_key(scope, hosts[i]));
+			if (it != cache.end() && now - it->second.time < ttl) {
+				FASTLIB_LOG(host_prober_log, trace) << "Use cached probe of " << hosts[i] << ".";
+				results[i] = it->second.resources;
+				cached[i] = true;
+			} else {
+				probe_generations[i] = generations[hosts[i]];
+			}
+		}
+	}
+	std::vector<bool> skipped(hosts.size(), false);
+	{
+		std::lock_guard<std::mutex> lock(timed_out_probes->mutex);
+		for (size_t i = 0; i != hosts.size(); ++i)
+			skipped[i] = !cached[i] && timed_out_probes->count[hosts[i]] >= max_timed_out_probes_per_host;
+	}
+	std::vector<std::shared_ptr<Probe_state>> states(hosts.size());
+	std::vector<std::function<void()>> jobs;
+	for (size_t i = 0; i != hosts.size(); ++i) {
+		if (cached[i] || skipped[i])
+			continue;
+		// The state is shared with the probe thread, so that the thread may outlive this call.
+		auto state = std::make_shared<Probe_state>();
+		state->finished = false;
+		state->timed_out = false;
+		futures[i] = state->promise.get_future();
+		states[i] = state;
+		auto host = hosts[i];
+		auto timed_out_probes = this->timed_out_probes;
+		jobs.push_back([state, probe, host, timed_out_probes]
+		{
+			{
+				std::lock_guard<std::mutex> lock(timed_out_probes->mutex);
+				// Do not start a probe nobody waits for anymore
+				if (state->timed_out) {
+					--timed_out_probes->count[host];
+					return;
+				}
+			}
+			try {
+				state->promise.set_value(probe(host));
+			} catch (...) {
+				state->promise.set_exception(std::current_exception());
+			}
+			std::lock_guard<std::mutex> lock(timed_out_probes->mutex);
+			state->finished = true;
+			if (state->timed_out)
+				--timed_out_probes->count[host];
+		});
+	}
+	// Run the probes by a bounded number of threads in a detached thread, so that hanging probes do not block this call.
+	if (!jobs.empty()) {
+		auto max_parallel = this->max_parallel;
+		std::thread([jobs, max_parallel]{run_bounded(jobs, max_parallel);}).detach();
+	}
+	// Collect results
+	std::vector<Host_resources> reachable;
+	for (size_t i = 0; i != hosts.size(); ++i) {
+		if (skipped[i]) {
+			FASTLIB_LOG(host_prober_log, warn) << "Previous probes of " << hosts[i] << " still hang. Dropping host.";
+			continue;
+		}
+		if (!cached[i]) {
+			if (futures[i].wait_until(deadline) != std::future_status::ready) {
+				std::lock_guard<std::mutex> lock(timed_out_probes->mutex);
+				// The probe might have finished in the meantime
+				if (!states[i]->finished) {
+					states[i]->timed_out = true;
+					++timed_out_probes->count[hosts[i]];
+					FASTLIB_LOG(host_prober_log, warn) << "Probing " << hosts[i] << " timed out. Dropping host.";
+					continue;
+				}
+			}
+			try {
+				results[i] = futures[i].get();
+			} catch (const std::exception &e) {
+				FASTLIB_LOG(host_prober_log, warn) << "Probing " << hosts[i] << " failed: " << e.what() << " Dropping host.";
+				continue;
+			}
+			std::lock_guard<std::mutex> lock(cache_mutex);
+			// The result might be outdated if the host was invalidated while probing
+			if (generations[hosts[i]] == probe_generations[i])
+				cache[get_cache_key(scope, hosts[i])] = Cache_entry{results[i], now};
+			else
+				FASTLIB_LOG(host_prober_log, trace) << hosts[i] << " was invalidated while probing. Do not cache probe.";
+		}
+		reachable.push_back(results[i]);
+	}
+	return reachable;
+}
+
+void Host_prober::invalidate(const std::string &host)
+{
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	++generations[host];
+	for (auto it = cache.begin(); it != cache.end();) {
+		if (it->second.resources.name == host)
+			it = cache.erase(it);
+		else
+			++it;
+	}
+}
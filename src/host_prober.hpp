@@ -0,0 +1,81 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef HOST_PROBER_HPP
+#define HOST_PROBER_HPP
+
+#include "placement.hpp"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * \brief Probes the resources of destination hosts in parallel and caches the results for a short time.
+ *
+ * The probes run by a bounded number of detached threads, so that a hanging connection does not block the caller beyond
+ * the timeout. Hosts which fail or time out are dropped from the result with a warning.
+ * Probes still running after their timeout are counted per host. A host with too many of them is not probed again
+ * until one returns, so that hanging hosts do not accumulate threads.
+ */
+class Host_prober
+{
+public:
+	using Probe = std::function<Host_resources(const std::string &host)>;
+
+	/**
+	 * \param timeout The time all probes of one call may take.
+	 * \param ttl The time a probe result is reused. 0 disables caching.
+	 * \param max_parallel Probes of one call run concurrently (0: one thread per host).
+	 */
+	Host_prober(std::chrono::milliseconds timeout, std::chrono::milliseconds ttl, unsigned int max_parallel = 0);
+
+	/**
+	 * \brief Get the resources of all reachable hosts in the order of hosts.
+	 *
+	 * \param scope Distinguishes probes of the same host which return different results, e.g., using other drivers.
+	 * \param probe_duration The time the probe itself takes, e.g., for sampling, which extends the timeout.
+	 */
+	std::vector<Host_resources> probe_all(const std::vector<std::string> &hosts, const Probe &probe, const std::string &scope = "",
+			std::chrono::milliseconds probe_duration = std::chrono::milliseconds(0));
+	/**
+	 * \brief Drop cached results of host, e.g., after a domain was migrated to it.
+	 */
+	void invalidate(const std::string &host);
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct Cache_entry
+	{
+		Host_resources resources;
+		clock::time_point time;
+	};
+
+	std::chrono::milliseconds timeout;
+	std::chrono::milliseconds ttl;
+	unsigned int max_parallel;
+	// ((scope, host) : result)
+	std::unordered_map<std::string, Cache_entry> cache;
+	// (host : number of invalidations), so that probes started before an invalidation are not cached
+	std::unordered_map<std::string, unsigned long long> generations;
+	std::mutex cache_mutex;
+	// Shared with the probe threads, since they may outlive the prober.
+	struct Timed_out_probes
+	{
+		std::mutex mutex;
+		// (host : number of probes still running after their timeout)
+		std::unordered_map<std::string, unsigned int> count;
+	};
+	std::shared_ptr<Timed_out_probes> timed_out_probes;
+};
+
+#endif
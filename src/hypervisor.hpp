@@ -13,6 +13,8 @@
 #include <fast-lib/message/migfra/pci_id.hpp>
 #include <fast-lib/message/migfra/time_measurement.hpp>
 #include <fast-lib/communicator.hpp>
+#include "task_report.hpp"
+#include "local_task.hpp"
 using PCI_id = fast::msg::migfra::PCI_id;
 using Time_measurement = fast::msg::migfra::Time_measurement;
 
@@ -55,18 +57,23 @@ public:
 	 * \param dest_hostname The name of the host to migrate to.
 	 * \param live_migration Enables live migration.
 	 * \param rdma_migration Enables rdma migration.
+	 * \param report Collects additional information returned in the details of the result.
 	 */
-	virtual void migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm) = 0;
+	virtual void migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm, Task_report &report) = 0;
 	/**
 	 * \brief Method to evacuate a host.
 	 */
-	virtual void evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm) = 0;
+	virtual void evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm, Task_report &report) = 0;
 	/**
 	 * \brief Method to repin vcpus of a virtual machine.
 	 *
 	 * Calls libvirt API to reassign CPUs to VCPUs.
 	 */
 	virtual void repin(const fast::msg::migfra::Repin &task, fast::msg::migfra::Time_measurement &time_measurement) = 0;
+	/**
+	 * \brief Method to repin vcpus, emulator threads and iothreads of a virtual machine.
+	 */
+	virtual void repin_threads(const Repin_threads &task, fast::msg::migfra::Time_measurement &time_measurement) = 0;
 	/**
 	 * \brief Method to suspend the execution of a virtual machine.
 	 *
@@ -81,8 +88,26 @@ public:
 	virtual void resume(const fast::msg::migfra::Resume &task, fast::msg::migfra::Time_measurement &time_measurement) = 0;
 	/**
  	 * \brief Method to generate a task list for Evacuate.
+ 	 *
+ 	 * The communicator may be used to announce the planned placement before any migration starts.
  	 */
-	virtual std::vector<std::shared_ptr<fast::msg::migfra::Task>> get_evacuate_tasks(const fast::msg::migfra::Task_container &task_cont) = 0;
+	virtual std::vector<std::shared_ptr<fast::msg::migfra::Task>> get_evacuate_tasks(const fast::msg::migfra::Task_container &task_cont, std::shared_ptr<fast::Communicator> comm) = 0;
+	/**
+	 * \brief Method to consolidate the domains of several hosts onto as few of them as possible.
+	 *
+	 * Errors of single migrations are returned in the results, so that the freed hosts are reported anyway.
+	 */
+	virtual void consolidate(const Consolidate &task, std::shared_ptr<fast::Communicator> comm, Consolidation_result &result) = 0;
+	/**
+	 * \brief Method to bring the cpu utilization of several hosts under a target.
+	 *
+	 * Errors of single migrations are returned in the results.
+	 */
+	virtual void rebalance(const Rebalance &task, std::shared_ptr<fast::Communicator> comm, Rebalance_result &result) = 0;
+	/**
+	 * \brief Method to move domains around a cycle of hosts.
+	 */
+	virtual void permute(const Permute &task, std::shared_ptr<fast::Communicator> comm, Permutation_result &result) = 0;
 };
 
 #endif
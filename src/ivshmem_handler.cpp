@@ -1,21 +1,24 @@
 #include "ivshmem_handler.hpp"
 
 #include "utility.hpp"
-#include "device_utility.hpp"
+#include "domain_inventory.hpp"
+#include "xml_scanner.hpp"
 
 #include <fast-lib/log.hpp>
 #include <libvirt/virterror.h>
 
+#include <functional>
 #include <regex>
 #include <iostream>
 
 FASTLIB_LOG_INIT(ivshmem_handler_log, "Ivshmem_handler")
 FASTLIB_LOG_SET_LEVEL_GLOBAL(ivshmem_handler_log, trace);
 
-Ivshmem_device::Ivshmem_device(std::string id, std::string size, std::string unit) :
+Ivshmem_device::Ivshmem_device(std::string id, std::string size, std::string unit, std::string model) :
 	id(std::move(id)),
 	size(std::move(size)),
-	unit(std::move(unit))
+	unit(std::move(unit)),
+	model(std::move(model))
 {
 }
 
@@ -26,43 +29,41 @@ Ivshmem_device::Ivshmem_device(const std::string &xml_desc)
 
 void Ivshmem_device::from_xml(const std::string &xml_desc)
 {
-	auto pt = read_xml_from_string(xml_desc);
-	if (pt.count("shmem") == 1) {
-		id = pt.get<decltype(id)>("shmem.<xmlattr>.name");
-		size = pt.get<decltype(size)>("shmem.size");
-		unit = pt.get<decltype(unit)>("shmem.size.<xmlattr>.unit");
-		if (pt.get_child("shmem").count("address") == 1) {
-			pt_pci = pt.get_child("shmem.address");
-		}
-	} else {
-		id = pt.get<decltype(id)>("alias.<xmlattr>.name");
-		size = pt.get<decltype(size)>("size");
-		unit = pt.get<decltype(unit)>("size.<xmlattr>.unit");
-		if (pt.count("address") == 1) {
-			pt_pci = pt.get_child("address");
+	Xml_scanner scanner(xml_desc);
+	for (auto token = scanner.next(); token != Xml_scanner::Token::end_of_document; token = scanner.next()) {
+		if (token != Xml_scanner::Token::start_element)
+			continue;
+		if (scanner.path_is("shmem")) {
+			id = scanner.attribute("name").str();
+		} else if (scanner.path_is("shmem/size")) {
+			unit = scanner.attribute("unit").str();
+			size = scanner.read_text().str();
+		} else if (scanner.path_is("shmem/model")) {
+			model = scanner.attribute("type").str();
+		} else if (scanner.path_is("shmem/server")) {
+			auto server = scanner.read_element();
+			server_xml.assign(server.data, server.size);
+		} else if (scanner.path_is("shmem/address")) {
+			auto address = scanner.read_element();
+			address_xml.assign(address.data, address.size);
 		}
 	}
+	if (id.empty() || size.empty())
+		throw std::runtime_error("Shmem xml is missing name or size.");
 }
 
 std::string Ivshmem_device::to_xml() const
 {
-/*	static const std::string new_template = "\
-<shmem name='@id'>\n\
-	<model type='ivshmem-plain'/>\n\
-	<size unit='M'>@size</size>\n\
-	<alias name='@id'/>\n\
-</shmem>\n\
-	";
-*/
-	boost::property_tree::ptree pt;
-	pt.put("shmem.<xmlattr>.name", id);
-	pt.put("shmem.model.<xmlattr>.type", "ivshmem-plain");
-	pt.put("shmem.size.<xmlattr>.unit", unit);
-	pt.put("shmem.size", size);
-	pt.put("shmem.alias.<xmlattr>.name", id);
-	if (!pt_pci.empty())
-		pt.put_child("shmem.address", pt_pci);
-	return write_xml_to_string(pt);
+	std::string xml = "<shmem name='" + xml_escape(id) + "'>\n";
+	if (!model.empty())
+		xml += "\t<model type='" + xml_escape(model) + "'/>\n";
+	xml += "\t<size unit='" + xml_escape(unit) + "'>" + xml_escape(size) + "</size>\n"
+		"\t<alias name='" + xml_escape(id) + "'/>\n";
+	if (!server_xml.empty())
+		xml += "\t" + server_xml + "\n";
+	if (!address_xml.empty())
+		xml += "\t" + address_xml + "\n";
+	return xml + "</shmem>\n";
 }
 
 void attach_ivshmem_device(virDomainPtr domain, const Ivshmem_device &device)
@@ -73,17 +74,19 @@ void attach_ivshmem_device(virDomainPtr domain, const Ivshmem_device &device)
 		throw std::runtime_error(std::string("Could not attach ivshmem device. ") + virGetLastErrorMessage());
 }
 
-Migrate_ivshmem_guard::Migrate_ivshmem_guard(std::shared_ptr<virDomain> domain, Time_measurement &time_measurement, std::string tag_postfix) :
+Migrate_ivshmem_guard::Migrate_ivshmem_guard(std::shared_ptr<virDomain> domain, const Domain_inventory &inventory, Time_measurement &time_measurement, std::string tag_postfix,
+		unsigned int max_parallel_operations) :
 	domain(domain),
 	time_measurement(time_measurement),
-	tag_postfix(std::move(tag_postfix))
+	tag_postfix(std::move(tag_postfix)),
+	max_parallel_operations(max_parallel_operations)
 {
 	if (this->tag_postfix != "")
 		this->tag_postfix = "-" + this->tag_postfix;
 	FASTLIB_LOG(ivshmem_handler_log, trace) << "Detach all devices.";
-	time_measurement.tick("detach-ivshmem-devs" + tag_postfix);
-	detach();
-	time_measurement.tock("detach-ivshmem-devs" + tag_postfix);
+	tick_synchronized(time_measurement, "detach-ivshmem-devs" + this->tag_postfix);
+	detach(inventory);
+	tock_synchronized(time_measurement, "detach-ivshmem-devs" + this->tag_postfix);
 }
 
 Migrate_ivshmem_guard::~Migrate_ivshmem_guard() noexcept(false)
@@ -105,35 +108,79 @@ void Migrate_ivshmem_guard::set_destination_domain(std::shared_ptr<virDomain> de
 	domain = dest_domain;
 }
 
-void Migrate_ivshmem_guard::detach()
+bool Migrate_ivshmem_guard::has_detached_devices() const
 {
-	auto domain_ptree = read_xml_from_string(get_domain_xml(domain.get()));
-	auto attached_devices = domain_ptree.get_child("domain.devices");
-	
-	for (const auto &device : attached_devices) {
-		if (device.first == "shmem") {
-			detached_devices.emplace_back(write_xml_to_string(device.second));
-		}
-	}
-	if (detached_devices.size() == 0) {
+	return !detached_devices.empty();
+}
+
+void Migrate_ivshmem_guard::detach(const Domain_inventory &inventory)
+{
+	std::vector<Ivshmem_device> devices;
+	for (const auto &shmem : inventory.shmems)
+		devices.emplace_back(shmem);
+	if (devices.empty()) {
 		FASTLIB_LOG(ivshmem_handler_log, trace) << "Could not find any attached ivshmem devices.";
-	} else {
-		if (detached_devices.size() > 1) 
-			throw std::runtime_error("Found more than one ivshmem device. Only migration of one is supported.");
-		FASTLIB_LOG(ivshmem_handler_log, trace) << "Detaching device: " << detached_devices.front().to_xml();
-		if (virDomainDetachDevice(domain.get(), detached_devices.front().to_xml().c_str()) != 0) {
-			throw std::runtime_error(std::string("Error detaching device. ") + virGetLastErrorMessage());
+		return;
+	}
+	FASTLIB_LOG(ivshmem_handler_log, trace) << "Detach " << devices.size() << " ivshmem devices.";
+	// Not std::vector<bool>, since elements are written concurrently.
+	std::vector<char> detached(devices.size(), false);
+	std::vector<std::function<void()>> operations;
+	for (size_t i = 0; i != devices.size(); ++i) {
+		operations.push_back([this, i, &devices, &detached]
+		{
+			const auto &device = devices[i];
+			const auto tag = "detach-ivshmem-dev-" + device.id + tag_postfix;
+			FASTLIB_LOG(ivshmem_handler_log, trace) << "Detaching device: " << device.to_xml();
+			tick_synchronized(time_measurement, tag);
+			if (virDomainDetachDevice(domain.get(), device.to_xml().c_str()) != 0)
+				throw std::runtime_error("Error detaching ivshmem device " + device.id + ". " + virGetLastErrorMessage());
+			tock_synchronized(time_measurement, tag);
+			detached[i] = true;
+		});
+	}
+	try {
+		run_all_bounded(operations, max_parallel_operations);
+	} catch (...) {
+		// Roll back by reattaching the devices which were detached.
+		std::vector<Ivshmem_device> rollback;
+		for (size_t i = 0; i != devices.size(); ++i) {
+			if (detached[i])
+				rollback.push_back(devices[i]);
+		}
+		FASTLIB_LOG(ivshmem_handler_log, trace) << "Detaching failed. Reattach " << rollback.size() << " detached devices.";
+		try {
+			attach(rollback, false);
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(ivshmem_handler_log, warn) << "Error during rollback of detaching ivshmem devices: " << e.what();
 		}
+		throw;
 	}
+	detached_devices = std::move(devices);
 }
 
-void Migrate_ivshmem_guard::reattach()
+void Migrate_ivshmem_guard::attach(const std::vector<Ivshmem_device> &devices, bool measure)
 {
-	if (detached_devices.size() > 0) {
-		if (detached_devices.size() != 1)
-			throw std::runtime_error("Wrong number of detached ivshmem devices: " + std::to_string(detached_devices.size()));
-		time_measurement.tick("reattach-ivshmem-devs" + tag_postfix);
-		attach_ivshmem_device(domain.get(), detached_devices.front());
-		time_measurement.tock("reattach-ivshmem-devs" + tag_postfix);
+	std::vector<std::function<void()>> operations;
+	for (const auto &device : devices) {
+		operations.push_back([this, &device, measure]
+		{
+			const auto tag = "reattach-ivshmem-dev-" + device.id + tag_postfix;
+			if (measure)
+				tick_synchronized(time_measurement, tag);
+			attach_ivshmem_device(domain.get(), device);
+			if (measure)
+				tock_synchronized(time_measurement, tag);
+		});
 	}
-}	
+	run_all_bounded(operations, max_parallel_operations);
+}
+
+void Migrate_ivshmem_guard::reattach()
+{
+	if (detached_devices.empty())
+		return;
+	tick_synchronized(time_measurement, "reattach-ivshmem-devs" + tag_postfix);
+	attach(detached_devices, true);
+	tock_synchronized(time_measurement, "reattach-ivshmem-devs" + tag_postfix);
+}
@@ -12,7 +12,6 @@
 #include <fast-lib/message/migfra/time_measurement.hpp>
 
 #include <libvirt/libvirt.h>
-#include <boost/property_tree/ptree.hpp>
 
 #include <string>
 #include <vector>
@@ -20,13 +19,15 @@
 
 using Time_measurement = fast::msg::migfra::Time_measurement;
 
+struct Domain_inventory;
+
 /**
  * \brief A struct representing an ivshmem device.
  */
 struct Ivshmem_device
 {
 
-	Ivshmem_device(std::string id, std::string size, std::string unit = "M");
+	Ivshmem_device(std::string id, std::string size, std::string unit = "M", std::string model = "ivshmem-plain");
 	Ivshmem_device(const std::string &xml_desc);
 
 	void from_xml(const std::string &xml_desc);
@@ -35,7 +36,12 @@ struct Ivshmem_device
 	std::string id;
 	std::string size;
 	std::string unit;
-	boost::property_tree::ptree pt_pci;
+	// Model type, e.g., ivshmem-plain or ivshmem-doorbell ("" uses the default of libvirt).
+	std::string model;
+	// Xml of the server element of an ivshmem-doorbell device ("" if none).
+	std::string server_xml;
+	// Xml of the PCI address element of the device ("" if unknown).
+	std::string address_xml;
 };
 
 /**
@@ -46,23 +52,36 @@ void attach_ivshmem_device(virDomainPtr domain, const Ivshmem_device &device);
 /**
  * \brief RAII-guard which detaches ivshmem devices in constructor and reattaches in destructor.
  *
+ * All ivshmem devices of a domain are detached and reattached concurrently and keep their PCI addresses.
+ * Each operation is measured with the tag "detach-ivshmem-dev-<name><tag_postfix>" or
+ * "reattach-ivshmem-dev-<name><tag_postfix>" respectively.
  * If no error occures during migration, the destination domain should be set.
  */
 class Migrate_ivshmem_guard
 {
 public:
-	Migrate_ivshmem_guard(std::shared_ptr<virDomain> domain, Time_measurement &time_measurement, std::string tag_postfix = "");
+	/**
+	 * \brief Detach the shmem devices listed in inventory, a snapshot of domain's devices.
+	 *
+	 * If a device cannot be detached, the devices which were detached are reattached and the error is rethrown.
+	 * \param max_parallel_operations Detach/reattach operations run concurrently (0: unlimited).
+	 */
+	Migrate_ivshmem_guard(std::shared_ptr<virDomain> domain, const Domain_inventory &inventory, Time_measurement &time_measurement, std::string tag_postfix = "", unsigned int max_parallel_operations = 0);
 	~Migrate_ivshmem_guard() noexcept(false);
 
 	void set_destination_domain(std::shared_ptr<virDomain> dest_domain);
+	bool has_detached_devices() const;
 private:
-	void detach();
+	void detach(const Domain_inventory &inventory);
+	// Attach devices concurrently and rethrow the first error after all were tried.
+	void attach(const std::vector<Ivshmem_device> &devices, bool measure);
 	void reattach();
 
 	std::shared_ptr<virDomain> domain;
 	std::vector<Ivshmem_device> detached_devices;
 	Time_measurement &time_measurement;
 	std::string tag_postfix;
+	unsigned int max_parallel_operations;
 };
 
 #endif
@@ -0,0 +1,50 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "libvirt_event_loop.hpp"
+
+#include <fast-lib/log.hpp>
+#include <libvirt/libvirt.h>
+
+#include <mutex>
+#include <stdexcept>
+
+FASTLIB_LOG_INIT(event_loop_log, "Libvirt_event_loop")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(event_loop_log, trace);
+
+Libvirt_event_loop::Libvirt_event_loop() :
+	running(true)
+{
+	// The default implementation may only be registered once per process.
+	static std::once_flag registered;
+	std::call_once(registered, []
+	{
+		if (virEventRegisterDefaultImpl() != 0)
+			throw std::runtime_error("Failed to register libvirt event implementation.");
+	});
+	wakeup_timer = virEventAddTimeout(-1, [](int, void *){}, nullptr, nullptr);
+	if (wakeup_timer < 0)
+		throw std::runtime_error("Failed to add wakeup timer to libvirt event loop.");
+	thread = std::thread([this]
+	{
+		FASTLIB_LOG(event_loop_log, trace) << "Start libvirt event loop.";
+		while (running) {
+			if (virEventRunDefaultImpl() != 0)
+				FASTLIB_LOG(event_loop_log, warn) << "Error while running libvirt event loop.";
+		}
+		FASTLIB_LOG(event_loop_log, trace) << "Stop libvirt event loop.";
+	});
+}
+
+Libvirt_event_loop::~Libvirt_event_loop()
+{
+	running = false;
+	virEventUpdateTimeout(wakeup_timer, 0);
+	thread.join();
+	virEventRemoveTimeout(wakeup_timer);
+}
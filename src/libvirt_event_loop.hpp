@@ -0,0 +1,35 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef LIBVIRT_EVENT_LOOP_HPP
+#define LIBVIRT_EVENT_LOOP_HPP
+
+#include <atomic>
+#include <thread>
+
+/**
+ * \brief Runs the default libvirt event loop in a separate thread.
+ *
+ * Event callbacks registered on a connection are only dispatched if an event implementation was registered
+ * before the connection was opened, so an instance has to be created before any connection is opened.
+ */
+class Libvirt_event_loop
+{
+public:
+	Libvirt_event_loop();
+	~Libvirt_event_loop();
+	Libvirt_event_loop(const Libvirt_event_loop &) = delete;
+	Libvirt_event_loop & operator=(const Libvirt_event_loop &) = delete;
+private:
+	std::atomic<bool> running;
+	// Timer which is only enabled to wake up the loop on shutdown.
+	int wakeup_timer;
+	std::thread thread;
+};
+
+#endif
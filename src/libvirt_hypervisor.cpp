@@ -9,18 +9,36 @@
 #include "libvirt_hypervisor.hpp"
 
 #include "pscom_handler.hpp"
+#include "libvirt_event_loop.hpp"
 #include "pci_device_handler.hpp"
+#include "domain_inventory.hpp"
 #include "utility.hpp"
 #include "ivshmem_handler.hpp"
 #include "repin_handler.hpp"
+#include "balloon_handler.hpp"
+#include "connection_pool.hpp"
+#include "step_graph.hpp"
+#include "migration_monitor.hpp"
+#include "migration_predictor.hpp"
+#include "device_utility.hpp"
+#include "placement.hpp"
+#include "capacity_ledger.hpp"
+#include "host_prober.hpp"
+#include "evacuation_scheduler.hpp"
+#include "permutation_coordinator.hpp"
+#include "save_staging.hpp"
+#include "shmem_transfer.hpp"
 
 #include <libvirt/libvirt.h>
 #include <libvirt/virterror.h>
 #include <fast-lib/log.hpp>
+#include <fast-lib/message/migfra/result.hpp>
 #include <libssh/libsshpp.hpp>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <unistd.h>
 
 #include <stdexcept>
 #include <memory>
@@ -28,8 +46,12 @@
 #include <future>
 #include <chrono>
 #include <mutex>
+#include <atomic>
 #include <regex>
 #include <functional>
+#include <unordered_map>
+#include <cerrno>
+#include <cstring>
 
 using namespace fast::msg::migfra;
 
@@ -67,6 +89,20 @@ void probe_ssh_connection(const std::string &host, const std::chrono::duration<d
 	} while (!success);
 }
 
+/**
+ * \brief Get the uri of a libvirt-connection to a specific host and libvirt-driver.
+ *
+ * \param host The hostname of the connection.
+ * \param driver The libvirt-driver of the connection (e.g., qemu).
+ * \param transport The transport protocol to use (e.g., ssh or tcp for remote connections)
+ */
+std::string get_connect_uri(const std::string &host, const std::string &driver, const std::string &transport = "")
+{
+	std::string plus_transport = (transport != "") ? ("+" + transport) : "";
+	std::string mode = (driver == "lxctools") ? "" : "system";
+	return driver + plus_transport + "://" + host + "/" + mode;
+}
+
 /**
  * \brief Get a libvirt-connection to a specific host and libvirt-driver.
  *
@@ -77,9 +113,7 @@ void probe_ssh_connection(const std::string &host, const std::chrono::duration<d
  */
 std::shared_ptr<virConnect> connect(const std::string &host, const std::string &driver, const std::string transport = "")
 {
-	std::string plus_transport = (transport != "") ? ("+" + transport) : "";
-	std::string mode = (driver == "lxctools") ? "" : "system";
-	std::string uri = driver + plus_transport + "://" + host + "/" + mode;
+	std::string uri = get_connect_uri(host, driver, transport);
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "Connect to " + uri;
 	std::shared_ptr<virConnect> conn(
 			virConnectOpen(uri.c_str()),
@@ -370,6 +404,64 @@ std::shared_ptr<virDomainSnapshot> redefine_snapshot(virDomainPtr domain, virDom
 	return dest_snapshot;
 }
 
+// RAII-guard to stage a persistent domain through an internal snapshot.
+// The constructor halts the domain by a snapshot, which frees its memory. restore() redefines and reverts the snapshot
+// on the destination, where the domain has to be defined as well (e.g., by shared configuration).
+// If the domain was not restored on the destination, the destructor reverts the snapshot on its source.
+// Snapshots are removed in destructor.
+class Snapshot_staging_guard
+{
+public:
+	Snapshot_staging_guard(std::shared_ptr<virDomain> domain) :
+		domain(domain)
+	{
+		if (virDomainIsPersistent(domain.get()) != 1)
+			throw std::runtime_error("Staging by snapshot requires a persistent domain.");
+		snapshot = create_snapshot(domain.get(), true);
+	}
+	~Snapshot_staging_guard() noexcept(false)
+	{
+		try {
+			if (restored) {
+				// Only remove metadata on source, since the snapshot data is shared with the destination
+				delete_snapshot(snapshot.get(), true);
+				delete_snapshot(dest_snapshot.get());
+			} else {
+				FASTLIB_LOG(libvirt_hyp_log, warn) << "Domain was not restored on destination. Revert snapshot on source.";
+				if (dest_snapshot)
+					delete_snapshot(dest_snapshot.get(), true);
+				revert_to_snapshot(snapshot.get(), false);
+				delete_snapshot(snapshot.get());
+			}
+		} catch (...) {
+			// Only log exception when unwinding stack, else rethrow exception.
+			if (std::uncaught_exception())
+				FASTLIB_LOG(libvirt_hyp_log, trace) << "Exception while cleaning up staged domain.";
+			else
+				throw;
+		}
+	}
+	Snapshot_staging_guard(const Snapshot_staging_guard &) = delete;
+	Snapshot_staging_guard & operator=(const Snapshot_staging_guard &) = delete;
+
+	// Restore the domain on the destination. The destination domain is returned.
+	std::shared_ptr<virDomain> restore(virConnectPtr dest_conn, bool paused)
+	{
+		auto dest_domain = find_by_name(dest_conn, virDomainGetName(domain.get()));
+		dest_snapshot = redefine_snapshot(dest_domain.get(), snapshot.get());
+		if (!dest_snapshot)
+			throw std::runtime_error(std::string("Error redefining snapshot on destination: ") + virGetLastErrorMessage());
+		revert_to_snapshot(dest_snapshot.get(), paused);
+		restored = true;
+		return dest_domain;
+	}
+private:
+	std::shared_ptr<virDomain> domain;
+	std::shared_ptr<virDomainSnapshot> snapshot;
+	std::shared_ptr<virDomainSnapshot> dest_snapshot;
+	bool restored = false;
+};
+
 std::string get_migrate_uri(bool rdma_migration, const std::string &dest_hostname)
 {
 	std::string migrate_uri = rdma_migration ? "rdma://" + dest_hostname + "-ib" : "";
@@ -382,6 +474,8 @@ unsigned long get_migrate_flags(std::string migration_type)
 	unsigned long flags = 0;
 	if (migration_type == "live") {
 		flags |= VIR_MIGRATE_LIVE;
+	} else if (migration_type == "post-copy") {
+		flags |= VIR_MIGRATE_LIVE | VIR_MIGRATE_POSTCOPY;
 	} else if (migration_type == "offline") {
 		flags |= VIR_MIGRATE_OFFLINE;
 	} else if (migration_type != "warm") {
@@ -417,6 +511,33 @@ std::shared_ptr<virDomain> migrate_domain(virDomainPtr domain, virConnectPtr des
 	return dest_domain;
 }
 
+/**
+ * \brief Migrate a domain without a connection to the destination held by migfra.
+ *
+ * The source libvirtd connects to the destination libvirtd itself (VIR_MIGRATE_PEER2PEER).
+ * \param dest_uri The libvirt uri of the destination host as seen from the source libvirtd.
+ * \param tunnelled Tunnel the migration data through the libvirtd connection.
+ */
+void migrate_domain_to_uri(virDomainPtr domain, const std::string &dest_uri, unsigned long flags, const std::string &migrate_uri, bool tunnelled)
+{
+	FASTLIB_LOG(libvirt_hyp_log, trace) << "Migrate domain peer-to-peer to " << dest_uri << ".";
+	flags |= VIR_MIGRATE_PEER2PEER;
+	if (tunnelled) {
+		if (migrate_uri != "")
+			throw std::runtime_error("Tunnelled migration cannot be combined with a migrate uri (e.g., rdma-migration).");
+		flags |= VIR_MIGRATE_TUNNELLED;
+	}
+	virTypedParameterPtr params = nullptr;
+	int params_size = 0;
+	int max_params = 0;
+	if (migrate_uri != "" && virTypedParamsAddString(&params, &params_size, &max_params, VIR_MIGRATE_PARAM_URI, migrate_uri.c_str()) == -1)
+		throw std::runtime_error(std::string("Error creating migration parameters: ") + virGetLastErrorMessage());
+	std::unique_ptr<virTypedParameter, std::function<void(virTypedParameterPtr)>> params_guard(params,
+			[params_size](virTypedParameterPtr ptr){virTypedParamsFree(ptr, params_size);});
+	if (virDomainMigrateToURI3(domain, dest_uri.c_str(), params, params_size, flags) == -1)
+		throw std::runtime_error(std::string("Migration failed: ") + virGetLastErrorMessage());
+}
+
 bool sort_domains_by_size(virDomainPtr domain1, virDomainPtr domain2)
 {
 	Memory_stats mem_stats1(domain1);
@@ -457,32 +578,56 @@ void Libvirt_hypervisor::swap_migration(const std::string &name, const std::stri
 	// Check if domains are in running state
 	check_state(domain.get(), VIR_DOMAIN_RUNNING);
 	check_state(domain_swap.get(), VIR_DOMAIN_RUNNING);
+	// Parse devices once for all guards
+	auto inventory = domain_inventory_cache->get(domain.get());
+	auto inventory_swap = domain_inventory_cache->get(domain_swap.get());
 	// Suspend pscom (resume in destructor)
 	Pscom_handler pscom_handler(task, comm, time_measurement, false);
 	Pscom_handler pscom_handler_swap(task, comm, time_measurement, true);
 	// Guard migration of PCI devices.
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "Create guards for device migration.";
-	Migrate_devices_guard dev_guard(pci_device_handler, domain, time_measurement, name);
-	Migrate_devices_guard dev_guard_swap(pci_device_handler, domain_swap, time_measurement, name_swap);
-	Migrate_ivshmem_guard ivshmem_guard(domain, time_measurement, name);
-	Migrate_ivshmem_guard ivshmem_guard_swap(domain_swap, time_measurement, name_swap);
+	Migrate_devices_guard dev_guard(pci_device_handler, domain, *inventory, time_measurement, name);
+	Migrate_devices_guard dev_guard_swap(pci_device_handler, domain_swap, *inventory_swap, time_measurement, name_swap);
+	Migrate_ivshmem_guard ivshmem_guard(domain, *inventory, time_measurement, name, settings.max_parallel_device_ops);
+	Migrate_ivshmem_guard ivshmem_guard_swap(domain_swap, *inventory_swap, time_measurement, name_swap, settings.max_parallel_device_ops);
 	// Guard repin of vcpus.
 	// In particular, resume after migration since repin is done after migration in suspended state.
 	Repin_guard repin_guard(domain, flags, task.vcpu_map, time_measurement, name);
 	Repin_guard repin_guard_swap(domain_swap, flags_swap, task.swap_with.get().vcpu_map, time_measurement, name_swap);
 	// Compare size and snapshot-swap if necessary
 	if (check_snapshot_required(domain.get(), conn.get(), domain_swap.get(), conn_swap.get())) {
-		FASTLIB_LOG(libvirt_hyp_log, trace) << "Starting swap-migration using snapshot.";
-		// TODO: RAII handler for snapshot for better error recovery
+		FASTLIB_LOG(libvirt_hyp_log, trace) << "Starting swap-migration using staging by " << settings.swap_staging << ".";
 		// TODO: Move to dedicated function
 		auto func = [=, &time_measurement](decltype(domain) domain1, decltype(name) name1, decltype(conn) conn1, decltype(hostname) hostname1, decltype(flags) flags1, decltype(dev_guard) &dev_guard1, decltype(ivshmem_guard) &ivshmem_guard1, decltype(repin_guard) &repin_guard1,
-				decltype(domain) domain2, decltype(name) name2, decltype(conn) conn2, decltype(flags) flags2, decltype(dev_guard) &dev_guard2, decltype(ivshmem_guard) &ivshmem_guard2, decltype(repin_guard) &repin_guard2)
+				decltype(domain) domain2, decltype(name) name2, decltype(conn) conn2, decltype(hostname) hostname2, decltype(flags) flags2, decltype(dev_guard) &dev_guard2, decltype(ivshmem_guard) &ivshmem_guard2, decltype(repin_guard) &repin_guard2)
 		{
+			if (settings.swap_staging == "save") {
+				time_measurement.tick("downtime-" + name1);
+				// Save vm1 to an image (restored on its source in destructor if not restored on destination)
+				Save_staging_guard staging(domain1, hostname1, settings.staging_path, settings.staging_shared, time_measurement, name1);
+				// Stream image to the destination of vm1 while vm2 migrates
+				auto transfer = std::async(std::launch::async, [&staging, &hostname2]{staging.transfer(hostname2);});
+				std::string migrate_uri = get_migrate_uri(rdma_migration, hostname1);
+				tick_synchronized(time_measurement, "migrate-" + name2);
+				auto dest_domain2 = migrate_domain(domain2.get(), conn1.get(), flags2, migrate_uri);
+				tock_synchronized(time_measurement, "migrate-" + name2);
+				repin_guard2.set_destination_domain(dest_domain2);
+				dev_guard2.set_destination_domain(dest_domain2);
+				ivshmem_guard2.set_destination_domain(dest_domain2);
+				transfer.get();
+				// Restore vm1 (paused if repin is required)
+				auto dest_domain1 = staging.restore(conn2.get(), flags1 & VIR_MIGRATE_PAUSED);
+				time_measurement.tock("downtime-" + name1);
+				repin_guard1.set_destination_domain(dest_domain1);
+				dev_guard1.set_destination_domain(dest_domain1);
+				ivshmem_guard1.set_destination_domain(dest_domain1);
+				return;
+			}
 			// Suspend vm1
 			time_measurement.tick("downtime-" + name1);
 			time_measurement.tick("suspend-" + name1);
-			// Take snapshot of vm1 and halt.
-			auto snapshot = create_snapshot(domain1.get(), true);
+			// Take snapshot of vm1 and halt (reverted on its source in destructor if not restored on destination)
+			Snapshot_staging_guard staging(domain1);
 			time_measurement.tock("suspend-" + name1);
 			// Create migrateuri for vm2
 			std::string migrate_uri = get_migrate_uri(rdma_migration, hostname1);
@@ -494,47 +639,31 @@ void Libvirt_hypervisor::swap_migration(const std::string &name, const std::stri
 			repin_guard2.set_destination_domain(dest_domain2);
 			dev_guard2.set_destination_domain(dest_domain2);
 			ivshmem_guard2.set_destination_domain(dest_domain2);
-			// Get snapshotted domain on dest
+			// Restore vm1 on destination (paused if repin is required)
 			time_measurement.tick("resume-" + name1);
-			// TODO: handle transient domains
-			auto dest_domain1 = find_by_name(conn2.get(), name1);
-			// Redefine snapshot on remote
-			auto dest_snapshot = redefine_snapshot(dest_domain1.get(), snapshot.get());
-			// Remove snapshot from src
-			delete_snapshot(snapshot.get(), true);
-			// Revert to snapshot (paused if repin is required)
-			revert_to_snapshot(dest_snapshot.get(), flags1 & VIR_MIGRATE_PAUSED);
+			auto dest_domain1 = staging.restore(conn2.get(), flags1 & VIR_MIGRATE_PAUSED);
 			time_measurement.tock("resume-" + name1);
 			time_measurement.tock("downtime-" + name1);
-			// Remove snapshot from destination
-			delete_snapshot(dest_snapshot.get());
 			// Set destination domain for guard
 			repin_guard1.set_destination_domain(dest_domain1);
 			dev_guard1.set_destination_domain(dest_domain1);
 			ivshmem_guard1.set_destination_domain(dest_domain1);
 		};
 		if (sort_domains_by_size(domain.get(), domain_swap.get()))
-			func(domain, name, conn, hostname, flags, dev_guard, ivshmem_guard, repin_guard, domain_swap, name_swap, conn_swap, flags_swap, dev_guard_swap, ivshmem_guard_swap, repin_guard_swap);
+			func(domain, name, conn, hostname, flags, dev_guard, ivshmem_guard, repin_guard, domain_swap, name_swap, conn_swap, hostname_swap, flags_swap, dev_guard_swap, ivshmem_guard_swap, repin_guard_swap);
 		else
-			func(domain_swap, name_swap, conn_swap, hostname_swap, flags_swap, dev_guard_swap, ivshmem_guard_swap, repin_guard_swap, domain, name, conn, flags, dev_guard, ivshmem_guard, repin_guard);
+			func(domain_swap, name_swap, conn_swap, hostname_swap, flags_swap, dev_guard_swap, ivshmem_guard_swap, repin_guard_swap, domain, name, conn, hostname, flags, dev_guard, ivshmem_guard, repin_guard);
 	} else {
 		FASTLIB_LOG(libvirt_hyp_log, trace) << "Starting swap-migration using parallel migration.";
 		time_measurement.tick("migrate");
-		std::mutex time_measurement_mutex;
-		auto mig_func = [=, &time_measurement, &time_measurement_mutex](const std::string &hostname, virDomainPtr domain, virConnectPtr destconn, unsigned long flags, Migrate_devices_guard &dev_guard, Migrate_ivshmem_guard &ivshmem_guard, Repin_guard &repin_guard, const std::string &name)
+		auto mig_func = [=, &time_measurement](const std::string &hostname, virDomainPtr domain, virConnectPtr destconn, unsigned long flags, Migrate_devices_guard &dev_guard, Migrate_ivshmem_guard &ivshmem_guard, Repin_guard &repin_guard, const std::string &name)
 		{
 			// Create migrateuri
 			std::string migrate_uri = get_migrate_uri(rdma_migration, hostname);
-			{
-				std::lock_guard<std::mutex> lock(time_measurement_mutex);
-				time_measurement.tick("migrate-" + name);
-			}
+			tick_synchronized(time_measurement, "migrate-" + name);
 			// Migrate
 			auto dest_domain = migrate_domain(domain, destconn, flags, migrate_uri);
-			{
-				std::lock_guard<std::mutex> lock(time_measurement_mutex);
-				time_measurement.tock("migrate-" + name);
-			}
+			tock_synchronized(time_measurement, "migrate-" + name);
 			// Set destination domain for guards
 			dev_guard.set_destination_domain(dest_domain);
 			ivshmem_guard.set_destination_domain(dest_domain);
@@ -573,18 +702,73 @@ std::string get_host_ip(const std::string &hostname)
 	return ips.front();
 }
 
+// Get the name of the local network interface which routes to hostname.
+// The route is looked up by connecting a UDP socket, which does not send any packets.
+std::string get_interface_to(const std::string &hostname)
+{
+	struct sockaddr_in remote = {};
+	remote.sin_family = AF_INET;
+	remote.sin_port = htons(9);
+	if (inet_pton(AF_INET, get_host_ip(hostname).c_str(), &remote.sin_addr) != 1)
+		throw std::runtime_error("Error converting IP address of " + hostname + ".");
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd == -1)
+		throw std::runtime_error("Error creating socket: " + std::string(strerror(errno)));
+	struct sockaddr_in local = {};
+	socklen_t local_len = sizeof(local);
+	bool routed = connect(fd, reinterpret_cast<struct sockaddr *>(&remote), sizeof(remote)) == 0 &&
+		getsockname(fd, reinterpret_cast<struct sockaddr *>(&local), &local_len) == 0;
+	int error = errno;
+	close(fd);
+	if (!routed)
+		throw std::runtime_error("Error finding route to " + hostname + ": " + strerror(error));
+	struct ifaddrs *ifaddrs_tmp_ptr = nullptr;
+	if (getifaddrs(&ifaddrs_tmp_ptr) == -1)
+		throw std::runtime_error("Error getting network interfaces: " + std::string(strerror(errno)));
+	std::shared_ptr<struct ifaddrs> ifaddrs(ifaddrs_tmp_ptr, [](struct ifaddrs *ifa){freeifaddrs(ifa);});
+	for (auto ifa = ifaddrs.get(); ifa != nullptr; ifa = ifa->ifa_next) {
+		if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_INET &&
+				reinterpret_cast<struct sockaddr_in *>(ifa->ifa_addr)->sin_addr.s_addr == local.sin_addr.s_addr)
+			return ifa->ifa_name;
+	}
+	throw std::runtime_error("No network interface has address " + std::string(inet_ntoa(local.sin_addr)) + ".");
+}
+
 //
 // Libvirt_hypervisor implementation
 //
 
-Libvirt_hypervisor::Libvirt_hypervisor(std::vector<std::string> nodes, std::string default_driver, std::string default_transport, unsigned int start_timeout, unsigned int stop_timeout) :
-	pci_device_handler(std::make_shared<PCI_device_handler>()),
+Libvirt_hypervisor::Libvirt_hypervisor(std::vector<std::string> nodes, std::string default_driver, std::string default_transport, unsigned int start_timeout, unsigned int stop_timeout, Libvirt_hypervisor_settings settings) :
+	event_loop(std::make_shared<Libvirt_event_loop>()),
+	domain_inventory_cache(std::make_shared<Domain_inventory_cache>()),
+	pci_device_handler(std::make_shared<PCI_device_handler>(settings.max_parallel_device_ops, settings.vf_pools)),
+	connection_pool(std::make_shared<Connection_pool>()),
 	nodes(std::move(nodes)),
 	default_driver(std::move(default_driver)),
 	default_transport(std::move(default_transport)),
 	start_timeout(start_timeout),
-	stop_timeout(stop_timeout)
+	stop_timeout(stop_timeout),
+	settings(std::move(settings))
 {
+	const auto &path = this->settings.migration_path;
+	if (path != "managed" && path != "pooled" && path != "peer2peer" && path != "tunnelled")
+		throw std::invalid_argument("Unknown migration-path in configuration found: " + path);
+	const auto &order = this->settings.evacuation_order;
+	if (order != "largest-first" && order != "smallest-first" && order != "none")
+		throw std::invalid_argument("Unknown evacuation-order in configuration found: " + order);
+	const auto &staging = this->settings.swap_staging;
+	if (staging != "snapshot" && staging != "save")
+		throw std::invalid_argument("Unknown swap-staging in configuration found: " + staging);
+	const auto &ivshmem_transfer = this->settings.ivshmem_transfer;
+	if (ivshmem_transfer != "none" && ivshmem_transfer != "copy" && ivshmem_transfer != "dirty")
+		throw std::invalid_argument("Unknown ivshmem-transfer in configuration found: " + ivshmem_transfer);
+	capacity_ledger = std::make_shared<Capacity_ledger>();
+	host_prober = std::make_shared<Host_prober>(
+			std::chrono::milliseconds(static_cast<long long>(this->settings.probe_timeout * 1000)),
+			std::chrono::milliseconds(static_cast<long long>(this->settings.probe_cache_ttl * 1000)),
+			this->settings.max_parallel_probes);
+	migration_predictor = std::make_shared<Migration_predictor>(this->settings.default_link_throughput,
+			std::chrono::seconds(this->settings.dirty_rate_sample_time));
 }
 
 void Libvirt_hypervisor::start(const Start &task, Time_measurement &time_measurement)
@@ -636,8 +820,7 @@ void Libvirt_hypervisor::start(const Start &task, Time_measurement &time_measure
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "Attach " << task.pci_addrs.size() << " devices by PCI address.";
     for (auto &addr : task.pci_addrs) {
 		PCI_address pci_addr = PCI_address(0, addr.bus, addr.device, addr.funct);
-		auto dev = std::make_shared<Device>(pci_addr);
-		pci_device_handler->attach_device(domain.get(), dev);
+		pci_device_handler->attach_by_address(domain.get(), pci_addr);
 	}
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "Attach " << task.pci_ids.size() << " devices by vendor id";
 	for (auto &pci_id : task.pci_ids) {
@@ -671,8 +854,12 @@ void Libvirt_hypervisor::stop(const Stop &task, Time_measurement &time_measureme
 		check_state(domain.get(), VIR_DOMAIN_RUNNING);
 		// Check if domain is persistent
 		auto persistent = (driver == "lxctools") ? true : is_persistent(domain.get());
-		// Detach PCI devices
-		pci_device_handler->detach(domain.get());
+		// Detach PCI devices (domain is stopped anyway if this fails)
+		try {
+			pci_device_handler->detach(domain.get(), domain_inventory_cache->get(domain.get()).get());
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(libvirt_hyp_log, trace) << "Error detaching devices before stopping: " << e.what();
+		}
 		// Destroy or shutdown domain
 		if (task.force.is_valid() && task.force.get()) {
 			if (virDomainDestroy(domain.get()) == -1)
@@ -696,6 +883,12 @@ void Libvirt_hypervisor::stop(const Stop &task, Time_measurement &time_measureme
 			if (virDomainUndefine(domain.get()) == -1)
 				throw std::runtime_error("Error undefining domain.");
 		}
+		// Shrink SR-IOV pools which became idle
+		try {
+			pci_device_handler->trim_vf_pools(conn.get());
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(libvirt_hyp_log, warn) << "Error trimming VF pools after stopping: " << e.what();
+		}
 	};
 	if (task.vm_name) {
 		func(*task.vm_name);
@@ -717,83 +910,483 @@ void Libvirt_hypervisor::stop(const Stop &task, Time_measurement &time_measureme
 	}
 }
 
-void Libvirt_hypervisor::migrate(const Migrate &task, Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm)
+void Libvirt_hypervisor::migrate(const Migrate &task, Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm, Task_report &report)
+{
+	migrate_from("", task, time_measurement, comm, report);
+}
+
+void Libvirt_hypervisor::migrate_from(const std::string &source_hostname, const Migrate &task, Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm, Task_report &report)
 {
 	const std::string &dest_hostname = task.dest_hostname;
 	auto migration_type = task.migration_type.is_valid() ? task.migration_type.get() : "warm";
 	bool rdma_migration = task.rdma_migration.is_valid() ? task.rdma_migration.get() : false;
 	auto driver = task.driver.is_valid() ? task.driver.get() : default_driver;
 	auto transport = task.transport.is_valid() ? task.transport.get() : default_transport;
-	FASTLIB_LOG(libvirt_hyp_log, trace) << "Migrate " << task.vm_name << " to " << task.dest_hostname << ".";
+	FASTLIB_LOG(libvirt_hyp_log, trace) << "Migrate " << task.vm_name << (source_hostname.empty() ? "" : " from " + source_hostname) << " to " << task.dest_hostname << ".";
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "migration-type=" << migration_type;
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "rdma-migration=" << rdma_migration;
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "driver=" << driver;
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "transport=" << transport;
-	// Set migration flags
-	auto base_flags = get_migrate_flags(migration_type);
+	// Set migration flags (migration-type auto is resolved per domain below)
+	auto base_flags = get_migrate_flags(migration_type == "auto" ? "warm" : migration_type);
 	// Swap migration or normal migration
 	if (task.swap_with.is_valid()) {
 		if (driver != "qemu")
 			throw std::runtime_error("Currently swap migration is only supported by the qemu driver.");
-		swap_migration(task.vm_name, task.swap_with.get().vm_name, get_hostname(), dest_hostname, base_flags, base_flags, rdma_migration, driver, transport, task, comm, time_measurement);
+		if (migration_type == "auto")
+			FASTLIB_LOG(libvirt_hyp_log, trace) << "Migration type auto is not supported by swap migration. Using warm migration.";
+		swap_migration(task.vm_name, task.swap_with.get().vm_name, source_hostname.empty() ? get_hostname() : source_hostname, dest_hostname, base_flags, base_flags, rdma_migration, driver, transport, task, comm, time_measurement);
 	} else {
 		auto flags = base_flags;
-		// Connect to libvirt
-		auto conn = connect("", driver);
+		// Connect to libvirt on the source host
+		auto conn = source_hostname.empty() ? connect("", driver) : connect(source_hostname, driver, transport);
 		// Get domain by name
 		auto domain = find_by_name(conn.get(), task.vm_name);
 		// Check if domain is in running state
 		check_state(domain.get(), VIR_DOMAIN_RUNNING);
-		// Suspend pscom (resume in destructor)
-		Pscom_handler pscom_handler(task, comm, time_measurement);
-		// Guard migration of PCI devices.
-		FASTLIB_LOG(libvirt_hyp_log, trace) << "Create guard for device migration.";
-		Migrate_ivshmem_guard ivshmem_guard(domain, time_measurement);
-		Migrate_devices_guard dev_guard(pci_device_handler, domain, time_measurement);
+		// Parse devices once for all guards
+		auto inventory = domain_inventory_cache->get(domain.get());
+		// Choose migration type by predicted cost
+		auto link = rdma_migration ? dest_hostname + "-ib" : dest_hostname;
+		bool predicted = migration_type == "auto" && driver == "qemu";
+		Migration_prediction prediction;
+		if (predicted) {
+			tick_synchronized(time_measurement, "predict");
+			auto predictions = migration_predictor->predict(domain.get(), link, settings.max_downtime);
+			for (const auto &p : predictions)
+				FASTLIB_LOG(libvirt_hyp_log, trace) << "Prediction: " << p.str();
+			prediction = Migration_predictor::choose(predictions, settings.max_downtime);
+			tock_synchronized(time_measurement, "predict");
+			FASTLIB_LOG(libvirt_hyp_log, trace) << "Chose migration type " << prediction.migration_type << ".";
+			flags = get_migrate_flags(prediction.migration_type);
+			// Let pre-copy converge at the downtime the prediction is based on.
+			if (prediction.migration_type == "live" &&
+					virDomainMigrateSetMaxDowntime(domain.get(), settings.max_downtime * 1000, 0) == -1)
+				throw std::runtime_error(std::string("Error setting max downtime: ") + virGetLastErrorMessage());
+		}
+		auto dest_uri = get_connect_uri(dest_hostname, driver, transport);
+		const auto &path = settings.migration_path;
+		bool peer2peer = path == "peer2peer" || path == "tunnelled";
+		if (peer2peer && driver == "lxctools") {
+			FASTLIB_LOG(libvirt_hyp_log, trace) << "Peer-to-peer migration is not supported by lxctools driver. Using managed migration.";
+			peer2peer = false;
+		}
+		// Live migrations may start pre-copy while the application still communicates
+		// and suspend pscom only when the remaining data fell below the threshold.
+		// Devices cannot be detached while the migration job is running, so domains with devices are excluded.
+		bool warm_up = settings.pre_copy_threshold != 0 && (flags & VIR_MIGRATE_LIVE) &&
+			task.pscom_hook_procs.is_valid() && !inventory->has_non_migratable_devices();
+		FASTLIB_LOG(libvirt_hyp_log, trace) << "pre-copy-warm-up=" << warm_up;
+		// The guards are created by concurrently running steps.
+		// Their holders are declared in the order of the former sequential execution,
+		// so that devices are reattached and pscom is resumed in reverse order.
+		Step_guard<Pscom_handler> pscom_handler;
+		Step_guard<Migrate_ivshmem_guard> ivshmem_guard;
+		Step_guard<Migrate_devices_guard> dev_guard;
 		// Guard repin of vcpus.
 		// In particular, resume after migration since repin is done after migration in suspended state.
 		Repin_guard repin_guard(domain, flags, task.vcpu_map, time_measurement);
-		// Connect to destination
-		auto dest_connection = connect(dest_hostname, driver, transport);
-		// Create migrateuri
-		// TODO: Fix libvirt lxctools driver so no IP has to be sent via migrate uri.
-		std::string migrate_uri = (driver == "lxctools") ?
-			get_host_ip(dest_hostname) :
-			get_migrate_uri(rdma_migration, dest_hostname);
+		// Shrink memory before migration (restore in destructor)
+		Step_guard<Balloon_guard> balloon_guard;
+		std::shared_ptr<virConnect> dest_connection;
+		std::shared_ptr<virDomain> dest_domain;
+		std::string migrate_uri;
+		Step_graph steps;
+		// Connect to destination (skipped for peer-to-peer migration)
+		steps.add_step("connect-dest", {}, [&]
+		{
+			tick_synchronized(time_measurement, "connect-dest");
+			// Create migrateuri
+			// TODO: Fix libvirt lxctools driver so no IP has to be sent via migrate uri.
+			migrate_uri = (driver == "lxctools") ?
+				get_host_ip(dest_hostname) :
+				get_migrate_uri(rdma_migration, dest_hostname);
+			if (!peer2peer) {
+				dest_connection = (path == "pooled") ?
+					connection_pool->get(dest_uri) :
+					connect(dest_hostname, driver, transport);
+			}
+			tock_synchronized(time_measurement, "connect-dest");
+		});
+		// Shrink memory to used memory plus headroom (skipped if disabled)
+		steps.add_step("shrink-balloon", {}, settings.balloon_headroom == 0 ? std::function<void()>() : [&]
+		{
+			balloon_guard.emplace(domain, settings.balloon_headroom, time_measurement);
+		});
+		// Wait for pre-copy to converge (skipped if not warming up).
+		// Depends on the same steps as migrate, so that migration is guaranteed to start and finish the wait.
+		std::atomic<bool> migration_finished(false);
+		bool pre_copy_converged = false;
+		Migration_monitor monitor(domain);
+		// Hold switchover during warm-up by a minimal max downtime, so that the job cannot converge
+		// before pscom is suspended. The former max downtime is set again after suspension or in destructor.
+		struct Switchover_hold
+		{
+			~Switchover_hold()
+			{
+				try {
+					release();
+				} catch (const std::exception &e) {
+					FASTLIB_LOG(libvirt_hyp_log, warn) << "Could not restore max downtime: " << e.what();
+				}
+			}
+			void release()
+			{
+				if (!held)
+					return;
+				held = false;
+				FASTLIB_LOG(libvirt_hyp_log, trace) << "Release switchover with max downtime " << downtime << " ms.";
+				if (virDomainMigrateSetMaxDowntime(domain, downtime, 0) == -1)
+					throw std::runtime_error(std::string("Error setting max downtime: ") + virGetLastErrorMessage());
+			}
+			virDomainPtr domain;
+			unsigned long long downtime;
+			bool held;
+		} switchover_hold{domain.get(), 0, false};
+		if (warm_up) {
+			if (virDomainMigrateGetMaxDowntime(domain.get(), &switchover_hold.downtime, 0) == -1)
+				throw std::runtime_error(std::string("Error getting max downtime: ") + virGetLastErrorMessage());
+			if (virDomainMigrateSetMaxDowntime(domain.get(), 1, 0) == -1)
+				throw std::runtime_error(std::string("Error setting max downtime: ") + virGetLastErrorMessage());
+			switchover_hold.held = true;
+		}
+		steps.add_step("warm-up", {"connect-dest", "shrink-balloon"}, !warm_up ? std::function<void()>() : [&]
+		{
+			tick_synchronized(time_measurement, "warm-up");
+			pre_copy_converged = monitor.wait_for_remaining_data(settings.pre_copy_threshold, migration_finished);
+			tock_synchronized(time_measurement, "warm-up");
+		});
+		// Stream contents of ivshmem regions to the destination (skipped if disabled or devices stay attached).
+		std::vector<std::unique_ptr<Shmem_transfer>> shmem_transfers;
+		if (settings.ivshmem_transfer != "none" && !warm_up) {
+			for (const auto &shmem : inventory->shmems) {
+				shmem_transfers.emplace_back(new Shmem_transfer(Ivshmem_device(shmem).id, source_hostname, dest_hostname,
+						settings.ivshmem_transfer == "dirty", time_measurement));
+			}
+		}
+		auto run_shmem_transfers = [&](void (Shmem_transfer::*stage)())
+		{
+			std::vector<std::function<void()>> operations;
+			for (const auto &transfer : shmem_transfers)
+				operations.push_back([&transfer, stage]{((*transfer).*stage)();});
+			run_all_bounded(operations, settings.max_parallel_device_ops);
+		};
+		// Send regions while still in use, so that only changed pages are sent after detaching.
+		steps.add_step("precopy-ivshmem", {}, shmem_transfers.empty() || settings.ivshmem_transfer != "dirty" ? std::function<void()>() : [&]
+		{
+			run_shmem_transfers(&Shmem_transfer::precopy);
+		});
+		// Suspend pscom (resume in destructor)
+		steps.add_step("pscom-suspend", {"warm-up", "precopy-ivshmem"}, [&]
+		{
+			if (warm_up && !pre_copy_converged) {
+				// Only possible if migration failed or the domain had (almost) no memory left to send
+				FASTLIB_LOG(libvirt_hyp_log, warn) << "Migration finished during warm-up. Skip pscom suspension.";
+				return;
+			}
+			try {
+				pscom_handler.emplace(task, comm, time_measurement);
+			} catch (...) {
+				// Do not let the held migration switch over with active connections
+				if (warm_up && virDomainAbortJob(domain.get()) == -1)
+					FASTLIB_LOG(libvirt_hyp_log, warn) << "Could not abort migration: " << virGetLastErrorMessage();
+				throw;
+			}
+			switchover_hold.release();
+		});
+		// Guard migration of PCI devices.
+		// Devices are detached after pscom closed the connections using them.
+		steps.add_step("detach-ivshmem-devs", {"pscom-suspend"}, warm_up ? std::function<void()>() : [&]
+		{
+			ivshmem_guard.emplace(domain, *inventory, time_measurement, "", settings.max_parallel_device_ops);
+		});
+		steps.add_step("detach-pci-devs", {"pscom-suspend"}, warm_up ? std::function<void()>() : [&]
+		{
+			dev_guard.emplace(pci_device_handler, domain, *inventory, time_measurement);
+		});
+		// Send regions while migrating. The devices are reattached after all steps are done.
+		steps.add_step("transfer-ivshmem", {"detach-ivshmem-devs"}, shmem_transfers.empty() ? std::function<void()>() : [&]
+		{
+			if (!ivshmem_guard->has_detached_devices())
+				return;
+			run_shmem_transfers(&Shmem_transfer::transfer);
+		});
+		// Reserve and pre-bind devices on destination while migrating (skipped if devices stay attached).
+		// Devices which could not be prepared are attached by id after migration.
+		steps.add_step("prepare-dest-pci-devs", {"connect-dest", "detach-pci-devs"}, warm_up ? std::function<void()>() : [&]
+		{
+			if (!dev_guard->has_detached_devices())
+				return;
+			try {
+				dev_guard->prepare_destination(peer2peer ? connection_pool->get(dest_uri).get() : dest_connection.get());
+			} catch (const std::exception &e) {
+				FASTLIB_LOG(libvirt_hyp_log, trace) << "Could not prepare devices on destination: " << e.what();
+			}
+		});
 		// Migrate domain
-		time_measurement.tick("migrate");
-		auto dest_domain = migrate_domain(domain.get(), dest_connection.get(), flags, migrate_uri);
-		time_measurement.tock("migrate");
-		// Set destination domain for guards
-		FASTLIB_LOG(libvirt_hyp_log, trace) << "Set destination domain for guards.";
-		repin_guard.set_destination_domain(dest_domain);
-		dev_guard.set_destination_domain(dest_domain);
-		ivshmem_guard.set_destination_domain(dest_domain);
+		auto migrate_dependencies = warm_up ?
+			std::vector<std::string>{"connect-dest", "shrink-balloon"} :
+			std::vector<std::string>{"connect-dest", "shrink-balloon", "detach-ivshmem-devs", "detach-pci-devs"};
+		// Switch to post-copy after the first pre-copy iteration (skipped for other migration types)
+		Migration_monitor post_copy_monitor(domain);
+		steps.add_step("start-post-copy", migrate_dependencies, !(flags & VIR_MIGRATE_POSTCOPY) ? std::function<void()>() : [&]
+		{
+			if (post_copy_monitor.wait_for_iteration(2, migration_finished)) {
+				FASTLIB_LOG(libvirt_hyp_log, trace) << "Switch to post-copy.";
+				// Migration continues in pre-copy mode if switching fails.
+				// Switching also fails if the job finished meanwhile, which is not an error.
+				if (virDomainMigrateStartPostCopy(domain.get(), 0) == -1) {
+					if (migration_finished || virDomainIsActive(domain.get()) != 1)
+						FASTLIB_LOG(libvirt_hyp_log, trace) << "Migration finished before switching to post-copy.";
+					else
+						FASTLIB_LOG(libvirt_hyp_log, trace) << "Error switching to post-copy: " << virGetLastErrorMessage();
+				}
+			}
+		});
+		// Set destination domain for guards as soon as the domain migrated,
+		// so that they do not roll back on the source if a concurrent step fails afterwards.
+		auto set_guards_destination = [&]
+		{
+			FASTLIB_LOG(libvirt_hyp_log, trace) << "Set destination domain for guards.";
+			repin_guard.set_destination_domain(dest_domain);
+			if (balloon_guard)
+				balloon_guard->set_destination_domain(dest_domain);
+			if (dev_guard)
+				dev_guard->set_destination_domain(dest_domain);
+			if (ivshmem_guard)
+				ivshmem_guard->set_destination_domain(dest_domain);
+		};
+		steps.add_step("migrate", migrate_dependencies, [&]
+		{
+			// Stop warm-up in any case when migration returns.
+			struct Finished_guard
+			{
+				~Finished_guard() {flag = true;}
+				std::atomic<bool> &flag;
+			} finished_guard{migration_finished};
+			if (peer2peer) {
+				// Migrate domain without connecting to destination
+				tick_synchronized(time_measurement, "migrate");
+				migrate_domain_to_uri(domain.get(), dest_uri, flags, migrate_uri, path == "tunnelled");
+				tock_synchronized(time_measurement, "migrate");
+				// Only connect to destination if the guards have work left to do on the destination domain
+				if ((dev_guard && dev_guard->has_detached_devices()) ||
+						(ivshmem_guard && ivshmem_guard->has_detached_devices()) ||
+						repin_guard.repin_required() || balloon_guard || predicted) {
+					FASTLIB_LOG(libvirt_hyp_log, trace) << "Get migrated domain on destination for guards.";
+					try {
+						dest_domain = find_by_name(connection_pool->get(dest_uri).get(), task.vm_name);
+					} catch (...) {
+						// The pooled connection might be broken, so do not reuse it.
+						connection_pool->invalidate(dest_uri);
+						throw;
+					}
+					set_guards_destination();
+				}
+			} else {
+				tick_synchronized(time_measurement, "migrate");
+				try {
+					dest_domain = migrate_domain(domain.get(), dest_connection.get(), flags, migrate_uri);
+				} catch (...) {
+					// The pooled connection might be broken, so do not reuse it.
+					if (path == "pooled")
+						connection_pool->invalidate(dest_uri);
+					throw;
+				}
+				tock_synchronized(time_measurement, "migrate");
+				set_guards_destination();
+			}
+		});
+		try {
+			steps.run();
+		} catch (...) {
+			// Report the steps done before the failure
+			report.add("critical-path", steps.critical_path_str());
+			throw;
+		}
+		report.add("critical-path", steps.critical_path_str());
+		if (warm_up) {
+			report.add("pre-copy-converged", pre_copy_converged ? "true" : "false");
+			report.add("data-remaining-at-suspend", monitor.get_last_progress().data_remaining);
+		}
+		// Learn link throughput and report actual costs
+		if (dest_domain) {
+			try {
+				Job_progress completed(dest_domain.get(), true);
+				completed.refresh();
+				if (completed.time_elapsed != 0) {
+					migration_predictor->add_throughput_sample(link, completed.memory_bps != 0 ?
+							completed.memory_bps :
+							completed.data_processed * 1000.0 / completed.time_elapsed);
+				}
+				if (predicted) {
+					report.add("actual-total-time", completed.time_elapsed / 1000.0);
+					report.add("actual-downtime", completed.downtime / 1000.0);
+				}
+			} catch (const std::exception &e) {
+				FASTLIB_LOG(libvirt_hyp_log, trace) << "Could not get statistics of completed migration: " << e.what();
+			}
+		}
+		if (balloon_guard)
+			report.add("balloon-shrunk-by", balloon_guard->get_shrunk_by());
+		for (const auto &transfer : shmem_transfers) {
+			report.add("ivshmem-" + transfer->get_name() + "-size", transfer->get_region_size());
+			report.add("ivshmem-" + transfer->get_name() + "-sent", transfer->get_bytes_sent());
+			report.add("ivshmem-" + transfer->get_name() + "-throughput", transfer->get_throughput());
+		}
+		if (predicted) {
+			report.add("predicted-migration-type", prediction.migration_type);
+			report.add("predicted-total-time", prediction.total_time);
+			report.add("predicted-downtime", prediction.downtime);
+		}
+	}
+}
+
+Domain_demand get_domain_demand(virDomainPtr domain)
+{
+	virDomainInfo domain_info;
+	if (virDomainGetInfo(domain, &domain_info) == -1)
+		throw std::runtime_error(std::string("Failed getting domain info: ") + virGetLastErrorMessage());
+	Domain_demand demand;
+	demand.name = get_domain_name(domain);
+	demand.vcpus = domain_info.nrVirtCpu;
+	demand.memory = domain_info.memory;
+	return demand;
+}
+
+std::vector<Domain_demand> get_active_domain_demands(virConnectPtr conn)
+{
+	virDomainPtr *domains;
+	auto num = virConnectListAllDomains(conn, &domains, VIR_CONNECT_LIST_DOMAINS_ACTIVE);
+	if (num < 0)
+		throw std::runtime_error(std::string("Error getting list of active domains.") + virGetLastErrorMessage());
+	std::vector<std::shared_ptr<virDomain>> domain_ptrs;
+	for (int i = 0; i != num; ++i)
+		domain_ptrs.emplace_back(domains[i], Deleter_virDomain());
+	free(domains);
+	std::vector<Domain_demand> demands;
+	for (const auto &domain : domain_ptrs)
+		demands.push_back(get_domain_demand(domain.get()));
+	return demands;
+}
+
+Host_resources get_host_resources(virConnectPtr conn, const std::string &host)
+{
+	Host_resources resources;
+	resources.name = host;
+	resources.cpus = get_host_cpu_count(conn);
+	resources.domains = get_active_domain_demands(conn);
+	for (const auto &demand : resources.domains) {
+		resources.used_cpus += demand.vcpus;
+		++resources.active_domains;
+	}
+	resources.free_memory = get_free_memory(conn) / 1024;
+	virNodeInfo node_info;
+	if (virNodeGetInfo(conn, &node_info) == -1)
+		throw std::runtime_error(std::string("Error getting node info: ") + virGetLastErrorMessage());
+	std::vector<unsigned long long> cells_free_memory(node_info.nodes);
+	auto cells = virNodeGetCellsFreeMemory(conn, cells_free_memory.data(), 0, cells_free_memory.size());
+	if (cells == -1)
+		throw std::runtime_error(std::string("Error getting free memory of NUMA nodes: ") + virGetLastErrorMessage());
+	for (int i = 0; i != cells; ++i)
+		resources.numa_free_memory.push_back(cells_free_memory[i] / 1024);
+	FASTLIB_LOG(libvirt_hyp_log, trace) << "Host " << host << ": " << resources.used_cpus << "/" << resources.cpus << " cpus used, "
+		<< resources.free_memory << " KiB free memory on " << cells << " NUMA nodes.";
+	return resources;
+}
+
+Host_resources get_host_resources(const std::string &host, const std::string &driver, const std::string &transport)
+{
+	auto conn = connect(host, driver, transport);
+	return get_host_resources(conn.get(), host);
+}
+
+// Statistics of a domain. Memory in KiB.
+struct Domain_stats
+{
+	unsigned long long cpu_time = 0;
+	unsigned long long memory = 0;
+	unsigned int vcpus = 0;
+};
+
+// Get statistics of all active domains by name.
+std::unordered_map<std::string, Domain_stats> get_all_domain_stats(virConnectPtr conn)
+{
+	virDomainStatsRecordPtr *records = nullptr;
+	auto stats_types = VIR_DOMAIN_STATS_CPU_TOTAL | VIR_DOMAIN_STATS_BALLOON | VIR_DOMAIN_STATS_VCPU;
+	if (virConnectGetAllDomainStats(conn, stats_types, &records, VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE) == -1)
+		throw std::runtime_error(std::string("Error getting domain stats: ") + virGetLastErrorMessage());
+	std::unique_ptr<virDomainStatsRecordPtr, decltype(&virDomainStatsRecordListFree)> records_guard(records, virDomainStatsRecordListFree);
+	std::unordered_map<std::string, Domain_stats> stats;
+	for (auto record = records; *record; ++record) {
+		Domain_stats domain_stats;
+		virTypedParamsGetULLong((*record)->params, (*record)->nparams, "cpu.time", &domain_stats.cpu_time);
+		virTypedParamsGetULLong((*record)->params, (*record)->nparams, "balloon.current", &domain_stats.memory);
+		virTypedParamsGetUInt((*record)->params, (*record)->nparams, "vcpu.current", &domain_stats.vcpus);
+		stats[get_domain_name((*record)->dom)] = domain_stats;
 	}
+	return stats;
 }
 
-int get_capacity(const std::string &host, const std::string &driver, const std::string transport = "")
+// Get resources of host including the cpu usage of its domains sampled for sample_time.
+Host_resources get_host_load(const std::string &host, const std::string &driver, const std::string &transport, std::chrono::duration<double> sample_time)
 {
 	auto conn = connect(host, driver, transport);
-	auto cpu_count = get_host_cpu_count(conn.get());
-	auto domain_count = get_active_domain_names(conn.get()).size();
-	return cpu_count - domain_count;
+	auto before = get_all_domain_stats(conn.get());
+	auto start = std::chrono::steady_clock::now();
+	std::this_thread::sleep_for(sample_time);
+	auto after = get_all_domain_stats(conn.get());
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	auto resources = get_host_resources(conn.get(), host);
+	double cpu_usage = 0;
+	for (auto &domain : resources.domains) {
+		auto it_before = before.find(domain.name);
+		auto it_after = after.find(domain.name);
+		// Domains started during sampling have no usage yet
+		if (it_before == before.end() || it_after == after.end() || it_after->second.cpu_time < it_before->second.cpu_time)
+			continue;
+		domain.cpu_usage = (it_after->second.cpu_time - it_before->second.cpu_time) / 1e9 / elapsed.count();
+		cpu_usage += domain.cpu_usage;
+	}
+	FASTLIB_LOG(libvirt_hyp_log, trace) << "Host " << host << ": " << cpu_usage << "/" << resources.cpus << " cpus busy.";
+	return resources;
 }
 
-std::tuple<std::deque<std::pair<std::string, int>> &, std::mutex &> get_destinations_capacities()
+// Modes placing all domains at once before evacuation starts.
+bool is_placement_mode(const std::string &mode)
 {
-	static std::mutex dest_caps_mutex;
-	static std::deque<std::pair<std::string, int>> dest_caps;
-	return std::tie(dest_caps, dest_caps_mutex);
+	return mode == "pack" || mode == "balance";
 }
 
-void init_destinations_capacities(const std::vector<std::string> &destinations, const std::string &driver, const std::string &transport, bool overbooking)
+// State shared by the evacuate tasks generated from one evacuate request.
+struct Evacuation_state
+{
+	// (destination : remaining capacity) used by modes auto, compact and scatter while planning
+	std::deque<std::pair<std::string, int>> dest_caps;
+	std::mutex dest_caps_mutex;
+	std::unique_ptr<Evacuation_scheduler> scheduler;
+	double predicted_makespan = 0;
+};
+
+// Evacuate task of a single domain generated by get_evacuate_tasks.
+struct Evacuate_subtask :
+	public Evacuate
+{
+	std::shared_ptr<Evacuation_state> state;
+	// Reservation of the planned destination
+	Capacity_ledger::Reservation_id reservation = 0;
+};
+
+void init_destinations_capacities(Evacuation_state &state, const std::vector<Host_resources> &destinations, bool overbooking, const Capacity_ledger &ledger)
 {
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "init dest_caps";
-	auto &dest_caps = std::get<0>(get_destinations_capacities());
+	auto &dest_caps = state.dest_caps;
 	dest_caps.clear();
 	for (const auto &destination : destinations) {
-		dest_caps.emplace_back(destination, get_capacity(destination, driver, transport));
+		// Capacity is the number of cpus minus the number of domains.
+		// Domains still migrating to the destination are not yet counted by the probe.
+		int capacity = destination.cpus - destination.active_domains - ledger.reserved_domains(destination.name);
+		dest_caps.emplace_back(destination.name, capacity);
 	}
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "dest_caps.size() = " << dest_caps.size();
 	// If no overbooking allowed -> drop all full hosts
@@ -806,7 +1399,42 @@ void init_destinations_capacities(const std::vector<std::string> &destinations,
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "dest_caps.size() = " << dest_caps.size();
 }
 
-std::vector<std::shared_ptr<Task>> Libvirt_hypervisor::get_evacuate_tasks(const Task_container &task_cont)
+std::string get_next_destination(Evacuation_state &state, bool overbooking, const std::string &mode)
+{
+	using dest_caps_deque = std::deque<std::pair<std::string, int>>;
+	// Lock for thread safety
+	std::lock_guard<std::mutex> lock(state.dest_caps_mutex);
+	auto &dest_caps = state.dest_caps;
+	// To few destinations to migrate to -> error
+	if (dest_caps.empty())
+		throw std::runtime_error("No destination host left to evacuate to.");
+	// Use first destination in list
+	auto destination = dest_caps.front().first;
+	// Reduce capacity of destination
+	--dest_caps.front().second;
+	if (mode == "compact") { // fill host, then go to next
+		if (dest_caps.front().second < 1) { // if host full/overbooked
+			if (!overbooking) { // no overbooking -> drop host
+				dest_caps.pop_front();
+			} else { // overbooking -> rotate to next host
+				std::rotate(dest_caps.begin(), dest_caps.begin() + 1, dest_caps.end());
+			}
+		}
+	} else if (mode == "scatter") { // rotate through destinations
+		if (dest_caps.front().second < 1 && !overbooking) {
+				dest_caps.pop_front();
+		} else {
+			std::rotate(dest_caps.begin(), dest_caps.begin() + 1, dest_caps.end());
+		}
+	} else if (mode == "auto") { // sort to distribute domains water-filling-like
+		std::sort(dest_caps.begin(), dest_caps.end(),
+				[](dest_caps_deque::const_reference a, dest_caps_deque::const_reference b)
+				{return a.second > b.second;});
+	}
+	return destination;
+}
+
+std::vector<std::shared_ptr<Task>> Libvirt_hypervisor::get_evacuate_tasks(const Task_container &task_cont, std::shared_ptr<fast::Communicator> comm)
 {
 	if (task_cont.type(true) != "node evacuated")
 		throw std::runtime_error("No evacuate tasks.");
@@ -814,12 +1442,75 @@ std::vector<std::shared_ptr<Task>> Libvirt_hypervisor::get_evacuate_tasks(const
 	auto overbooking = base_task->overbooking.get_or(true);
 	auto driver = base_task->driver.get_or(default_driver);
 	auto transport = base_task->transport.get_or(default_transport);
+	auto mode = base_task->mode.get_or("auto");
+	auto rdma_migration = base_task->rdma_migration.get_or(false);
 	auto conn = connect("", driver);
-	auto domain_names = get_active_domain_names(conn.get());
+	auto demands = get_active_domain_demands(conn.get());
+	auto state = std::make_shared<Evacuation_state>();
+	auto probe = [driver, transport](const std::string &host) {return get_host_resources(host, driver, transport);};
+	auto probe_scope = driver + "+" + transport;
+	Placement placement;
+	std::unordered_map<std::string, Capacity_ledger::Reservation_id> reservations;
+	// Roll back reservations unless the tasks releasing them are returned
+	struct Reservations_guard
+	{
+		~Reservations_guard()
+		{
+			if (released)
+				return;
+			for (const auto &domain_reservation : reservations) {
+				try {
+					ledger.rollback(domain_reservation.second);
+				} catch (const std::exception &e) {
+					FASTLIB_LOG(libvirt_hyp_log, warn) << "Could not roll back reservation of " << domain_reservation.first << ": " << e.what();
+				}
+			}
+		}
+		Capacity_ledger &ledger;
+		const std::unordered_map<std::string, Capacity_ledger::Reservation_id> &reservations;
+		bool released;
+	} reservations_guard{*capacity_ledger, reservations, false};
+	{
+		// Plan and reserve atomically with respect to other evacuate requests
+		auto planning_lock = capacity_ledger->lock_planning();
+		auto hosts = host_prober->probe_all(base_task->destinations, probe, probe_scope);
+		if (is_placement_mode(mode)) {
+			capacity_ledger->subtract_reserved(hosts);
+			placement = place_domains(demands, hosts, mode, overbooking);
+		} else {
+			init_destinations_capacities(*state, hosts, overbooking, *capacity_ledger);
+			for (const auto &demand : demands) {
+				try {
+					placement.assignment[demand.name] = get_next_destination(*state, overbooking, mode);
+				} catch (const std::runtime_error &e) {
+					FASTLIB_LOG(libvirt_hyp_log, warn) << "No destination for " << demand.name << ": " << e.what();
+					placement.unplaced.push_back(demand.name);
+				}
+			}
+		}
+		for (const auto &demand : demands) {
+			auto it = placement.assignment.find(demand.name);
+			if (it != placement.assignment.end())
+				reservations[demand.name] = capacity_ledger->reserve(it->second, demand);
+		}
+	}
+	// Schedule migrations by predicted migration time
+	state->scheduler.reset(new Evacuation_scheduler(settings.evacuation_order,
+				settings.max_migrations_per_destination, settings.max_migrations_per_nic));
+	for (const auto &demand : demands) {
+		auto it = placement.assignment.find(demand.name);
+		auto destination = it != placement.assignment.end() ? it->second : "";
+		auto link = destination != "" && rdma_migration ? destination + "-ib" : destination;
+		state->scheduler->add(demand.name, demand.memory * 1024.0 / migration_predictor->get_throughput(link), destination);
+	}
+	state->predicted_makespan = state->scheduler->predict_makespan();
+	FASTLIB_LOG(libvirt_hyp_log, trace) << "Predicted makespan of evacuation: " << state->predicted_makespan << " s.";
+	// Generate tasks in order of priority, so that they are also started in this order.
+	// Tasks are generated for exactly the domains known to the scheduler and ledger, so that each is finished.
 	std::vector<std::shared_ptr<Task>> tasks;
-	for (auto &domain_name : domain_names) {
+	for (const auto &domain_name : state->scheduler->get_domains()) {
 		// TODO: Implement copy constructor for Evacuate task
-		auto task = std::make_shared<Evacuate>();
+		auto task = std::make_shared<Evacuate_subtask>();
 		task->destinations = base_task->destinations;
 		task->mode = base_task->mode;
 		task->overbooking = base_task->overbooking;
@@ -830,9 +1521,31 @@ std::vector<std::shared_ptr<Task>> Libvirt_hypervisor::get_evacuate_tasks(const
 		task->driver = base_task->driver;
 		task->transport = base_task->transport;
 		task->vm_name.set(domain_name);
+		task->state = state;
+		// Restrict destinations to the planned one (none if the domain does not fit anywhere)
+		auto it = placement.assignment.find(domain_name);
+		task->destinations.clear();
+		if (it != placement.assignment.end()) {
+			task->destinations.push_back(it->second);
+			task->reservation = reservations.at(domain_name);
+		}
 		tasks.push_back(task);
 	}
-	init_destinations_capacities(base_task->destinations, driver, transport, overbooking);
+	if (is_placement_mode(mode)) {
+		// Announce placement before any migration starts
+		std::vector<Result> results;
+		for (const auto &domain_host : placement.assignment)
+			results.emplace_back(domain_host.first, "planned", "destination: " + domain_host.second);
+		for (const auto &domain_name : placement.unplaced)
+			results.emplace_back(domain_name, "unplaced", std::string("Domain does not fit on any destination."));
+		try {
+			comm->send_message(Result_container("evacuation planned", results, task_cont.id.get_or("")).to_string());
+		} catch (const std::exception &e) {
+			// Reservations are released by the tasks, so they have to be executed anyway.
+			FASTLIB_LOG(libvirt_hyp_log, warn) << "Could not announce evacuation plan: " << e.what();
+		}
+	}
+	reservations_guard.released = true;
 	return tasks;
 }
 
@@ -851,57 +1564,320 @@ Migrate conv_evacuate_to_migrate(const std::string &domain_name, const std::stri
 	return mig_task;
 }
 
-std::string get_next_destination(std::deque<std::pair<std::string, int>> &dest_caps, bool overbooking, const std::string &mode, std::mutex &m)
+void Libvirt_hypervisor::evacuate(const Evacuate &task, Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm, Task_report &report)
 {
-	using dest_caps_deque = std::deque<std::pair<std::string, int>>;
-	// To few destinations to migrate to -> error
-	if (dest_caps.empty())
-		throw std::runtime_error("No destination host left to evacuate to.");
-	// Lock for thread safety
-	std::lock_guard<std::mutex> lock(m);
-	// Use first destination in list
-	auto destination = dest_caps.front().first;
-	// Reduce capacity of destination
-	--dest_caps.front().second;
-	if (mode == "compact") { // fill host, then go to next
-		if (dest_caps.front().second < 1) { // if host full/overbooked
-			if (!overbooking) { // no overbooking -> drop host
-				dest_caps.pop_front();
-			} else { // overbooking -> rotate to next host
-				std::rotate(dest_caps.begin(), dest_caps.begin() + 1, dest_caps.end());
-			}
-		}
-	} else if (mode == "scatter") { // rotate through destinations
-		if (dest_caps.front().second < 1 && !overbooking) {
-				dest_caps.pop_front();
-		} else {
-			std::rotate(dest_caps.begin(), dest_caps.begin() + 1, dest_caps.end());
+	auto subtask = dynamic_cast<const Evacuate_subtask *>(&task);
+	if (!subtask)
+		throw std::logic_error("Evacuate task was not generated by get_evacuate_tasks.");
+	// Finish domain in scheduler in any case, so that it does not block other domains
+	auto &scheduler = *subtask->state->scheduler;
+	Evacuation_slot slot(scheduler, task.vm_name.get());
+	report.add("predicted-makespan", subtask->state->predicted_makespan);
+	auto mode = task.mode.get_or("auto");
+	auto domain_name = task.vm_name.get();
+	// Destination was planned and reserved in get_evacuate_tasks
+	if (task.destinations.empty()) {
+		throw std::runtime_error(is_placement_mode(mode) ?
+				"Domain " + domain_name + " does not fit on any destination." :
+				"No destination host left to evacuate to.");
+	}
+	Reservation_guard reservation(capacity_ledger, subtask->reservation);
+	auto destination = task.destinations.front();
+	if (is_placement_mode(mode))
+		report.add("placement", mode);
+	// The migration data leaves through the NIC routing to the host of the migrate uri
+	auto link = task.rdma_migration.get_or(false) ? destination + "-ib" : destination;
+	std::string nic;
+	try {
+		nic = get_interface_to(link);
+	} catch (const std::exception &e) {
+		FASTLIB_LOG(libvirt_hyp_log, warn) << "Could not determine NIC used to reach " << link << ": " << e.what() << " Assuming the default NIC.";
+		nic = "default";
+	}
+	// Wait for a free slot on destination and source NIC
+	tick_synchronized(time_measurement, "wait-for-slot");
+	slot.acquire(destination, nic);
+	tock_synchronized(time_measurement, "wait-for-slot");
+	FASTLIB_LOG(libvirt_hyp_log, trace) << "Evacuate domain " << domain_name << " to " << destination << ".";
+	// Convert task
+	auto mig_task = conv_evacuate_to_migrate(domain_name, destination, task);
+	// Migrate
+	migrate(mig_task, time_measurement, comm, report);
+	reservation.commit();
+	// The domain is visible to new probes of the destination only
+	host_prober->invalidate(destination);
+	if (slot.finish())
+		report.add("achieved-makespan", scheduler.get_elapsed());
+}
+
+// Convert a consolidate or rebalance task to the Migrate task of a single domain.
+template<typename T>
+Migrate conv_local_task_to_migrate(const std::string &domain_name, const std::string &destination, const T &task)
+{
+	Migrate mig_task;
+	mig_task.vm_name = domain_name;
+	mig_task.dest_hostname = destination;
+	mig_task.migration_type = task.migration_type;
+	mig_task.rdma_migration = task.rdma_migration;
+	mig_task.pscom_hook_procs = task.pscom_hook_procs;
+	mig_task.transport = task.transport;
+	mig_task.time_measurement = task.time_measurement;
+	mig_task.driver = task.driver;
+	return mig_task;
+}
+
+Result Libvirt_hypervisor::execute_planned_migration(const std::string &source_hostname, const Migrate &task, const std::vector<Capacity_ledger::Reservation_id> &reservation_ids, std::shared_ptr<fast::Communicator> comm)
+{
+	std::vector<std::unique_ptr<Reservation_guard>> reservations;
+	for (auto id : reservation_ids)
+		reservations.emplace_back(new Reservation_guard(capacity_ledger, id));
+	Time_measurement time_measurement(task.time_measurement.get_or(false));
+	Task_report report;
+	Result result;
+	try {
+		time_measurement.tick("overall");
+		report.add("source", source_hostname);
+		report.add("destination", task.dest_hostname);
+		if (task.swap_with.is_valid())
+			report.add("swap-with", task.swap_with.get().vm_name);
+		migrate_from(source_hostname, task, time_measurement, comm, report);
+		time_measurement.tock("overall");
+		for (auto &reservation : reservations)
+			reservation->commit();
+		result = Result(task.vm_name, "success", time_measurement, report.str());
+	} catch (const std::exception &e) {
+		FASTLIB_LOG(libvirt_hyp_log, warn) << "Exception while migrating " << task.vm_name << " from " << source_hostname << ": " << e.what();
+		result = Result(task.vm_name, "error", time_measurement, e.what());
+	}
+	// The moved domains are visible to new probes only
+	host_prober->invalidate(source_hostname);
+	host_prober->invalidate(task.dest_hostname);
+	return result;
+}
+
+void Libvirt_hypervisor::consolidate(const Consolidate &task, std::shared_ptr<fast::Communicator> comm, Consolidation_result &result)
+{
+	auto overbooking = task.overbooking.get_or(false);
+	auto max_parallel = task.max_parallel.get_or(2);
+	auto driver = task.driver.get_or(default_driver);
+	auto transport = task.transport.get_or(default_transport);
+	auto rdma_migration = task.rdma_migration.get_or(false);
+	if (max_parallel == 0)
+		throw std::invalid_argument("max-parallel of consolidate task must not be 0.");
+	auto probe = [driver, transport](const std::string &host) {return get_host_resources(host, driver, transport);};
+	Consolidation_plan plan;
+	std::vector<Capacity_ledger::Reservation_id> reservations;
+	{
+		// Plan and reserve atomically with respect to evacuate and other consolidate requests
+		auto planning_lock = capacity_ledger->lock_planning();
+		auto hosts = host_prober->probe_all(task.hosts, probe, driver + "+" + transport);
+		capacity_ledger->subtract_reserved(hosts);
+		plan = plan_consolidation(std::move(hosts), overbooking);
+		for (const auto &move : plan.moves)
+			reservations.push_back(capacity_ledger->reserve(move.destination, move.domain));
+	}
+	// Start the longest migrations first
+	std::vector<size_t> order(plan.moves.size());
+	std::vector<double> durations(plan.moves.size());
+	for (size_t i = 0; i != plan.moves.size(); ++i) {
+		const auto &move = plan.moves[i];
+		auto link = rdma_migration ? move.destination + "-ib" : move.destination;
+		order[i] = i;
+		durations[i] = move.domain.memory * 1024.0 / migration_predictor->get_throughput(link);
+	}
+	std::stable_sort(order.begin(), order.end(), [&durations](size_t lhs, size_t rhs) {return durations[lhs] > durations[rhs];});
+	std::vector<Result> results(plan.moves.size());
+	std::vector<std::function<void()>> jobs;
+	for (auto i : order) {
+		jobs.push_back([this, i, &plan, &reservations, &results, &task, comm]
+		{
+			const auto &move = plan.moves[i];
+			auto mig_task = conv_local_task_to_migrate(move.domain.name, move.destination, task);
+			results[i] = execute_planned_migration(move.source, mig_task, {reservations[i]}, comm);
+		});
+	}
+	run_bounded(jobs, max_parallel);
+	// A host is freed if all of its domains were migrated
+	for (const auto &host : plan.freed_hosts) {
+		bool freed = true;
+		for (size_t i = 0; i != plan.moves.size(); ++i)
+			freed = freed && (plan.moves[i].source != host || results[i].status == "success");
+		if (freed)
+			result.freed_hosts.push_back(host);
+	}
+	result.results = std::move(results);
+}
+
+void Libvirt_hypervisor::rebalance(const Rebalance &task, std::shared_ptr<fast::Communicator> comm, Rebalance_result &result)
+{
+	auto target = task.target.get_or(0.8);
+	auto sample_time = std::chrono::duration<double>(task.sample_time.get_or(1));
+	auto swap = task.swap.get_or(true);
+	auto overbooking = task.overbooking.get_or(false);
+	auto max_parallel = task.max_parallel.get_or(2);
+	auto driver = task.driver.get_or(default_driver);
+	auto transport = task.transport.get_or(default_transport);
+	if (max_parallel == 0)
+		throw std::invalid_argument("max-parallel of rebalance task must not be 0.");
+	if (sample_time.count() <= 0)
+		throw std::invalid_argument("sample-time of rebalance task must be greater than 0.");
+	if (swap && driver != "qemu") {
+		FASTLIB_LOG(libvirt_hyp_log, trace) << "Swap migration is only supported by the qemu driver. Disabling swaps.";
+		swap = false;
+	}
+	auto probe = [driver, transport, sample_time](const std::string &host) {return get_host_load(host, driver, transport, sample_time);};
+	Rebalance_plan plan;
+	std::vector<std::vector<Capacity_ledger::Reservation_id>> reservations;
+	{
+		// Plan and reserve atomically with respect to evacuate and other rebalance requests
+		auto planning_lock = capacity_ledger->lock_planning();
+		auto hosts = host_prober->probe_all(task.hosts, probe, "load+" + driver + "+" + transport,
+				std::chrono::duration_cast<std::chrono::milliseconds>(sample_time));
+		capacity_ledger->subtract_reserved(hosts);
+		plan = plan_rebalance(std::move(hosts), target, swap, overbooking);
+		for (const auto &action : plan.actions) {
+			reservations.push_back({capacity_ledger->reserve(action.destination, action.domain)});
+			if (!action.swap_with.name.empty())
+				reservations.back().push_back(capacity_ledger->reserve(action.source, action.swap_with));
 		}
-	} else if (mode == "auto") { // sort to distribute domains water-filling-like
-		std::sort(dest_caps.begin(), dest_caps.end(),
-				[](dest_caps_deque::const_reference a, dest_caps_deque::const_reference b)
-				{return a.second > b.second;});
 	}
-	return destination;
+	std::vector<Result> results(plan.actions.size());
+	std::vector<std::function<void()>> jobs;
+	for (size_t i = 0; i != plan.actions.size(); ++i) {
+		jobs.push_back([this, i, &plan, &reservations, &results, &task, comm]
+		{
+			const auto &action = plan.actions[i];
+			auto mig_task = conv_local_task_to_migrate(action.domain.name, action.destination, task);
+			if (!action.swap_with.name.empty()) {
+				Swap_with swap_with;
+				swap_with.vm_name = action.swap_with.name;
+				swap_with.pscom_hook_procs = task.pscom_hook_procs;
+				mig_task.swap_with = swap_with;
+			}
+			results[i] = execute_planned_migration(action.source, mig_task, reservations[i], comm);
+		});
+	}
+	run_bounded(jobs, max_parallel);
+	result.results = std::move(results);
+	result.overloaded_hosts = plan.overloaded_hosts;
 }
 
-void Libvirt_hypervisor::evacuate(const Evacuate &task, Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm)
+void Libvirt_hypervisor::permute(const Permute &task, std::shared_ptr<fast::Communicator> comm, Permutation_result &result)
 {
-	auto mode = task.mode.get_or("auto");
-	auto overbooking = task.overbooking.get_or(true);
+	auto migration_type = task.migration_type.get_or("warm");
+	auto rdma_migration = task.rdma_migration.get_or(false);
 	auto driver = task.driver.get_or(default_driver);
 	auto transport = task.transport.get_or(default_transport);
-	auto domain_name = task.vm_name.get();
-	// Connect to libvirt
-	auto conn = connect("", driver);
-	// Get cap per destination and mutex for synchronization in pair
-	auto dest_caps_tuple = get_destinations_capacities();
-	const auto &destination = get_next_destination(std::get<0>(dest_caps_tuple), overbooking, mode, std::get<1>(dest_caps_tuple));
-	FASTLIB_LOG(libvirt_hyp_log, trace) << "Evacuate domain " << domain_name << " to " << destination << ".";
-	// Convert task
-	auto mig_task = conv_evacuate_to_migrate(domain_name, destination, task);
-	// Migrate
-	migrate(mig_task, time_measurement, comm);
+	const auto &cycle = task.cycle;
+	auto k = cycle.size();
+	if (driver != "qemu")
+		throw std::runtime_error("Currently permutation is only supported by the qemu driver.");
+	if (migration_type != "live" && migration_type != "warm") {
+		FASTLIB_LOG(libvirt_hyp_log, trace) << "Migration type " << migration_type << " is not supported by permutation. Using warm migration.";
+		migration_type = "warm";
+	}
+	// Connect to all hosts and find domains
+	std::unordered_map<std::string, std::shared_ptr<virConnect>> conns;
+	std::unordered_map<std::string, long long> free_memory;
+	for (const auto &entry : cycle) {
+		if (conns.count(entry.host) != 0)
+			throw std::invalid_argument("Host " + entry.host + " occurs twice in cycle of permute task.");
+		conns[entry.host] = connect(entry.host, driver, transport);
+		free_memory[entry.host] = get_free_memory(conns[entry.host].get()) / 1024;
+	}
+	std::vector<std::shared_ptr<virDomain>> domains;
+	std::vector<std::string> hosts;
+	std::vector<unsigned long long> memory;
+	for (const auto &entry : cycle) {
+		domains.push_back(find_by_name(conns[entry.host].get(), entry.vm_name));
+		check_state(domains.back().get(), VIR_DOMAIN_RUNNING);
+		hosts.push_back(entry.host);
+		memory.push_back(get_memory_size(domains.back().get()));
+	}
+	Permutation_coordinator coordinator(std::move(hosts), std::move(memory), std::move(free_memory));
+	if (!coordinator.is_feasible())
+		throw std::runtime_error("Not enough memory to permute domains, even after their occupants left.");
+	auto permute_domain = [&, comm](size_t i)
+	{
+		Permutation_member member(coordinator, i);
+		const auto &entry = cycle[i];
+		const auto &destination = cycle[(i + 1) % k].host;
+		auto domain = domains[i];
+		Time_measurement time_measurement(task.time_measurement.get_or(false));
+		Task_report report;
+		try {
+			time_measurement.tick("overall");
+			report.add("source", entry.host);
+			report.add("destination", destination);
+			time_measurement.tick("wait-for-room");
+			bool reserved = coordinator.wait_for_turn(i);
+			time_measurement.tock("wait-for-room");
+			auto mig_task = conv_local_task_to_migrate(entry.vm_name, destination, task);
+			auto flags = get_migrate_flags(migration_type);
+			// Suspend pscom (resume in destructor)
+			Pscom_handler pscom_handler(mig_task, comm, time_measurement);
+			// Guard migration of devices
+			auto inventory = domain_inventory_cache->get(domain.get());
+			Migrate_devices_guard dev_guard(pci_device_handler, domain, *inventory, time_measurement);
+			Migrate_ivshmem_guard ivshmem_guard(domain, *inventory, time_measurement, "", settings.max_parallel_device_ops);
+			// Guard repin of vcpus
+			Repin_guard repin_guard(domain, flags, mig_task.vcpu_map, time_measurement);
+			std::shared_ptr<virDomain> dest_domain;
+			if (reserved) {
+				auto migrate_uri = get_migrate_uri(rdma_migration, destination);
+				time_measurement.tick("migrate");
+				dest_domain = migrate_domain(domain.get(), conns.at(destination).get(), flags, migrate_uri);
+				time_measurement.tock("migrate");
+				coordinator.left_source(i);
+			} else if (settings.swap_staging == "save") {
+				// Stage domain through a save image, since its destination has no room yet
+				report.add("staged", true);
+				time_measurement.tick("downtime");
+				Save_staging_guard staging(domain, entry.host, settings.staging_path, settings.staging_shared, time_measurement);
+				coordinator.left_source(i);
+				staging.transfer(destination);
+				time_measurement.tick("wait-for-room-staged");
+				coordinator.wait_for_room(i);
+				time_measurement.tock("wait-for-room-staged");
+				dest_domain = staging.restore(conns.at(destination).get(), flags & VIR_MIGRATE_PAUSED);
+				time_measurement.tock("downtime");
+			} else {
+				// Stage domain through a snapshot, since its destination has no room yet
+				report.add("staged", true);
+				time_measurement.tick("downtime");
+				time_measurement.tick("suspend");
+				// Reverted on source in destructor if not restored on destination
+				Snapshot_staging_guard staging(domain);
+				time_measurement.tock("suspend");
+				coordinator.left_source(i);
+				time_measurement.tick("wait-for-room-staged");
+				coordinator.wait_for_room(i);
+				time_measurement.tock("wait-for-room-staged");
+				time_measurement.tick("resume");
+				dest_domain = staging.restore(conns.at(destination).get(), flags & VIR_MIGRATE_PAUSED);
+				time_measurement.tock("resume");
+				time_measurement.tock("downtime");
+			}
+			coordinator.arrived(i);
+			// Set destination domain for guards
+			repin_guard.set_destination_domain(dest_domain);
+			dev_guard.set_destination_domain(dest_domain);
+			ivshmem_guard.set_destination_domain(dest_domain);
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(libvirt_hyp_log, warn) << "Exception while permuting " << entry.vm_name << ": " << e.what();
+			return Result(entry.vm_name, "error", time_measurement, e.what());
+		}
+		time_measurement.tock("overall");
+		return Result(entry.vm_name, "success", time_measurement, report.str());
+	};
+	// Start all moves, the coordinator decides when each may migrate
+	std::vector<std::future<Result>> futures;
+	for (size_t i = 0; i != k; ++i)
+		futures.push_back(std::async(std::launch::async, permute_domain, i));
+	for (auto &future : futures)
+		result.results.push_back(future.get());
+	for (const auto &entry : cycle)
+		host_prober->invalidate(entry.host);
 }
 
 void Libvirt_hypervisor::repin(const Repin &task, Time_measurement &time_measurement)
@@ -914,7 +1890,45 @@ void Libvirt_hypervisor::repin(const Repin &task, Time_measurement &time_measure
 	// Get domain by name
 	auto domain = find_by_name(conn.get(), task.vm_name);
 	FASTLIB_LOG(libvirt_hyp_log, trace) << "Repin domain " << task.vm_name << ".";
-	repin_vcpus(domain.get(), vcpu_map);
+	auto repinned = repin_vcpus(domain.get(), vcpu_map);
+	FASTLIB_LOG(libvirt_hyp_log, trace) << "Repinned " << repinned << " of " << vcpu_map.size() << " vcpus.";
+	domain_inventory_cache->invalidate(domain.get());
+}
+
+void Libvirt_hypervisor::repin_threads(const Repin_threads &task, Time_measurement &time_measurement)
+{
+	auto driver = task.driver.is_valid() ? task.driver.get() : default_driver;
+	// Connect to libvirt
+	auto conn = connect("", driver);
+	// Get domain by name
+	auto domain = find_by_name(conn.get(), task.vm_name);
+	FASTLIB_LOG(libvirt_hyp_log, trace) << "Repin threads of domain " << task.vm_name << ".";
+	if (task.vcpu_map.is_valid()) {
+		tick_synchronized(time_measurement, "repin-vcpus");
+		auto repinned = repin_vcpus(domain.get(), task.vcpu_map.get());
+		tock_synchronized(time_measurement, "repin-vcpus");
+		FASTLIB_LOG(libvirt_hyp_log, trace) << "Repinned " << repinned << " of " << task.vcpu_map.get().size() << " vcpus.";
+	}
+	if (task.emulator_map.is_valid()) {
+		tick_synchronized(time_measurement, "repin-emulator");
+		auto repinned = repin_emulator(domain.get(), task.emulator_map.get());
+		tock_synchronized(time_measurement, "repin-emulator");
+		FASTLIB_LOG(libvirt_hyp_log, trace) << (repinned ? "Repinned" : "Kept pinning of") << " emulator threads.";
+	}
+	if (task.iothread_map.is_valid()) {
+		tick_synchronized(time_measurement, "repin-iothreads");
+		auto repinned = repin_iothreads(domain.get(), task.iothread_map.get());
+		tock_synchronized(time_measurement, "repin-iothreads");
+		FASTLIB_LOG(libvirt_hyp_log, trace) << "Repinned " << repinned << " of " << task.iothread_map.get().size() << " iothreads.";
+	}
+	// Move memory after the threads, so that pages allocated meanwhile are already local.
+	if (task.memnode_map.is_valid()) {
+		tick_synchronized(time_measurement, "repin-memory");
+		set_memory_nodes(domain.get(), task.memnode_map.get());
+		tock_synchronized(time_measurement, "repin-memory");
+	}
+	// Pinning and numatune are part of the cached inventory, but changing them emits no device or lifecycle events.
+	domain_inventory_cache->invalidate(domain.get());
 }
 
 void Libvirt_hypervisor::suspend(const fast::msg::migfra::Suspend &task, fast::msg::migfra::Time_measurement &time_measurement)
@@ -10,12 +10,124 @@
 #define LIBVIRT_HYPERVISOR_HPP
 
 #include "hypervisor.hpp"
+#include "capacity_ledger.hpp"
+#include "vf_pool.hpp"
 
 #include <memory>
 #include <vector>
 #include <string>
 
+class Libvirt_event_loop;
 class PCI_device_handler;
+class Domain_inventory_cache;
+class Connection_pool;
+class Migration_predictor;
+class Host_prober;
+
+/**
+ * \brief Optional settings of Libvirt_hypervisor read from the hypervisor section of the config file.
+ */
+struct Libvirt_hypervisor_settings
+{
+	/**
+	 * \brief Defines how migrations reach the destination host.
+	 *
+	 * managed: migfra opens a new connection to the destination for each migration (virDomainMigrate3).
+	 * pooled: like managed, but connections to destinations are kept open and reused.
+	 * peer2peer: the source libvirtd connects to the destination itself (virDomainMigrateToURI3).
+	 * tunnelled: like peer2peer, but migration data is tunnelled through the libvirtd connection.
+	 */
+	std::string migration_path = "managed";
+	/**
+	 * \brief Remaining bytes of a live migration at which pscom processes are suspended.
+	 *
+	 * If not 0, live migrations of domains without devices to detach start pre-copy while the
+	 * application still communicates, so that pscom is only suspended for the final switchover.
+	 */
+	unsigned long long pre_copy_threshold = 0;
+	/**
+	 * \brief Downtime in seconds a migration with migration-type auto may cause.
+	 */
+	double max_downtime = 0.3;
+	/**
+	 * \brief Throughput in bytes/s assumed for links without previous migrations.
+	 */
+	double default_link_throughput = 1.25e9;
+	/**
+	 * \brief Duration in seconds the dirty rate of a domain is sampled for migration-type auto.
+	 */
+	unsigned int dirty_rate_sample_time = 1;
+	/**
+	 * \brief Memory in KiB left to a domain in addition to its used memory when shrinking it before migration.
+	 *
+	 * If not 0, the memory of domains is shrunk using the balloon driver before migration and restored afterwards.
+	 */
+	unsigned long long balloon_headroom = 0;
+	/**
+	 * \brief Time in seconds probing the destinations of an evacuation may take. Slower hosts are dropped.
+	 */
+	double probe_timeout = 5;
+	/**
+	 * \brief Time in seconds probed resources of destinations are reused by subsequent evacuations.
+	 */
+	double probe_cache_ttl = 5;
+	/**
+	 * \brief Concurrent probes of destinations (0: one thread per destination).
+	 */
+	unsigned int max_parallel_probes = 8;
+	/**
+	 * \brief Order in which the domains of an evacuation are migrated by predicted migration time.
+	 *
+	 * largest-first: minimizes the time to drain the node.
+	 * smallest-first: relieves the node of as many domains as early as possible.
+	 * none: order of the domains on the node.
+	 */
+	std::string evacuation_order = "largest-first";
+	/**
+	 * \brief Concurrent migrations of an evacuation per destination (0: unlimited).
+	 */
+	unsigned int max_migrations_per_destination = 0;
+	/**
+	 * \brief Concurrent migrations of an evacuation per source NIC (0: unlimited).
+	 *
+	 * The NIC of a migration is the local network interface routing to its destination,
+	 * or to <destination>-ib with rdma-migration. Predicting the makespan assumes a single NIC.
+	 */
+	unsigned int max_migrations_per_nic = 0;
+	/**
+	 * \brief Defines how swap migrations and permutations stage a domain whose destination has no room yet.
+	 *
+	 * snapshot: Internal snapshot which is redefined and reverted on the destination.
+	 * save: Memory is saved to an image in staging_path, streamed to the destination and restored there.
+	 */
+	std::string swap_staging = "snapshot";
+	/**
+	 * \brief Directory of the images used by swap_staging "save", e.g., on tmpfs, NVMe or a parallel file system.
+	 *
+	 * Images bypass the page cache unless the directory is on tmpfs.
+	 */
+	std::string staging_path = "/dev/shm/migfra";
+	/**
+	 * \brief True if staging_path is shared between hosts, so that images need no transfer.
+	 */
+	bool staging_shared = false;
+	/**
+	 * \brief Concurrent attach/detach operations of PCI and ivshmem devices per domain (0: unlimited).
+	 */
+	unsigned int max_parallel_device_ops = 4;
+	/**
+	 * \brief Defines whether the contents of ivshmem regions are sent to the destination of a migration.
+	 *
+	 * none: the devices are reattached to empty regions on the destination.
+	 * copy: the regions are streamed to the destination after the devices were detached.
+	 * dirty: the regions are streamed while still in use and only changed pages are sent after the devices were detached.
+	 */
+	std::string ivshmem_transfer = "none";
+	/**
+	 * \brief SR-IOV physical functions whose virtual functions are grown on demand and trimmed after stop.
+	 */
+	std::vector<VF_pool_config> vf_pools;
+};
 
 /**
  * \brief Implementation of the Hypervisor interface using libvirt API.
@@ -34,8 +146,9 @@ public:
 	 *
 	 * Establishes an connection to qemu on the local host.
 	 * \param nodes Defines the nodes to look for already running virtual machines.
+	 * \param settings Optional settings, e.g., the migration path.
 	 */
-	Libvirt_hypervisor(std::vector<std::string> nodes, std::string default_driver, std::string default_transport, unsigned int start_timeout, unsigned int stop_timeout);
+	Libvirt_hypervisor(std::vector<std::string> nodes, std::string default_driver, std::string default_transport, unsigned int start_timeout, unsigned int stop_timeout, Libvirt_hypervisor_settings settings = Libvirt_hypervisor_settings());
 	/**
 	 * \brief Method to start a virtual machine.
 	 *
@@ -64,17 +177,25 @@ public:
 	 * \param rdma_migration Enables rdma migration.
 	 * \param time_measurement Time measurement facility.
 	 */
-	void migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm) override;
+	void migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm, Task_report &report) override;
 	/**
 	 * \brief Method to evacuate an entire host, i.e., migrate all domains away from this host.
 	 */
-	void evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm) override;
+	void evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm, Task_report &report) override;
 	/**
 	 * \brief Method to repin vcpus of a virtual machine.
 	 *
 	 * Calls libvirt API to reassign CPUs to VCPUs.
 	 */
 	void repin(const fast::msg::migfra::Repin &task, fast::msg::migfra::Time_measurement &time_measurement) override;
+	/**
+	 * \brief Method to repin vcpus, emulator threads and iothreads of a virtual machine.
+	 *
+	 * Only threads whose cpus changed are repinned. Memory is moved to the NUMA nodes of memnode_map by updating
+	 * the numatune nodeset (mode strict or restrictive required). The phases are measured as repin-vcpus,
+	 * repin-emulator, repin-iothreads and repin-memory.
+	 */
+	void repin_threads(const Repin_threads &task, fast::msg::migfra::Time_measurement &time_measurement) override;
 	/**
 	 * \brief Method to suspend the execution of a virtual machine.
 	 *
@@ -91,17 +212,57 @@ public:
 	/**
  	 * \brief Method to generate a task list for Evacuate.
  	 */
-	std::vector<std::shared_ptr<fast::msg::migfra::Task>> get_evacuate_tasks(const fast::msg::migfra::Task_container &task_cont) override;
+	std::vector<std::shared_ptr<fast::msg::migfra::Task>> get_evacuate_tasks(const fast::msg::migfra::Task_container &task_cont, std::shared_ptr<fast::Communicator> comm) override;
+	/**
+	 * \brief Method to consolidate the domains of several hosts onto as few of them as possible.
+	 *
+	 * Plans the migrations using plan_consolidation and reserves them in the capacity ledger.
+	 * The migrations are executed from their source hosts through the migrate path, at most
+	 * max-parallel (default 2) at the same time.
+	 */
+	void consolidate(const Consolidate &task, std::shared_ptr<fast::Communicator> comm, Consolidation_result &result) override;
+	/**
+	 * \brief Method to bring the cpu utilization of several hosts under a target.
+	 *
+	 * Samples the cpu usage of all domains using virConnectGetAllDomainStats, plans migrations and
+	 * swap migrations using plan_rebalance and executes them like consolidate.
+	 */
+	void rebalance(const Rebalance &task, std::shared_ptr<fast::Communicator> comm, Rebalance_result &result) override;
+	/**
+	 * \brief Method to move domains around a cycle of hosts.
+	 *
+	 * Generalizes swap migration: domains migrate in parallel as soon as their destination has room,
+	 * a fully blocked cycle is resolved by staging domains through snapshots (see Permutation_coordinator).
+	 */
+	void permute(const Permute &task, std::shared_ptr<fast::Communicator> comm, Permutation_result &result) override;
 private:
+	/**
+	 * \brief Execute a planned migration from source_hostname and commit its reservations on success.
+	 *
+	 * Errors are returned in the result.
+	 */
+	fast::msg::migfra::Result execute_planned_migration(const std::string &source_hostname, const fast::msg::migfra::Migrate &task, const std::vector<Capacity_ledger::Reservation_id> &reservation_ids, std::shared_ptr<fast::Communicator> comm);
+	/**
+	 * \brief Migrate a domain running on source_hostname ("" for the local host).
+	 */
+	void migrate_from(const std::string &source_hostname, const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm, Task_report &report);
 
 	void swap_migration(const std::string &name, const std::string &name_swap, const std::string &hostname, const std::string &hostname_swap, unsigned long flags, unsigned long flags_swap, bool rdma_migration, const std::string &driver, const std::string &transport, const fast::msg::migfra::Migrate &task, std::shared_ptr<fast::Communicator> comm, fast::msg::migfra::Time_measurement &time_measurement);
 
+	// Declared first, since it has to be started before any connection is opened.
+	std::shared_ptr<Libvirt_event_loop> event_loop;
+	std::shared_ptr<Domain_inventory_cache> domain_inventory_cache;
 	std::shared_ptr<PCI_device_handler> pci_device_handler;
+	std::shared_ptr<Connection_pool> connection_pool;
+	std::shared_ptr<Migration_predictor> migration_predictor;
+	std::shared_ptr<Capacity_ledger> capacity_ledger;
+	std::shared_ptr<Host_prober> host_prober;
 	std::vector<std::string> nodes;
 	std::string default_driver;
 	std::string default_transport;
 	unsigned int start_timeout;
 	unsigned int stop_timeout;
+	Libvirt_hypervisor_settings settings;
 };
 
 #endif
@@ -0,0 +1,199 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "local_task.hpp"
+
+#include <stdexcept>
+
+// Set optional from node if node is defined.
+template<typename T>
+static void load_optional(fast::Optional<T> &optional, const YAML::Node &node)
+{
+	if (node)
+		optional = node.as<T>();
+}
+
+// Add optional to node if it is valid.
+template<typename T>
+static void emit_optional(YAML::Node node, const fast::Optional<T> &optional)
+{
+	if (optional.is_valid())
+		node = optional.get();
+}
+
+YAML::Node Consolidate::emit() const
+{
+	YAML::Node node = Task::emit();
+	node["task"] = "consolidate hosts";
+	node["hosts"] = hosts;
+	emit_optional(node["parameter"]["overbooking"], overbooking);
+	emit_optional(node["parameter"]["max-parallel"], max_parallel);
+	emit_optional(node["parameter"]["migration-type"], migration_type);
+	emit_optional(node["parameter"]["rdma-migration"], rdma_migration);
+	emit_optional(node["parameter"]["pscom-hook-procs"], pscom_hook_procs);
+	emit_optional(node["parameter"]["transport"], transport);
+	return node;
+}
+
+void Consolidate::load(const YAML::Node &node)
+{
+	Task::load(node);
+	if (!node["hosts"])
+		throw std::invalid_argument("No hosts defined in consolidate task.");
+	hosts = node["hosts"].as<decltype(hosts)>();
+	auto parameter = node["parameter"];
+	if (parameter) {
+		load_optional(overbooking, parameter["overbooking"]);
+		load_optional(max_parallel, parameter["max-parallel"]);
+		load_optional(migration_type, parameter["migration-type"]);
+		load_optional(rdma_migration, parameter["rdma-migration"]);
+		load_optional(pscom_hook_procs, parameter["pscom-hook-procs"]);
+		load_optional(transport, parameter["transport"]);
+	}
+}
+
+YAML::Node Rebalance::emit() const
+{
+	YAML::Node node = Task::emit();
+	node["task"] = "rebalance hosts";
+	node["hosts"] = hosts;
+	emit_optional(node["parameter"]["target"], target);
+	emit_optional(node["parameter"]["sample-time"], sample_time);
+	emit_optional(node["parameter"]["swap"], swap);
+	emit_optional(node["parameter"]["overbooking"], overbooking);
+	emit_optional(node["parameter"]["max-parallel"], max_parallel);
+	emit_optional(node["parameter"]["migration-type"], migration_type);
+	emit_optional(node["parameter"]["rdma-migration"], rdma_migration);
+	emit_optional(node["parameter"]["pscom-hook-procs"], pscom_hook_procs);
+	emit_optional(node["parameter"]["transport"], transport);
+	return node;
+}
+
+void Rebalance::load(const YAML::Node &node)
+{
+	Task::load(node);
+	if (!node["hosts"])
+		throw std::invalid_argument("No hosts defined in rebalance task.");
+	hosts = node["hosts"].as<decltype(hosts)>();
+	auto parameter = node["parameter"];
+	if (parameter) {
+		load_optional(target, parameter["target"]);
+		load_optional(sample_time, parameter["sample-time"]);
+		load_optional(swap, parameter["swap"]);
+		load_optional(overbooking, parameter["overbooking"]);
+		load_optional(max_parallel, parameter["max-parallel"]);
+		load_optional(migration_type, parameter["migration-type"]);
+		load_optional(rdma_migration, parameter["rdma-migration"]);
+		load_optional(pscom_hook_procs, parameter["pscom-hook-procs"]);
+		load_optional(transport, parameter["transport"]);
+	}
+}
+
+YAML::Node Permute::emit() const
+{
+	YAML::Node node = Task::emit();
+	node["task"] = "permute domains";
+	for (const auto &entry : cycle) {
+		YAML::Node entry_node;
+		entry_node["vm-name"] = entry.vm_name;
+		entry_node["host"] = entry.host;
+		node["cycle"].push_back(entry_node);
+	}
+	emit_optional(node["parameter"]["migration-type"], migration_type);
+	emit_optional(node["parameter"]["rdma-migration"], rdma_migration);
+	emit_optional(node["parameter"]["pscom-hook-procs"], pscom_hook_procs);
+	emit_optional(node["parameter"]["transport"], transport);
+	return node;
+}
+
+void Permute::load(const YAML::Node &node)
+{
+	Task::load(node);
+	if (!node["cycle"] || !node["cycle"].IsSequence())
+		throw std::invalid_argument("No cycle defined in permute task.");
+	cycle.clear();
+	for (const auto &entry_node : node["cycle"]) {
+		if (!entry_node["vm-name"] || !entry_node["host"])
+			throw std::invalid_argument("Entry of cycle in permute task requires vm-name and host.");
+		cycle.push_back(Permute_entry{entry_node["vm-name"].as<std::string>(), entry_node["host"].as<std::string>()});
+	}
+	if (cycle.size() < 2)
+		throw std::invalid_argument("Cycle of permute task requires at least two domains.");
+	auto parameter = node["parameter"];
+	if (parameter) {
+		load_optional(migration_type, parameter["migration-type"]);
+		load_optional(rdma_migration, parameter["rdma-migration"]);
+		load_optional(pscom_hook_procs, parameter["pscom-hook-procs"]);
+		load_optional(transport, parameter["transport"]);
+	}
+}
+
+YAML::Node Repin_threads::emit() const
+{
+	YAML::Node node = Task::emit();
+	node["task"] = "repin threads";
+	node["vm-name"] = vm_name;
+	emit_optional(node["vcpu-map"], vcpu_map);
+	emit_optional(node["emulator-map"], emulator_map);
+	emit_optional(node["iothread-map"], iothread_map);
+	emit_optional(node["memnode-map"], memnode_map);
+	return node;
+}
+
+void Repin_threads::load(const YAML::Node &node)
+{
+	Task::load(node);
+	if (!node["vm-name"])
+		throw std::invalid_argument("No vm-name defined in repin threads task.");
+	vm_name = node["vm-name"].as<std::string>();
+	load_optional(vcpu_map, node["vcpu-map"]);
+	load_optional(emulator_map, node["emulator-map"]);
+	load_optional(iothread_map, node["iothread-map"]);
+	load_optional(memnode_map, node["memnode-map"]);
+	if (!vcpu_map.is_valid() && !emulator_map.is_valid() && !iothread_map.is_valid() && !memnode_map.is_valid())
+		throw std::invalid_argument("Repin threads task requires vcpu-map, emulator-map, iothread-map or memnode-map.");
+}
+
+bool Local_task_container::is_local_task(const YAML::Node &node)
+{
+	if (!node.IsMap() || !node["task"])
+		return false;
+	auto type = node["task"].as<std::string>();
+	return type == "consolidate hosts" || type == "rebalance hosts" || type == "permute domains" || type == "repin threads";
+}
+
+void Local_task_container::load(const YAML::Node &node)
+{
+	auto type = node["task"].as<std::string>();
+	if (type == "consolidate hosts")
+		task = std::make_shared<Consolidate>();
+	else if (type == "rebalance hosts")
+		task = std::make_shared<Rebalance>();
+	else if (type == "permute domains")
+		task = std::make_shared<Permute>();
+	else if (type == "repin threads")
+		task = std::make_shared<Repin_threads>();
+	else
+		throw std::invalid_argument("Unknown local task type: " + type);
+	task->load(node);
+	load_optional(concurrent_execution, node["concurrent-execution"]);
+	load_optional(id, node["id"]);
+}
+
+std::string Local_task_container::result_type() const
+{
+	if (std::dynamic_pointer_cast<Consolidate>(task))
+		return "hosts consolidated";
+	if (std::dynamic_pointer_cast<Rebalance>(task))
+		return "hosts rebalanced";
+	if (std::dynamic_pointer_cast<Permute>(task))
+		return "domains permuted";
+	if (std::dynamic_pointer_cast<Repin_threads>(task))
+		return "threads repinned";
+	throw std::logic_error("Local task container holds no task.");
+}
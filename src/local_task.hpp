@@ -0,0 +1,170 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef LOCAL_TASK_HPP
+#define LOCAL_TASK_HPP
+
+#include <fast-lib/message/migfra/task.hpp>
+#include <fast-lib/message/migfra/result.hpp>
+#include <fast-lib/optional.hpp>
+#include <yaml-cpp/yaml.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * \brief Task to consolidate the domains of several hosts onto as few of them as possible.
+ *
+ * Tasks in this file are not part of the fast-lib message definitions and are parsed by Local_task_container.
+ */
+struct Consolidate :
+	public fast::msg::migfra::Task
+{
+	YAML::Node emit() const override;
+	void load(const YAML::Node &node) override;
+
+	std::vector<std::string> hosts;
+	fast::Optional<bool> overbooking;
+	fast::Optional<unsigned int> max_parallel;
+	fast::Optional<std::string> migration_type;
+	fast::Optional<bool> rdma_migration;
+	fast::Optional<std::string> pscom_hook_procs;
+	fast::Optional<std::string> transport;
+};
+
+/**
+ * \brief Results of a Consolidate task.
+ */
+struct Consolidation_result
+{
+	// Result of each migrated domain.
+	std::vector<fast::msg::migfra::Result> results;
+	// Hosts which were emptied successfully.
+	std::vector<std::string> freed_hosts;
+};
+
+/**
+ * \brief Task to bring the cpu utilization of several hosts under a target by migrating few domains.
+ */
+struct Rebalance :
+	public fast::msg::migfra::Task
+{
+	YAML::Node emit() const override;
+	void load(const YAML::Node &node) override;
+
+	std::vector<std::string> hosts;
+	fast::Optional<double> target;
+	fast::Optional<double> sample_time;
+	fast::Optional<bool> swap;
+	fast::Optional<bool> overbooking;
+	fast::Optional<unsigned int> max_parallel;
+	fast::Optional<std::string> migration_type;
+	fast::Optional<bool> rdma_migration;
+	fast::Optional<std::string> pscom_hook_procs;
+	fast::Optional<std::string> transport;
+};
+
+/**
+ * \brief Results of a Rebalance task.
+ */
+struct Rebalance_result
+{
+	// Result of each migration or swap migration.
+	std::vector<fast::msg::migfra::Result> results;
+	// Hosts which are still above the target.
+	std::vector<std::string> overloaded_hosts;
+};
+
+/**
+ * \brief Domain of a Permute task together with the host it runs on.
+ */
+struct Permute_entry
+{
+	std::string vm_name;
+	std::string host;
+};
+
+/**
+ * \brief Task to move domains around a cycle of hosts.
+ *
+ * Each domain moves to the host of the next domain in the cycle, the last domain to the host of the first one.
+ */
+struct Permute :
+	public fast::msg::migfra::Task
+{
+	YAML::Node emit() const override;
+	void load(const YAML::Node &node) override;
+
+	std::vector<Permute_entry> cycle;
+	fast::Optional<std::string> migration_type;
+	fast::Optional<bool> rdma_migration;
+	fast::Optional<std::string> pscom_hook_procs;
+	fast::Optional<std::string> transport;
+};
+
+/**
+ * \brief Results of a Permute task.
+ */
+struct Permutation_result
+{
+	// Result of each domain of the cycle.
+	std::vector<fast::msg::migfra::Result> results;
+};
+
+/**
+ * \brief Task to repin the vcpus, emulator threads and iothreads of a domain and to move its memory.
+ *
+ * Extends the repin task of fast-lib, whose message only carries a vcpu map, so that housekeeping threads
+ * can be moved off the cpus of the vcpus. Threads already pinned to the requested cpus are left untouched.
+ * If the vcpus move to another socket, the memory should follow to the NUMA nodes given by memnode_map.
+ */
+struct Repin_threads :
+	public fast::msg::migfra::Task
+{
+	YAML::Node emit() const override;
+	void load(const YAML::Node &node) override;
+
+	std::string vm_name;
+	fast::Optional<std::vector<std::vector<unsigned int>>> vcpu_map;
+	// Cpus of the emulator threads, e.g., the main loop of qemu.
+	fast::Optional<std::vector<unsigned int>> emulator_map;
+	// Cpus of each iothread in order of their ids.
+	fast::Optional<std::vector<std::vector<unsigned int>>> iothread_map;
+	// NUMA nodes the memory is migrated to.
+	fast::Optional<std::vector<unsigned int>> memnode_map;
+};
+
+/**
+ * \brief Container of a single task defined by migfra itself instead of fast-lib.
+ *
+ * Messages with other task types are left to fast::msg::migfra::Task_container.
+ */
+struct Local_task_container
+{
+	/**
+	 * \brief Check if the message contains a task defined by migfra.
+	 */
+	static bool is_local_task(const YAML::Node &node);
+	/**
+	 * \brief Parse the message.
+	 *
+	 * Throws std::invalid_argument if the task type is unknown.
+	 */
+	void load(const YAML::Node &node);
+	/**
+	 * \brief Get the type of the result message, e.g., "hosts consolidated".
+	 */
+	std::string result_type() const;
+
+	std::shared_ptr<fast::msg::migfra::Task> task;
+	fast::Optional<bool> concurrent_execution;
+	fast::Optional<std::string> id;
+};
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "migration_monitor.hpp"
+
+#include <fast-lib/log.hpp>
+#include <libvirt/virterror.h>
+
+#include <stdexcept>
+#include <thread>
+
+FASTLIB_LOG_INIT(migration_monitor_log, "Migration_monitor")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(migration_monitor_log, trace);
+
+Job_progress::Job_progress(virDomainPtr domain, bool completed) :
+	domain(domain),
+	completed(completed)
+{
+}
+
+std::string Job_progress::str() const
+{
+	return "active: " + std::to_string(active) +
+		", time elapsed: " + std::to_string(time_elapsed) + " ms" +
+		", data processed: " + std::to_string(data_processed) + " bytes" +
+		", data remaining: " + std::to_string(data_remaining) + " bytes" +
+		", dirty rate: " + std::to_string(memory_dirty_rate) + " pages/s" +
+		", bandwidth: " + std::to_string(memory_bps) + " bytes/s" +
+		", iteration: " + std::to_string(memory_iteration) +
+		", downtime: " + std::to_string(downtime) + " ms";
+}
+
+void Job_progress::refresh()
+{
+	int type;
+	virTypedParameterPtr params = nullptr;
+	int nparams = 0;
+	if (virDomainGetJobStats(domain, &type, &params, &nparams, completed ? VIR_DOMAIN_JOB_STATS_COMPLETED : 0) == -1)
+		throw std::runtime_error(std::string("Error getting job stats: ") + virGetLastErrorMessage());
+	active = (type == VIR_DOMAIN_JOB_BOUNDED || type == VIR_DOMAIN_JOB_UNBOUNDED);
+	// Missing fields keep their previous value.
+	virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_TIME_ELAPSED, &time_elapsed);
+	virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_DATA_TOTAL, &data_total);
+	virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_DATA_PROCESSED, &data_processed);
+	virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_DATA_REMAINING, &data_remaining);
+	virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_MEMORY_DIRTY_RATE, &memory_dirty_rate);
+	virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_MEMORY_BPS, &memory_bps);
+	virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_MEMORY_ITERATION, &memory_iteration);
+	virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_DOWNTIME, &downtime);
+	virTypedParamsFree(params, nparams);
+}
+
+Migration_monitor::Migration_monitor(std::shared_ptr<virDomain> domain, std::chrono::milliseconds poll_interval) :
+	domain(domain),
+	poll_interval(poll_interval),
+	progress(domain.get())
+{
+}
+
+bool Migration_monitor::refresh(const std::atomic<bool> &migration_finished)
+{
+	try {
+		progress.refresh();
+		return true;
+	} catch (const std::exception &e) {
+		// Domain is gone or shut off on source, i.e., the migration job has ended.
+		if (migration_finished || virDomainIsActive(domain.get()) != 1) {
+			FASTLIB_LOG(migration_monitor_log, trace) << "Migration job ended: " << e.what();
+			return false;
+		}
+		// The migrating thread might not have returned yet.
+		std::this_thread::sleep_for(poll_interval);
+		if (migration_finished) {
+			FASTLIB_LOG(migration_monitor_log, trace) << "Migration job ended: " << e.what();
+			return false;
+		}
+		throw;
+	}
+}
+
+bool Migration_monitor::wait_for_remaining_data(unsigned long long threshold, const std::atomic<bool> &migration_finished)
+{
+	FASTLIB_LOG(migration_monitor_log, trace) << "Wait for remaining data to fall below " << threshold << " bytes.";
+	while (!migration_finished) {
+		if (!refresh(migration_finished))
+			break;
+		// Remaining data is only meaningful after the first iteration has determined the total.
+		if (progress.active && progress.data_total != 0 && progress.data_remaining <= threshold) {
+			FASTLIB_LOG(migration_monitor_log, trace) << "Threshold reached: " << progress.str();
+			return true;
+		}
+		std::this_thread::sleep_for(poll_interval);
+	}
+	FASTLIB_LOG(migration_monitor_log, trace) << "Migration finished before threshold was reached.";
+	return false;
+}
+
+bool Migration_monitor::wait_for_iteration(unsigned long long iteration, const std::atomic<bool> &migration_finished)
+{
+	FASTLIB_LOG(migration_monitor_log, trace) << "Wait for memory iteration " << iteration << ".";
+	while (!migration_finished) {
+		if (!refresh(migration_finished))
+			break;
+		if (progress.active && progress.memory_iteration >= iteration) {
+			FASTLIB_LOG(migration_monitor_log, trace) << "Iteration reached: " << progress.str();
+			return true;
+		}
+		std::this_thread::sleep_for(poll_interval);
+	}
+	FASTLIB_LOG(migration_monitor_log, trace) << "Migration finished before iteration was reached.";
+	return false;
+}
+
+const Job_progress & Migration_monitor::get_last_progress() const
+{
+	return progress;
+}
@@ -0,0 +1,86 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef MIGRATION_MONITOR_HPP
+#define MIGRATION_MONITOR_HPP
+
+#include <libvirt/libvirt.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+
+/**
+ * \brief Progress of the job currently running on a domain as reported by virDomainGetJobStats.
+ *
+ * If completed is set, the statistics of the last completed job are read instead,
+ * e.g., from the destination domain after migration.
+ */
+struct Job_progress
+{
+	Job_progress(virDomainPtr domain, bool completed = false);
+
+	std::string str() const;
+	void refresh();
+
+	bool active = false;
+	unsigned long long time_elapsed = 0;
+	unsigned long long data_total = 0;
+	unsigned long long data_processed = 0;
+	unsigned long long data_remaining = 0;
+	unsigned long long memory_dirty_rate = 0;
+	unsigned long long memory_bps = 0;
+	unsigned long long memory_iteration = 0;
+	unsigned long long downtime = 0;
+	virDomainPtr domain = nullptr;
+	bool completed = false;
+};
+
+/**
+ * \brief Observes the migration job of a domain while it is running in another thread.
+ */
+class Migration_monitor
+{
+public:
+	Migration_monitor(std::shared_ptr<virDomain> domain, std::chrono::milliseconds poll_interval = std::chrono::milliseconds(50));
+
+	/**
+	 * \brief Block until the remaining data of the migration job is at most threshold bytes.
+	 *
+	 * \param threshold Remaining bytes at which the pre-copy is considered converged.
+	 * \param migration_finished Set by the migrating thread when migration returned (successfully or not).
+	 * \returns True if the threshold was reached, false if the migration finished before.
+	 */
+	bool wait_for_remaining_data(unsigned long long threshold, const std::atomic<bool> &migration_finished);
+	/**
+	 * \brief Block until the migration job has finished the given number of memory iterations.
+	 *
+	 * \returns True if the iteration was reached, false if the migration finished before.
+	 */
+	bool wait_for_iteration(unsigned long long iteration, const std::atomic<bool> &migration_finished);
+	/**
+	 * \brief Get the progress observed last.
+	 */
+	const Job_progress & get_last_progress() const;
+private:
+	/**
+	 * \brief Refresh the progress or detect that the migration job has ended.
+	 *
+	 * Job stats are unavailable once the source domain is inactive or undefined,
+	 * which may happen before the migrating thread sets migration_finished.
+	 * \returns False if the job has ended, true if the progress was refreshed.
+	 */
+	bool refresh(const std::atomic<bool> &migration_finished);
+
+	std::shared_ptr<virDomain> domain;
+	std::chrono::milliseconds poll_interval;
+	Job_progress progress;
+};
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "migration_predictor.hpp"
+
+#include "utility.hpp"
+
+#include <fast-lib/log.hpp>
+#include <libvirt/virterror.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+FASTLIB_LOG_INIT(migration_predictor_log, "Migration_predictor")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(migration_predictor_log, trace);
+
+// Live migration is aborted by QEMU's defaults after this many iterations without convergence.
+static const unsigned int max_pre_copy_iterations = 30;
+// Estimated time to transfer cpu and device state when switching to the destination.
+static const double switchover_time = 0.02;
+// Weight of a new throughput sample in the moving average.
+static const double throughput_weight = 0.5;
+// Value of "dirtyrate.calc_status" when the measurement is done (VIR_DOMAIN_DIRTYRATE_MEASURED).
+static const int dirty_rate_measured = 2;
+
+std::string Migration_prediction::str() const
+{
+	return migration_type + ": " + (converges ? "" : "not converging, ") +
+		"total " + std::to_string(total_time) + " s, downtime " + std::to_string(downtime) + " s";
+}
+
+Migration_predictor::Migration_predictor(double default_throughput, std::chrono::seconds dirty_rate_sample_time) :
+	default_throughput(default_throughput),
+	dirty_rate_sample_time(dirty_rate_sample_time)
+{
+	if (default_throughput <= 0)
+		throw std::invalid_argument("Default throughput of migration predictor must be positive.");
+}
+
+std::vector<Migration_prediction> Migration_predictor::predict(virDomainPtr domain, const std::string &link, double max_downtime)
+{
+	Memory_stats mem_stats(domain);
+	// Unused guest pages are zero pages which are transferred cheaply.
+	auto memory_kib = mem_stats.actual_balloon - std::min(mem_stats.unused, mem_stats.actual_balloon);
+	double memory = memory_kib * 1024.0;
+	double dirty_rate = sample_dirty_rate(domain);
+	double throughput = get_throughput(link);
+	FASTLIB_LOG(migration_predictor_log, trace) << "Predict migration of " << memory << " bytes with dirty rate "
+		<< dirty_rate << " bytes/s over link " << link << " with " << throughput << " bytes/s.";
+	return predict(memory, dirty_rate, throughput, max_downtime);
+}
+
+std::vector<Migration_prediction> Migration_predictor::predict(double memory, double dirty_rate, double throughput, double max_downtime)
+{
+	std::vector<Migration_prediction> predictions;
+	// Warm: the domain is paused while all memory is transferred once.
+	Migration_prediction warm;
+	warm.migration_type = "warm";
+	warm.total_time = memory / throughput + switchover_time;
+	warm.downtime = warm.total_time;
+	predictions.push_back(warm);
+	// Live: pages dirtied during an iteration are resent in the next one
+	// until the rest can be sent within max_downtime.
+	Migration_prediction live;
+	live.migration_type = "live";
+	live.converges = false;
+	if (dirty_rate >= 0) {
+		double remaining = memory;
+		for (unsigned int i = 0; i != max_pre_copy_iterations; ++i) {
+			double iteration_time = remaining / throughput;
+			live.total_time += iteration_time;
+			if (iteration_time <= max_downtime) {
+				live.converges = true;
+				live.downtime = iteration_time + switchover_time;
+				break;
+			}
+			remaining = std::min(memory, dirty_rate * iteration_time);
+		}
+	}
+	if (!live.converges)
+		live.downtime = live.total_time;
+	live.total_time += switchover_time;
+	predictions.push_back(live);
+	// Post-copy: one pre-copy iteration, then the domain runs on the destination
+	// while pages dirtied in the meantime are fetched on demand.
+	Migration_prediction post_copy;
+	post_copy.migration_type = "post-copy";
+	double dirtied = dirty_rate >= 0 ? std::min(memory, dirty_rate * memory / throughput) : memory;
+	post_copy.total_time = (memory + dirtied) / throughput + switchover_time;
+	post_copy.downtime = switchover_time;
+	predictions.push_back(post_copy);
+	return predictions;
+}
+
+const Migration_prediction & Migration_predictor::choose(const std::vector<Migration_prediction> &predictions, double max_downtime)
+{
+	if (predictions.empty())
+		throw std::logic_error("No migration predictions to choose from.");
+	const Migration_prediction *best = nullptr;
+	// Predictions are ordered by preference, so ties keep the earlier one.
+	for (const auto &prediction : predictions) {
+		if (prediction.converges && prediction.downtime <= max_downtime &&
+				(!best || prediction.total_time < best->total_time))
+			best = &prediction;
+	}
+	if (best)
+		return *best;
+	FASTLIB_LOG(migration_predictor_log, trace) << "No migration type within downtime bound. Choose lowest downtime.";
+	for (const auto &prediction : predictions) {
+		if (prediction.converges && (!best || prediction.downtime < best->downtime))
+			best = &prediction;
+	}
+	return best ? *best : predictions.front();
+}
+
+void Migration_predictor::add_throughput_sample(const std::string &link, double throughput)
+{
+	if (throughput <= 0)
+		return;
+	std::lock_guard<std::mutex> lock(throughputs_mutex);
+	auto it = throughputs.find(link);
+	if (it == throughputs.end())
+		throughputs.emplace(link, throughput);
+	else
+		it->second = throughput_weight * throughput + (1 - throughput_weight) * it->second;
+	FASTLIB_LOG(migration_predictor_log, trace) << "Throughput of link " << link << " is " << throughputs[link] << " bytes/s.";
+}
+
+double Migration_predictor::get_throughput(const std::string &link) const
+{
+	std::lock_guard<std::mutex> lock(throughputs_mutex);
+	auto it = throughputs.find(link);
+	return it == throughputs.end() ? default_throughput : it->second;
+}
+
+double Migration_predictor::sample_dirty_rate(virDomainPtr domain) const
+{
+	if (virDomainStartDirtyRateCalc(domain, dirty_rate_sample_time.count(), 0) == -1) {
+		FASTLIB_LOG(migration_predictor_log, trace) << "Dirty rate calculation not available: " << virGetLastErrorMessage();
+		return -1;
+	}
+	std::this_thread::sleep_for(dirty_rate_sample_time);
+	// The calculation might take slightly longer than the sample time.
+	for (unsigned int retries = 0; retries != 10; ++retries) {
+		virDomainStatsRecordPtr *records = nullptr;
+		virDomainPtr domains[] = {domain, nullptr};
+		if (virDomainListGetStats(domains, VIR_DOMAIN_STATS_DIRTYRATE, &records, 0) == -1)
+			throw std::runtime_error(std::string("Error getting dirty rate: ") + virGetLastErrorMessage());
+		int status = -1;
+		long long megabytes_per_second = -1;
+		if (records[0]) {
+			virTypedParamsGetInt(records[0]->params, records[0]->nparams, "dirtyrate.calc_status", &status);
+			virTypedParamsGetLLong(records[0]->params, records[0]->nparams, "dirtyrate.megabytes_per_second", &megabytes_per_second);
+		}
+		virDomainStatsRecordListFree(records);
+		if (status == dirty_rate_measured && megabytes_per_second >= 0)
+			return megabytes_per_second * 1024.0 * 1024.0;
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	FASTLIB_LOG(migration_predictor_log, trace) << "Dirty rate calculation did not finish in time.";
+	return -1;
+}
@@ -0,0 +1,84 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef MIGRATION_PREDICTOR_HPP
+#define MIGRATION_PREDICTOR_HPP
+
+#include <libvirt/libvirt.h>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * \brief Predicted cost of migrating a domain with a certain migration type.
+ */
+struct Migration_prediction
+{
+	std::string migration_type;
+	bool converges = true;
+	// Time from start of migration until the domain runs on the destination in seconds.
+	double total_time = 0;
+	// Time the domain is paused in seconds.
+	double downtime = 0;
+
+	std::string str() const;
+};
+
+/**
+ * \brief Estimates total time and downtime of warm, live and post-copy migration.
+ *
+ * The model uses the memory in use (from Memory_stats), the dirty rate of the guest
+ * (sampled with virDomainStartDirtyRateCalc) and the throughput measured by previous migrations over the same link.
+ * Links without history use a configurable default throughput.
+ */
+class Migration_predictor
+{
+public:
+	Migration_predictor(double default_throughput, std::chrono::seconds dirty_rate_sample_time);
+
+	/**
+	 * \brief Predict all migration types for a domain.
+	 *
+	 * \param domain The domain to migrate.
+	 * \param link Identifies the path to the destination, e.g., its hostname.
+	 * \param max_downtime The downtime live migration aims for in seconds.
+	 */
+	std::vector<Migration_prediction> predict(virDomainPtr domain, const std::string &link, double max_downtime);
+	/**
+	 * \brief Predict all migration types from raw inputs (bytes, bytes/s, seconds).
+	 *
+	 * A dirty rate below 0 means unknown, so live migration is predicted not to converge.
+	 */
+	static std::vector<Migration_prediction> predict(double memory, double dirty_rate, double throughput, double max_downtime);
+	/**
+	 * \brief Choose the prediction with the lowest total time among those within max_downtime.
+	 *
+	 * If none is within bounds, the one with the lowest downtime is chosen.
+	 */
+	static const Migration_prediction & choose(const std::vector<Migration_prediction> &predictions, double max_downtime);
+	/**
+	 * \brief Add a throughput in bytes/s measured by a completed migration over link.
+	 */
+	void add_throughput_sample(const std::string &link, double throughput);
+	/**
+	 * \brief Get the expected throughput of link in bytes/s.
+	 */
+	double get_throughput(const std::string &link) const;
+private:
+	double sample_dirty_rate(virDomainPtr domain) const;
+
+	double default_throughput;
+	std::chrono::seconds dirty_rate_sample_time;
+	std::unordered_map<std::string, double> throughputs;
+	mutable std::mutex throughputs_mutex;
+};
+
+#endif
@@ -10,15 +10,21 @@
 
 #include "utility.hpp"
 #include "device_utility.hpp"
+#include "device_ledger.hpp"
+#include "vf_pool.hpp"
+#include "domain_inventory.hpp"
+#include "xml_scanner.hpp"
 
 #include <fast-lib/log.hpp>
-#include <boost/property_tree/xml_parser.hpp>
+#include <libvirt/virterror.h>
 
 #include <iostream>
 #include <stdexcept>
 #include <sstream>
 #include <algorithm>
-#include <random>
+#include <cstdlib>
+#include <exception>
+#include <functional>
 
 FASTLIB_LOG_INIT(pcidev_handler_log, "PCI_device_handler")
 FASTLIB_LOG_SET_LEVEL_GLOBAL(pcidev_handler_log, trace);
@@ -27,14 +33,6 @@ FASTLIB_LOG_SET_LEVEL_GLOBAL(pcidev_handler_log, trace);
 // PCI_id implementation
 //
 
-PCI_id make_pci_id_from_nodedev_xml(const std::string &nodedev_xml)
-{
-	auto nodedev_ptree = read_xml_from_string(nodedev_xml);
-	auto vendor = std::stoul(nodedev_ptree.get<std::string>("device.capability.vendor.<xmlattr>.id"), nullptr, 0);
-	auto device = std::stoul(nodedev_ptree.get<std::string>("device.capability.product.<xmlattr>.id"), nullptr, 0);
-	return PCI_id(vendor, device);
-}
-
 PCI_id::PCI_id(vendor_t vendor, device_t device) :
 	vendor(vendor), device(device)
 {
@@ -78,24 +76,53 @@ void PCI_id::load(const YAML::Node &node)
 // PCI_address implementation
 //
 
-PCI_address make_pci_address_from_device_ptree(const boost::property_tree::ptree &device_ptree)
+PCI_address make_pci_address_from_xml(const Xml_scanner &scanner)
 {
-	auto domain = device_ptree.get<PCI_address::domain_t>("device.capability.domain");
-	auto bus = device_ptree.get<PCI_address::bus_t>("device.capability.bus");
-	auto slot = device_ptree.get<PCI_address::slot_t>("device.capability.slot");
-	auto function = device_ptree.get<PCI_address::function_t>("device.capability.function");
+	auto domain = scanner.attribute("domain").to_ulong();
+	auto bus = scanner.attribute("bus").to_ulong();
+	auto slot = scanner.attribute("slot").to_ulong();
+	auto function = scanner.attribute("function").to_ulong();
 	return PCI_address(domain, bus, slot, function);
 }
 
-PCI_address make_pci_address_from_address_ptree(const boost::property_tree::ptree &address_ptree)
+bool is_pci_hostdev(const Xml_scanner &scanner)
 {
-	auto xmlattr = address_ptree.get_child("address.<xmlattr>"); 
-	// std::stoul has to be used since boost.property_tree cannot convert hex strings to integer types.
-	auto domain = std::stoul(xmlattr.get<std::string>("domain"), nullptr, 0);
-	auto bus = std::stoul(xmlattr.get<std::string>("bus"), nullptr, 0);
-	auto slot = std::stoul(xmlattr.get<std::string>("slot"), nullptr, 0);
-	auto function = std::stoul(xmlattr.get<std::string>("function"), nullptr, 0);
-	return PCI_address(domain, bus, slot, function);
+	return scanner.attribute("mode").str() == "subsystem" && scanner.attribute("type").str() == "pci";
+}
+
+// Get the PCI addresses of the hostdevs in a domain xml.
+// Other hostdevs (e.g., USB, SCSI or mdev) are skipped.
+std::vector<PCI_address> get_hostdev_addresses(const std::string &domain_xml)
+{
+	std::vector<PCI_address> addresses;
+	Xml_scanner scanner(domain_xml);
+	bool pci_hostdev = false;
+	for (auto token = scanner.next(); token != Xml_scanner::Token::end_of_document; token = scanner.next()) {
+		if (token != Xml_scanner::Token::start_element)
+			continue;
+		if (scanner.path_is("domain/devices/hostdev"))
+			pci_hostdev = is_pci_hostdev(scanner);
+		else if (pci_hostdev && scanner.path_is("domain/devices/hostdev/source/address"))
+			addresses.push_back(make_pci_address_from_xml(scanner));
+	}
+	return addresses;
+}
+
+std::unordered_map<PCI_address, std::string> get_attached_devices(virConnectPtr host_connection)
+{
+	virDomainPtr *domains_carray = nullptr;
+	auto num = virConnectListAllDomains(host_connection, &domains_carray, VIR_CONNECT_LIST_DOMAINS_ACTIVE);
+	if (num < 0)
+		throw std::runtime_error(std::string("Error getting list of active domains.") + virGetLastErrorMessage());
+	std::vector<std::unique_ptr<virDomain, Deleter_virDomain>> domains(domains_carray, domains_carray + num);
+	free(domains_carray);
+	std::unordered_map<PCI_address, std::string> attached;
+	for (const auto &domain : domains) {
+		const std::string domain_name = virDomainGetName(domain.get());
+		for (const auto &address : get_hostdev_addresses(get_domain_xml(domain.get())))
+			attached.emplace(address, domain_name);
+	}
+	return attached;
 }
 
 PCI_address::PCI_address(domain_t domain, bus_t bus, slot_t slot, function_t function) :
@@ -103,14 +130,10 @@ PCI_address::PCI_address(domain_t domain, bus_t bus, slot_t slot, function_t fun
 {
 }
 
-boost::property_tree::ptree PCI_address::to_address_ptree() const
+std::string PCI_address::to_address_xml() const
 {
-	boost::property_tree::ptree pt;
-	pt.put("address.<xmlattr>.domain", to_hex_string(domain, 4));
-	pt.put("address.<xmlattr>.bus", to_hex_string(bus, 2));
-	pt.put("address.<xmlattr>.slot", to_hex_string(slot, 2));
-	pt.put("address.<xmlattr>.function", to_hex_string(function, 1));
-	return pt;
+	return "<address domain='" + to_hex_string(domain, 4) + "' bus='" + to_hex_string(bus, 2)
+		+ "' slot='" + to_hex_string(slot, 2) + "' function='" + to_hex_string(function, 1) + "'/>";
 }
 
 std::string PCI_address::str() const
@@ -138,230 +161,641 @@ bool PCI_address::operator==(const PCI_address &rhs) const
 // Device implementation
 //
 
-Device::Device(const std::string &xml_desc) :
-	xml_desc(xml_desc),
-	address(make_pci_address_from_device_ptree(read_xml_from_string(xml_desc))),
-	attached_hint(false)
+struct Device::Description
+{
+	unsigned long domain = 0;
+	unsigned long bus = 0;
+	unsigned long slot = 0;
+	unsigned long function = 0;
+	unsigned long vendor = 0;
+	unsigned long product = 0;
+	// Counts the address and id fields found.
+	unsigned int fields = 0;
+	int iommu_group = -1;
+	int numa_node = -1;
+	std::shared_ptr<const PCI_address> physical_function;
+	unsigned int max_virtual_functions = 0;
+	std::vector<PCI_address> virtual_functions;
+};
+
+// Parse the fields of a PCI node device in a single pass.
+Device::Description Device::parse_xml(const std::string &xml_desc)
+{
+	Device::Description description;
+	// Type of the nested capability, e.g., virt_functions.
+	Xml_ref capability_type;
+	Xml_scanner scanner(xml_desc);
+	for (auto token = scanner.next(); token != Xml_scanner::Token::end_of_document; token = scanner.next()) {
+		if (token != Xml_scanner::Token::start_element)
+			continue;
+		if (scanner.path_is("device/capability/domain")) {
+			description.domain = scanner.read_text().to_ulong();
+			++description.fields;
+		} else if (scanner.path_is("device/capability/bus")) {
+			description.bus = scanner.read_text().to_ulong();
+			++description.fields;
+		} else if (scanner.path_is("device/capability/slot")) {
+			description.slot = scanner.read_text().to_ulong();
+			++description.fields;
+		} else if (scanner.path_is("device/capability/function")) {
+			description.function = scanner.read_text().to_ulong();
+			++description.fields;
+		} else if (scanner.path_is("device/capability/vendor")) {
+			description.vendor = scanner.attribute("id").to_ulong();
+			++description.fields;
+		} else if (scanner.path_is("device/capability/product")) {
+			description.product = scanner.attribute("id").to_ulong();
+			++description.fields;
+		} else if (scanner.path_is("device/capability/iommuGroup")) {
+			description.iommu_group = scanner.attribute("number").to_long();
+		} else if (scanner.path_is("device/capability/numa")) {
+			description.numa_node = scanner.attribute("node").to_long();
+		} else if (scanner.path_is("device/capability/capability")) {
+			capability_type = scanner.attribute("type");
+			if (capability_type == "virt_functions" && scanner.attribute("maxCount").data)
+				description.max_virtual_functions = scanner.attribute("maxCount").to_ulong();
+		} else if (scanner.path_is("device/capability/capability/address")) {
+			if (capability_type == "phys_function")
+				description.physical_function = std::make_shared<const PCI_address>(make_pci_address_from_xml(scanner));
+			else if (capability_type == "virt_functions")
+				description.virtual_functions.push_back(make_pci_address_from_xml(scanner));
+		}
+	}
+	if (description.fields != 6)
+		throw std::runtime_error("Node device xml is missing PCI address or id.");
+	return description;
+}
+
+Device::Device(std::string xml_desc) :
+	Device(parse_xml(xml_desc), std::move(xml_desc))
 {
 }
 
-Device::Device(std::string &&xml_desc) :
+Device::Device(Description description, std::string &&xml_desc) :
 	xml_desc(std::move(xml_desc)),
-	address(make_pci_address_from_device_ptree(read_xml_from_string(this->xml_desc))),
-	attached_hint(false)
+	address(description.domain, description.bus, description.slot, description.function),
+	id(description.vendor, description.product),
+	iommu_group(description.iommu_group),
+	numa_node(description.numa_node),
+	physical_function(std::move(description.physical_function)),
+	max_virtual_functions(description.max_virtual_functions),
+	virtual_functions(std::move(description.virtual_functions))
 {
 }
 
 Device::Device(PCI_address &pci_addr) :
 	xml_desc(to_hostdev_xml(pci_addr)),
 	address(pci_addr),
-	attached_hint(false)
+	id(0, 0),
+	iommu_group(-1),
+	numa_node(-1),
+	max_virtual_functions(0)
 {
 }
 
+// Format hostdev xml directly instead of building a ptree.
+std::string make_hostdev_xml(const PCI_address &address, bool managed)
+{
+	return std::string("<hostdev mode='subsystem' type='pci' managed='") + (managed ? "yes" : "no") + "'>\n"
+		"\t<source>\n"
+		"\t\t" + address.to_address_xml() + "\n"
+		"\t</source>\n"
+		"</hostdev>\n";
+}
 
 std::string Device::to_hostdev_xml(PCI_address &pci_addr) const
 {
-	boost::property_tree::ptree hostdev_ptree;
-	hostdev_ptree.put("hostdev.<xmlattr>.mode", "subsystem");
-	hostdev_ptree.put("hostdev.<xmlattr>.type", "pci");
-	hostdev_ptree.put("hostdev.<xmlattr>.managed", "yes");
+	return make_hostdev_xml(pci_addr, true);
+}
 
-	boost::property_tree::ptree sub_pt;
-	sub_pt.put("address.<xmlattr>.domain", to_hex_string(pci_addr.domain, 4));
-	sub_pt.put("address.<xmlattr>.bus", to_hex_string(pci_addr.bus, 2));
-	sub_pt.put("address.<xmlattr>.slot", to_hex_string(pci_addr.slot, 2));
-	sub_pt.put("address.<xmlattr>.function", to_hex_string(pci_addr.function, 1));
+std::string Device::to_hostdev_xml(bool managed) const
+{
+	return make_hostdev_xml(address, managed);
+}
 
-	hostdev_ptree.put_child("hostdev.source", sub_pt);
+//
+// Device_inventory implementation
+//
 
-	return write_xml_to_string(hostdev_ptree);
+void Device_inventory::add(std::shared_ptr<Device> device)
+{
+	by_id[device->id].push_back(device);
+	if (device->iommu_group != -1)
+		by_iommu_group[device->iommu_group].push_back(device);
+	by_address.emplace(device->address, std::move(device));
 }
 
-std::string Device::to_hostdev_xml() const
+void Device_inventory::remove(const PCI_address &address)
 {
-	using namespace boost::property_tree;
-	// Write hostdev xml
-	ptree hostdev_ptree;
-	hostdev_ptree.put("hostdev.<xmlattr>.mode", "subsystem");
-	hostdev_ptree.put("hostdev.<xmlattr>.type", "pci");
-	hostdev_ptree.put("hostdev.<xmlattr>.managed", "yes");
-	hostdev_ptree.put_child("hostdev.source", address.to_address_ptree());
-	return write_xml_to_string(hostdev_ptree);
+	auto it = by_address.find(address);
+	if (it == by_address.end())
+		return;
+	auto device = it->second;
+	by_address.erase(it);
+	auto erase_from = [&device](std::vector<std::shared_ptr<Device>> &devices)
+	{
+		devices.erase(std::remove(devices.begin(), devices.end(), device), devices.end());
+		return devices.empty();
+	};
+	if (erase_from(by_id[device->id]))
+		by_id.erase(device->id);
+	if (device->iommu_group != -1 && erase_from(by_iommu_group[device->iommu_group]))
+		by_iommu_group.erase(device->iommu_group);
 }
 
 //
 // Device_cache implementation
 //
 
-std::vector<std::shared_ptr<Device>> Device_cache::get_devices(virConnectPtr host_connection, PCI_id pci_id, bool sort_and_shuffle) const
+Device_cache::Device_cache() :
+	event_target(std::make_shared<Event_target>())
+{
+	event_target->cache = this;
+}
+
+Device_cache::~Device_cache()
+{
+	{
+		// Wait for a callback in progress and ignore later ones.
+		std::lock_guard<std::mutex> lock(event_target->mutex);
+		event_target->cache = nullptr;
+	}
+	std::lock_guard<std::mutex> lock(devices_mutex);
+	for (const auto &uri_subscription : subscriptions) {
+		const auto &subscription = *uri_subscription.second;
+		if (subscription.lifecycle_callback_id != -1)
+			virConnectNodeDeviceEventDeregisterAny(subscription.connection.get(), subscription.lifecycle_callback_id);
+		if (subscription.update_callback_id != -1)
+			virConnectNodeDeviceEventDeregisterAny(subscription.connection.get(), subscription.update_callback_id);
+	}
+}
+
+bool Device_cache::Subscription::is_registered() const
+{
+	return lifecycle_callback_id != -1 && update_callback_id != -1;
+}
+
+bool Device_cache::Subscription::is_active() const
+{
+	return is_registered() && virConnectIsAlive(connection.get()) == 1;
+}
+
+void Device_cache::lifecycle_callback(virConnectPtr connection, virNodeDevicePtr device, int event, int detail, void *opaque)
+{
+	(void) connection;
+	(void) detail;
+	auto data = static_cast<const Callback_data *>(opaque);
+	std::lock_guard<std::mutex> lock(data->target->mutex);
+	if (!data->target->cache)
+		return;
+	if (event == VIR_NODE_DEVICE_EVENT_CREATED)
+		data->target->cache->update_device(data->host_uri, device);
+	else if (event == VIR_NODE_DEVICE_EVENT_DELETED)
+		data->target->cache->remove_device(data->host_uri, device);
+}
+
+void Device_cache::update_callback(virConnectPtr connection, virNodeDevicePtr device, void *opaque)
+{
+	(void) connection;
+	auto data = static_cast<const Callback_data *>(opaque);
+	std::lock_guard<std::mutex> lock(data->target->mutex);
+	if (data->target->cache)
+		data->target->cache->update_device(data->host_uri, device);
+}
+
+void Device_cache::free_callback_data(void *opaque)
+{
+	delete static_cast<Callback_data *>(opaque);
+}
+
+std::unique_ptr<Device_cache::Subscription> Device_cache::subscribe(virConnectPtr host_connection, const std::string &host_uri) const
+{
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Subscribe to node device events of host " << host_uri << ".";
+	std::unique_ptr<Subscription> subscription(new Subscription);
+	// Keep connection open to receive events.
+	virConnectRef(host_connection);
+	subscription->connection.reset(host_connection, Deleter_virConnect());
+	// The callback data is freed by libvirt when the callback is deregistered or the connection is closed.
+	auto register_callback = [&](int event_id, virConnectNodeDeviceEventGenericCallback callback)
+	{
+		auto data = new Callback_data{event_target, host_uri};
+		auto callback_id = virConnectNodeDeviceEventRegisterAny(host_connection, nullptr, event_id, callback, data, free_callback_data);
+		if (callback_id == -1)
+			delete data;
+		return callback_id;
+	};
+	subscription->lifecycle_callback_id = register_callback(VIR_NODE_DEVICE_EVENT_ID_LIFECYCLE, VIR_NODE_DEVICE_EVENT_CALLBACK(lifecycle_callback));
+	subscription->update_callback_id = register_callback(VIR_NODE_DEVICE_EVENT_ID_UPDATE, VIR_NODE_DEVICE_EVENT_CALLBACK(update_callback));
+	if (!subscription->is_registered())
+		FASTLIB_LOG(pcidev_handler_log, warn) << "Node device events of host " << host_uri << " are not available. "
+			<< "Device cache is only rebuilt on unknown devices.";
+	return subscription;
+}
+
+void Device_cache::update_device(const std::string &host_uri, virNodeDevicePtr device) const
+{
+	const std::string name = virNodeDeviceGetName(device);
+	if (name.compare(0, 4, "pci_") != 0)
+		return;
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Update device " << name << " on host " << host_uri << ".";
+	std::shared_ptr<Device> dev;
+	try {
+		dev = std::make_shared<Device>(convert_and_free_cstr(virNodeDeviceGetXMLDesc(device, 0)));
+	} catch (const std::exception &e) {
+		FASTLIB_LOG(pcidev_handler_log, warn) << "Failed to update device " << name << ": " << e.what();
+		return;
+	}
+	std::lock_guard<std::mutex> lock(devices_mutex);
+	auto it = inventories.find(host_uri);
+	// Inventory is built with all devices on first access.
+	if (it == inventories.end() || !it->second)
+		return;
+	auto old_it = it->second->by_address.find(dev->address);
+	if (old_it != it->second->by_address.end()) {
+		const auto &old_dev = old_it->second;
+		// Keep device if only the driver changed, e.g., on bind to vfio.
+		if (old_dev->id == dev->id && old_dev->iommu_group == dev->iommu_group &&
+				old_dev->virtual_functions == dev->virtual_functions)
+			return;
+	}
+	auto inventory = std::make_shared<Device_inventory>(*it->second);
+	inventory->remove(dev->address);
+	inventory->add(std::move(dev));
+	it->second = std::move(inventory);
+}
+
+void Device_cache::remove_device(const std::string &host_uri, virNodeDevicePtr device) const
+{
+	const std::string name = virNodeDeviceGetName(device);
+	if (name.compare(0, 4, "pci_") != 0)
+		return;
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Remove device " << name << " on host " << host_uri << ".";
+	std::lock_guard<std::mutex> lock(devices_mutex);
+	auto it = inventories.find(host_uri);
+	if (it == inventories.end() || !it->second)
+		return;
+	for (const auto &address_device : it->second->by_address) {
+		if (address_device.first.to_name_fmt() == name) {
+			auto inventory = std::make_shared<Device_inventory>(*it->second);
+			inventory->remove(address_device.first);
+			it->second = std::move(inventory);
+			return;
+		}
+	}
+}
+
+std::shared_ptr<const Device_inventory> Device_cache::get_inventory(virConnectPtr host_connection, bool rebuild) const
 {
 	auto host_uri = convert_and_free_cstr(virConnectGetURI(host_connection));
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Get devices on host " << host_uri << " with pci_id " << pci_id.str();
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Lock while accessing device cache.";
 	std::unique_lock<std::mutex> lock(devices_mutex);
-	// If no entry found try to find and cache devices.
-	if (devices[host_uri][pci_id].empty()) {
-		FASTLIB_LOG(pcidev_handler_log, trace) << "No entry found.";
-		// Find devices
-		FASTLIB_LOG(pcidev_handler_log, trace) << "Search for devices.";
-		auto found_devices = list_all_node_devices_wrapper(host_connection, VIR_CONNECT_LIST_NODE_DEVICES_CAP_PCI_DEV);
-		// Fill cache with found devices
-		FASTLIB_LOG(pcidev_handler_log, trace) << "Filtering " << found_devices.size() << " found PCI devices.";
-		for (const auto &device : found_devices) {
-			auto xml_desc = convert_and_free_cstr(virNodeDeviceGetXMLDesc(device.get(), 0));
-			auto found_device_id = xml_desc.find("<product id='" + pci_id.device_hex() + "'>");
-			auto found_vendor_id = xml_desc.find("<vendor id='" + pci_id.vendor_hex() + "'>");
-			if (found_device_id != std::string::npos && found_vendor_id != std::string::npos) {
-				auto dev = std::make_shared<Device>(std::move(xml_desc));
-				FASTLIB_LOG(pcidev_handler_log, trace) << "Adding device: " << dev->address.str();
-				devices[host_uri][pci_id].push_back(dev);
-			}
-		}
+	auto &subscription = subscriptions[host_uri];
+	if (subscription && subscription->is_registered() && !subscription->is_active()) {
+		// Events might have been missed, so inventory has to be rebuilt.
+		FASTLIB_LOG(pcidev_handler_log, trace) << "Connection for node device events of host " << host_uri << " died.";
+		subscription.reset();
+		inventories.erase(host_uri);
 	}
-	// Copy devices from cache.
-	auto vec = devices[host_uri][pci_id];
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Found " << vec.size() << " devices on cache.";
-	// Unlock since no access to devices cache is needed anymore.
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Unlock since no access to device cache is needed anymore.";
+	// Subscribe before scanning, so that no change is missed.
+	if (!subscription)
+		subscription = subscribe(host_connection, host_uri);
+	auto old_inventory = inventories[host_uri];
+	// An inventory kept up to date by events is never rebuilt.
+	if (old_inventory && (!rebuild || subscription->is_active()))
+		return old_inventory;
+	// Build inventory without holding the lock, so that other hosts are not blocked.
 	lock.unlock();
-	if (sort_and_shuffle) {
-		// Sort potentially attached devices to end of vector.
-		FASTLIB_LOG(pcidev_handler_log, trace) << "Sort potentially attached devices to end of vector.";
-		std::sort(vec.begin(), vec.end(), 
-				[](const std::shared_ptr<Device> &lhs, const std::shared_ptr<Device> &rhs)
-				{
-					return lhs->attached_hint < rhs->attached_hint;
-				});
-		// Shuffle not attached devices to prevent parallel attachment when starting multiple VMs.
-		auto sorted_part_end = std::find_if(vec.begin(), vec.end(),
-				[](const std::shared_ptr<Device> &rhs)
-				{
-					return rhs->attached_hint == true;
-				});
-		FASTLIB_LOG(pcidev_handler_log, trace) << std::count_if(vec.begin(), sorted_part_end, 
-						[](const std::shared_ptr<Device>&){return true;})
-					 << " devices are marked as being not attached.";
-		FASTLIB_LOG(pcidev_handler_log, trace) << "Shuffle not attached devices.";
-		std::random_device random_seed;
-		std::minstd_rand random_generator(random_seed());
-		std::shuffle(vec.begin(), sorted_part_end, random_generator);
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Build device inventory of host " << host_uri << ".";
+	auto inventory = std::make_shared<Device_inventory>();
+	auto found_devices = list_all_node_devices_wrapper(host_connection, VIR_CONNECT_LIST_NODE_DEVICES_CAP_PCI_DEV);
+	for (const auto &device : found_devices) {
+		inventory->add(std::make_shared<Device>(convert_and_free_cstr(virNodeDeviceGetXMLDesc(device.get(), 0))));
+	}
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Found " << inventory->by_address.size() << " PCI devices in "
+		<< inventory->by_iommu_group.size() << " IOMMU groups on host " << host_uri << ".";
+	lock.lock();
+	auto &current_inventory = inventories[host_uri];
+	// Another thread built the inventory in the meantime.
+	if (current_inventory != old_inventory)
+		return current_inventory;
+	current_inventory = inventory;
+	return current_inventory;
+}
+
+std::vector<std::shared_ptr<Device>> Device_cache::get_devices(virConnectPtr host_connection, PCI_id pci_id) const
+{
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Get devices with pci_id " << pci_id.str();
+	auto inventory = get_inventory(host_connection);
+	auto it = inventory->by_id.find(pci_id);
+	if (it == inventory->by_id.end()) {
+		FASTLIB_LOG(pcidev_handler_log, trace) << "No entry found.";
+		inventory = get_inventory(host_connection, true);
+		it = inventory->by_id.find(pci_id);
 	}
+	// Copy devices from inventory.
+	std::vector<std::shared_ptr<Device>> vec;
+	if (it != inventory->by_id.end())
+		vec = it->second;
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Found " << vec.size() << " devices on cache.";
 	return vec;
 }
 
+std::shared_ptr<Device> Device_cache::get_device(virConnectPtr host_connection, const PCI_address &address) const
+{
+	auto inventory = get_inventory(host_connection);
+	auto it = inventory->by_address.find(address);
+	if (it == inventory->by_address.end()) {
+		inventory = get_inventory(host_connection, true);
+		it = inventory->by_address.find(address);
+		if (it == inventory->by_address.end())
+			return nullptr;
+	}
+	return it->second;
+}
+
+void Device_cache::rescan(virConnectPtr host_connection) const
+{
+	auto host_uri = convert_and_free_cstr(virConnectGetURI(host_connection));
+	{
+		std::lock_guard<std::mutex> lock(devices_mutex);
+		inventories.erase(host_uri);
+	}
+	get_inventory(host_connection);
+}
+
+std::vector<std::shared_ptr<Device>> Device_cache::get_iommu_group(virConnectPtr host_connection, int iommu_group) const
+{
+	auto inventory = get_inventory(host_connection);
+	auto it = inventory->by_iommu_group.find(iommu_group);
+	if (it == inventory->by_iommu_group.end())
+		return std::vector<std::shared_ptr<Device>>();
+	return it->second;
+}
+
 //
 // PCI_device_handler implementation
 //
 
-PCI_device_handler::PCI_device_handler() :
-	device_cache(new Device_cache)
+PCI_device_handler::PCI_device_handler(unsigned int max_parallel_operations) :
+	PCI_device_handler(max_parallel_operations, {})
 {
 }
 
-void PCI_device_handler::attach_by_id(virDomainPtr domain, PCI_id pci_id)
+PCI_device_handler::PCI_device_handler(unsigned int max_parallel_operations, const std::vector<VF_pool_config> &vf_pools) :
+	device_cache(new Device_cache),
+	device_ledger(new Device_ledger),
+	vf_pool(vf_pools.empty() ? nullptr : new VF_pool(vf_pools, *device_cache, *device_ledger)),
+	max_parallel_operations(max_parallel_operations)
+{
+}
+
+PCI_device_handler::~PCI_device_handler() = default;
+
+void PCI_device_handler::load_ledger(virConnectPtr connection, const std::string &host_uri)
+{
+	if (device_ledger->is_loaded(host_uri))
+		return;
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Load device reservations of host " << host_uri << " from its domains.";
+	device_ledger->load(host_uri, get_attached_devices(connection));
+}
+
+// Run an operation and measure its duration if a time measurement is given.
+void run_timed(Time_measurement *time_measurement, const std::string &tag, const std::function<void()> &operation)
+{
+	if (time_measurement)
+		tick_synchronized(*time_measurement, tag);
+	operation();
+	if (time_measurement)
+		tock_synchronized(*time_measurement, tag);
+}
+
+void PCI_device_handler::run_operations(const std::vector<std::function<void()>> &operations) const
+{
+	run_all_bounded(operations, max_parallel_operations);
+}
+
+std::shared_ptr<Device> PCI_device_handler::reserve_by_id(virDomainPtr domain, const std::string &host_uri, PCI_id pci_id)
 {
-	// Get connection the domain belongs to.
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Get connection the domain belongs to.";
 	auto connection = virDomainGetConnect(domain);
+	const std::string domain_name = virDomainGetName(domain);
+	bool pooled = vf_pool && vf_pool->manages(pci_id);
 	// Get vector of devices.
 	FASTLIB_LOG(pcidev_handler_log, trace) << "Get vector of devices.";
 	auto devices = device_cache->get_devices(connection, pci_id);
-	if (devices.empty()) {
-		throw std::runtime_error("No devices of type \"" + pci_id.str() 
-			+ "\" found on \"" + convert_and_free_cstr(virConnectGetURI(connection)) + "\".");
+	if (pooled)
+		devices = vf_pool->order_candidates(domain, std::move(devices));
+	else if (devices.empty())
+		throw std::runtime_error("No devices of type \"" + pci_id.str() + "\" found on \"" + host_uri + "\".");
+	// Reserve a free device before attaching.
+	load_ledger(connection, host_uri);
+	auto device = device_ledger->reserve_any(host_uri, devices, domain_name);
+	if (!device) {
+		// Domains destroyed without detaching their devices leave stale reservations.
+		auto released = device_ledger->release_stale(host_uri, [connection](const std::string &name)
+		{
+			std::unique_ptr<virDomain, Deleter_virDomain> owner(virDomainLookupByName(connection, name.c_str()));
+			return owner && virDomainIsActive(owner.get()) == 1;
+		});
+		if (released != 0)
+			device = device_ledger->reserve_any(host_uri, devices, domain_name);
 	}
-	// Try to attach a device until success or none is left.
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Try to attach a device until success or none is left.";
-	int ret = -1;
-	for (const auto &device : devices) {
-		if (attach_device(domain, device)) {
-			ret = 1;
-			// should we break here? only attach one device?
-			// Probably yes. Because we only have one device id but the cache might output more than one
-			// I mean. By ID is not a great idea anyway
-			break;
-		}
+	if (!device && pooled && vf_pool->grow(domain, pci_id)) {
+		devices = vf_pool->order_candidates(domain, device_cache->get_devices(connection, pci_id));
+		device = device_ledger->reserve_any(host_uri, devices, domain_name);
 	}
-	if (ret != 0)
-		throw std::runtime_error("No pci device could be attached");
+	if (!device)
+		throw std::runtime_error("No free device of type \"" + pci_id.str() + "\" found on \"" + host_uri + "\".");
+	return device;
 }
 
-bool PCI_device_handler::attach_device(virDomainPtr domain, std::shared_ptr<Device> device)
+void PCI_device_handler::attach_by_id(virDomainPtr domain, PCI_id pci_id)
 {
-		FASTLIB_LOG(pcidev_handler_log, trace) << "Trying to attach device " << device->address.str();
-		auto hostdev_xml = device->to_hostdev_xml();
-		FASTLIB_LOG(pcidev_handler_log, trace) << "Hostdev xml:";
-		FASTLIB_LOG(pcidev_handler_log, trace) << hostdev_xml;
-		if (virDomainAttachDevice(domain, hostdev_xml.c_str())) {
-			device->attached_hint = true;
-			FASTLIB_LOG(pcidev_handler_log, trace) << "Success attaching device.";
-			return true;
-		}
-		FASTLIB_LOG(pcidev_handler_log, trace) << "No success attaching device.";
-		return false;
+	attach(domain, {}, {{pci_id, 1}});
 }
 
-std::unordered_map<PCI_id, size_t> PCI_device_handler::detach(virDomainPtr domain)
+void PCI_device_handler::attach_by_address(virDomainPtr domain, const PCI_address &address)
 {
-	// Parse domain xml to get all attached hostdevs.
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Parse domain xml to get all attached hostdevs.";
-	// TODO: Consider reusing hostdev xml descriptions instead of generating later from cached devices.
-	auto domain_ptree = read_xml_from_string(get_domain_xml(domain));
-	auto attached_devices = domain_ptree.get_child("domain.devices");
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Find attached devices.";
-	std::vector<PCI_address> addresses;
-	for (const auto &device : attached_devices) {
-		if (device.first == "hostdev") {
-			addresses.push_back(make_pci_address_from_address_ptree(device.second.get_child("source")));
+	auto connection = virDomainGetConnect(domain);
+	auto host_uri = convert_and_free_cstr(virConnectGetURI(connection));
+	auto device = device_cache->get_device(connection, address);
+	if (!device)
+		throw std::runtime_error("No device at \"" + address.str() + "\" found on \"" + host_uri + "\".");
+	load_ledger(connection, host_uri);
+	if (!device_ledger->reserve(host_uri, address, virDomainGetName(domain)))
+		throw std::runtime_error("Device at \"" + address.str() + "\" on \"" + host_uri + "\" is already in use.");
+	attach_device(domain, host_uri, device);
+}
+
+void PCI_device_handler::attach(virDomainPtr domain, const std::vector<std::shared_ptr<Device>> &prepared, const std::unordered_map<PCI_id, size_t> &types_counts,
+		Time_measurement *time_measurement, const std::string &tag_postfix)
+{
+	auto connection = virDomainGetConnect(domain);
+	auto host_uri = convert_and_free_cstr(virConnectGetURI(connection));
+	const std::string domain_name = virDomainGetName(domain);
+	// Reserve all devices before attaching any of them.
+	// Devices which could be reserved are attached even if reserving others failed.
+	auto devices = prepared;
+	std::exception_ptr reserve_error;
+	for (const auto &type_count : types_counts) {
+		for (size_t i = 0; i != type_count.second && !reserve_error; ++i) {
+			try {
+				devices.push_back(reserve_by_id(domain, host_uri, type_count.first));
+			} catch (...) {
+				reserve_error = std::current_exception();
+			}
 		}
 	}
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Found " << addresses.size() << " attached devices.";
-	// Get PCI-id of devices.
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Get PCI-id of devices.";
-	// TODO: Add method to device cache to find devices 
-	auto connection = virDomainGetConnect(domain);	
-	std::unordered_map<PCI_id, std::vector<PCI_address>> id_addresses_map;
-	for (auto &address : addresses) {
-		std::unique_ptr<virNodeDevice, Deleter_virNodeDevice> nodedev;
-		nodedev.reset(virNodeDeviceLookupByName(connection, address.to_name_fmt().c_str()));
-		auto device_xml = convert_and_free_cstr(virNodeDeviceGetXMLDesc(nodedev.get(), 0));
-		auto pci_id = make_pci_id_from_nodedev_xml(device_xml);
-		id_addresses_map[pci_id].push_back(std::move(address));
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Attach " << devices.size() << " devices to " << domain_name << ".";
+	std::vector<std::function<void()>> operations;
+	for (const auto &device : devices) {
+		operations.push_back([this, domain, &host_uri, device, time_measurement, &tag_postfix]
+		{
+			run_timed(time_measurement, "attach-pci-dev-" + device->address.str() + tag_postfix, [&]
+			{
+				attach_device(domain, host_uri, device);
+			});
+		});
+	}
+	run_operations(operations);
+	if (reserve_error)
+		std::rethrow_exception(reserve_error);
+}
+
+void PCI_device_handler::attach_device(virDomainPtr domain, const std::string &host_uri, std::shared_ptr<Device> device)
+{
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Attach device " << device->address.str();
+	// VFs pre-bound to vfio-pci by the pool are attached unmanaged.
+	auto hostdev_xml = device->to_hostdev_xml(!(vf_pool && vf_pool->is_prebound(host_uri, device->address)));
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Hostdev xml:";
+	FASTLIB_LOG(pcidev_handler_log, trace) << hostdev_xml;
+	if (virDomainAttachDevice(domain, hostdev_xml.c_str()) != 0) {
+		if (vf_pool && vf_pool->manages(device->id))
+			vf_pool->quarantine(host_uri, device->address);
+		device_ledger->release(host_uri, device->address);
+		throw std::runtime_error("Error attaching device " + device->address.str() + ": " + virGetLastErrorMessage());
 	}
-	// Find devices in cache.
+	// Prepared devices are owned by the now active domain.
+	device_ledger->confirm(host_uri, device->address);
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Success attaching device.";
+}
+
+void PCI_device_handler::trim_vf_pools(virConnectPtr host_connection)
+{
+	if (!vf_pool)
+		return;
+	// Without loaded reservations, VFs of running domains would look idle, e.g., after a restart of migfra.
+	load_ledger(host_connection, convert_and_free_cstr(virConnectGetURI(host_connection)));
+	vf_pool->trim(host_connection);
+}
+
+std::unordered_map<PCI_id, size_t> PCI_device_handler::detach(virDomainPtr domain, const Domain_inventory *inventory, Time_measurement *time_measurement, const std::string &tag_postfix)
+{
+	// Get all attached hostdevs from inventory or parse domain xml.
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Get all attached hostdevs.";
+	// TODO: Consider reusing hostdev xml descriptions instead of generating later from cached devices.
+	auto addresses = inventory ? inventory->hostdevs : get_hostdev_addresses(get_domain_xml(domain));
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Found " << addresses.size() << " attached devices.";
+	// Find devices and their PCI-id in cache.
 	FASTLIB_LOG(pcidev_handler_log, trace) << "Find devices in cache.";
+	auto connection = virDomainGetConnect(domain);
+	auto host_uri = convert_and_free_cstr(virConnectGetURI(connection));
+	const std::string domain_name = virDomainGetName(domain);
+	// Releasing must not mark the host as loaded while the devices of other domains are missing.
+	load_ledger(connection, host_uri);
 	std::vector<std::shared_ptr<Device>> devices;
-	for (const auto &id_addresses_pair : id_addresses_map) {
-		auto pci_id = id_addresses_pair.first;
-		auto addresses = id_addresses_pair.second;
-		auto all_devices = device_cache->get_devices(connection, pci_id, false);
-		for (const auto &address : addresses) {
-			for (const auto &device : all_devices) {
-				if (device->address == address) {
-					devices.push_back(device);
-					break;
+	// Detached device types with amount (may help reattaching on dest host)
+	std::unordered_map<PCI_id, size_t> types_counts;
+	for (const auto &address : addresses) {
+		auto device = device_cache->get_device(connection, address);
+		if (!device)
+			throw std::runtime_error("Attached device " + address.str() + " not found on host.");
+		++types_counts[device->id];
+		devices.push_back(std::move(device));
+	}
+	// Detach concurrently and release reservations.
+	FASTLIB_LOG(pcidev_handler_log, trace) << "Detach and release reservations.";
+	// Not std::vector<bool>, since elements are written concurrently.
+	std::vector<char> detached(devices.size(), false);
+	std::vector<std::function<void()>> operations;
+	for (size_t i = 0; i != devices.size(); ++i) {
+		operations.push_back([this, domain, i, &devices, &detached, &host_uri, &domain_name, time_measurement, &tag_postfix]
+		{
+			const auto &device = devices[i];
+			run_timed(time_measurement, "detach-pci-dev-" + device->address.str() + tag_postfix, [&]
+			{
+				if (virDomainDetachDevice(domain, device->to_hostdev_xml().c_str()) != 0) {
+					throw std::runtime_error("Error detaching device " + device->address.str()
+						+ " from " + domain_name + ": " + virGetLastErrorMessage());
 				}
-			}
+			});
+			detached[i] = true;
+			device_ledger->release(host_uri, device->address);
+		});
+	}
+	try {
+		run_operations(operations);
+	} catch (...) {
+		// Roll back by reattaching the devices which were detached.
+		std::vector<std::shared_ptr<Device>> rollback;
+		for (size_t i = 0; i != devices.size(); ++i) {
+			if (detached[i] && device_ledger->reserve(host_uri, devices[i]->address, domain_name))
+				rollback.push_back(devices[i]);
+		}
+		FASTLIB_LOG(pcidev_handler_log, trace) << "Detaching failed. Reattach " << rollback.size() << " detached devices.";
+		try {
+			attach(domain, rollback, {});
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(pcidev_handler_log, warn) << "Error during rollback of detaching devices: " << e.what();
 		}
+		throw;
 	}
-	// Detach and reset attached hint.
-	FASTLIB_LOG(pcidev_handler_log, trace) << "Detach and reset attached hint.";
-	for (const auto &device : devices) {
-		if (virDomainDetachDevice(domain, device->to_hostdev_xml().c_str()) != 0) {
-			auto domain_name = virDomainGetName(domain);
-			FASTLIB_LOG(pcidev_handler_log, trace) << "Error detaching device " << device->address.str() 
-						 << " from " << domain_name << ".";
+	return types_counts;
+}
+
+std::vector<std::shared_ptr<Device>> PCI_device_handler::prepare(virConnectPtr host_connection, const std::string &domain_name, const std::unordered_map<PCI_id, size_t> &types_counts)
+{
+	auto host_uri = convert_and_free_cstr(virConnectGetURI(host_connection));
+	std::vector<std::shared_ptr<Device>> prepared;
+	try {
+		load_ledger(host_connection, host_uri);
+		for (const auto &type_count : types_counts) {
+			auto candidates = device_cache->get_devices(host_connection, type_count.first);
+			for (size_t i = 0; i != type_count.second; ++i) {
+				// The domain does not exist on the host yet, so keep the reservation pending until it is attached or released.
+				auto device = device_ledger->reserve_any(host_uri, candidates, domain_name, true);
+				if (!device) {
+					FASTLIB_LOG(pcidev_handler_log, trace) << "No free device of type " << type_count.first.str() << " left to prepare.";
+					break;
+				}
+				prepared.push_back(std::move(device));
+			}
 		}
-		device->attached_hint = false;
+	} catch (...) {
+		for (const auto &device : prepared)
+			device_ledger->release(host_uri, device->address);
+		throw;
 	}
-	// Return detached device types with amount (may help reattaching on dest host)
-	std::unordered_map<PCI_id, size_t> types_counts;
-	for (const auto &id_addresses_pair : id_addresses_map) {
-		types_counts[id_addresses_pair.first] = id_addresses_pair.second.size();
+	// Bind to vfio, so that the managed attach does not have to unbind the host driver.
+	for (const auto &device : prepared) {
+		FASTLIB_LOG(pcidev_handler_log, trace) << "Pre-bind device " << device->address.str() << " on " << host_uri << ".";
+		std::unique_ptr<virNodeDevice, Deleter_virNodeDevice> nodedev(
+				virNodeDeviceLookupByName(host_connection, device->address.to_name_fmt().c_str()));
+		if (!nodedev || virNodeDeviceDetachFlags(nodedev.get(), "vfio", 0) != 0)
+			FASTLIB_LOG(pcidev_handler_log, trace) << "Could not pre-bind device " << device->address.str() << ". It is bound on attach.";
 	}
+	return prepared;
+}
 
-	return types_counts;
+void PCI_device_handler::release_prepared(virConnectPtr host_connection, const std::vector<std::shared_ptr<Device>> &devices)
+{
+	auto host_uri = convert_and_free_cstr(virConnectGetURI(host_connection));
+	load_ledger(host_connection, host_uri);
+	for (const auto &device : devices) {
+		device_ledger->release(host_uri, device->address);
+		std::unique_ptr<virNodeDevice, Deleter_virNodeDevice> nodedev(
+				virNodeDeviceLookupByName(host_connection, device->address.to_name_fmt().c_str()));
+		if (!nodedev || virNodeDeviceReAttach(nodedev.get()) != 0)
+			FASTLIB_LOG(pcidev_handler_log, trace) << "Could not rebind device " << device->address.str() << " to its host driver.";
+	}
 }
 
 //
@@ -369,7 +803,7 @@ std::unordered_map<PCI_id, size_t> PCI_device_handler::detach(virDomainPtr domai
 //
 
 Migrate_devices_guard::Migrate_devices_guard(std::shared_ptr<PCI_device_handler> pci_device_handler,
-		std::shared_ptr<virDomain> domain, Time_measurement &time_measurement, std::string tag_postfix) :
+		std::shared_ptr<virDomain> domain, const Domain_inventory &inventory, Time_measurement &time_measurement, std::string tag_postfix) :
 	pci_device_handler(pci_device_handler),
 	domain(domain),
 	time_measurement(time_measurement),
@@ -377,10 +811,14 @@ Migrate_devices_guard::Migrate_devices_guard(std::shared_ptr<PCI_device_handler>
 {
 	if (this->tag_postfix != "")
 		this->tag_postfix = "-" + this->tag_postfix;
+	auto name = virDomainGetName(domain.get());
+	if (!name)
+		throw std::runtime_error(std::string("Error getting domain name: ") + virGetLastErrorMessage());
+	domain_name = name;
 	FASTLIB_LOG(pcidev_handler_log, trace) << "Detach all devices.";
-	time_measurement.tick("detach-pci-devs" + this->tag_postfix);
-	detached_types_counts = pci_device_handler->detach(domain.get());
-	time_measurement.tock("detach-pci-devs" + this->tag_postfix);
+	tick_synchronized(time_measurement, "detach-pci-devs" + this->tag_postfix);
+	detached_types_counts = pci_device_handler->detach(domain.get(), &inventory, &time_measurement, this->tag_postfix);
+	tock_synchronized(time_measurement, "detach-pci-devs" + this->tag_postfix);
 }
 
 Migrate_devices_guard::~Migrate_devices_guard() noexcept(false)
@@ -400,16 +838,43 @@ void Migrate_devices_guard::set_destination_domain(std::shared_ptr<virDomain> de
 {
 	// override domain to reattach devices on
 	domain = dest_domain;
+	migrated = true;
+}
+
+void Migrate_devices_guard::prepare_destination(virConnectPtr dest_connection)
+{
+	tick_synchronized(time_measurement, "prepare-pci-devs" + tag_postfix);
+	// Keep connection to release prepared devices if migration fails.
+	virConnectRef(dest_connection);
+	this->dest_connection.reset(dest_connection, Deleter_virConnect());
+	prepared_devices = pci_device_handler->prepare(dest_connection, domain_name, detached_types_counts);
+	tock_synchronized(time_measurement, "prepare-pci-devs" + tag_postfix);
+}
+
+bool Migrate_devices_guard::has_detached_devices() const
+{
+	for (const auto &type_count : detached_types_counts) {
+		if (type_count.second != 0)
+			return true;
+	}
+	return false;
 }
 
 void Migrate_devices_guard::reattach()
 {
-	time_measurement.tick("reattach-pci-devs" + tag_postfix);
-	for (auto &type_count : detached_types_counts) {
-		for (;type_count.second != 0; --type_count.second) {
-			FASTLIB_LOG(pcidev_handler_log, trace) << "Reattach device of type " << type_count.first.str();
-			pci_device_handler->attach_by_id(domain.get(), type_count.first);
-		}
+	tick_synchronized(time_measurement, "reattach-pci-devs" + tag_postfix);
+	auto prepared = std::move(prepared_devices);
+	prepared_devices.clear();
+	if (!migrated && !prepared.empty()) {
+		FASTLIB_LOG(pcidev_handler_log, trace) << "Release " << prepared.size() << " prepared devices on destination.";
+		pci_device_handler->release_prepared(dest_connection.get(), prepared);
+		prepared.clear();
 	}
-	time_measurement.tock("reattach-pci-devs" + tag_postfix);
+	// Devices which were not prepared are attached by id.
+	auto types_counts = std::move(detached_types_counts);
+	detached_types_counts.clear();
+	for (const auto &device : prepared)
+		--types_counts[device->id];
+	pci_device_handler->attach(domain.get(), prepared, types_counts, &time_measurement, tag_postfix);
+	tock_synchronized(time_measurement, "reattach-pci-devs" + tag_postfix);
 }
@@ -15,18 +15,17 @@
 #include <fast-lib/serializable.hpp>
 
 #include <libvirt/libvirt.h>
-#include <boost/property_tree/ptree.hpp>
 
+#include <functional>
 #include <memory>
 #include <unordered_map>
 #include <vector>
 #include <mutex>
-#include <atomic>
 
 using PCI_id = fast::msg::migfra::PCI_id;
 using Time_measurement = fast::msg::migfra::Time_measurement;
 
-// Contains pci address and methods to convert from and to ptree.
+// Contains pci address and methods to convert from and to xml.
 struct PCI_address
 {
 	using domain_t = unsigned short;
@@ -37,7 +36,7 @@ struct PCI_address
 	PCI_address(domain_t domain, bus_t bus, slot_t slot, function_t function);
 
 	bool operator==(const PCI_address &rhs) const;
-	boost::property_tree::ptree to_address_ptree() const;
+	std::string to_address_xml() const;
 	std::string str() const;
 	std::string to_name_fmt() const;
 
@@ -47,73 +46,259 @@ struct PCI_address
 	const function_t function;
 };
 
+namespace std {
+	template<> struct hash<PCI_address>
+	{
+		size_t operator()(const PCI_address &address) const
+		{
+			return (static_cast<size_t>(address.domain) << 16) | (address.bus << 8) | (address.slot << 3) | address.function;
+		}
+	};
+}
+
+class Xml_scanner;
+
+// Make PCI address from the attributes of the address element the scanner is at, e.g., the source of a hostdev.
+PCI_address make_pci_address_from_xml(const Xml_scanner &scanner);
+
+// Check if the hostdev element the scanner is at is a PCI device, i.e., has a PCI source address.
+bool is_pci_hostdev(const Xml_scanner &scanner);
+
+// Get the devices attached to the active domains of a host with the name of the domain per device.
+std::unordered_map<PCI_address, std::string> get_attached_devices(virConnectPtr host_connection);
+
 // Contains xml description of device which can be used to attach/detach.
-// Also contains a hint to mark the device as already in use.
-// Nevertheless the device might still be tried to attach but has lower priority.
+// Which domain a device is reserved for is tracked by Device_ledger.
 struct Device
 {
-	Device(const std::string &xml_desc);
-	Device(std::string &&xml_desc);
+	// Parse the xml description of a PCI node device.
+	Device(std::string xml_desc);
 	Device(PCI_address &pci_addr);
 
-	std::string to_hostdev_xml() const;
+	// Unmanaged hostdevs are neither bound to vfio-pci on attach nor rebound to their host driver on detach.
+	std::string to_hostdev_xml(bool managed = true) const;
 	std::string to_hostdev_xml(PCI_address &pci_addr) const;
 
 	const std::string xml_desc;
 	const PCI_address address;
-	std::atomic<bool> attached_hint;
+	const PCI_id id;
+	// IOMMU group of the device (-1 if unknown).
+	const int iommu_group;
+	// NUMA node of the device (-1 if unknown).
+	const int numa_node;
+	// Address of the SR-IOV physical function if the device is a virtual function (nullptr otherwise).
+	const std::shared_ptr<const PCI_address> physical_function;
+	// Maximum and current SR-IOV virtual functions if the device is a physical function.
+	const unsigned int max_virtual_functions;
+	const std::vector<PCI_address> virtual_functions;
+private:
+	// Fields parsed from the xml description.
+	struct Description;
+
+	static Description parse_xml(const std::string &xml_desc);
+	Device(Description description, std::string &&xml_desc);
 };
 
-// A lazy initialized cache to store devices in.
+// PCI devices of a host indexed by PCI-id, PCI address and IOMMU group.
+struct Device_inventory
+{
+	void add(std::shared_ptr<Device> device);
+	void remove(const PCI_address &address);
+
+	std::unordered_map<PCI_id, std::vector<std::shared_ptr<Device>>> by_id;
+	std::unordered_map<PCI_address, std::shared_ptr<Device>> by_address;
+	std::unordered_map<int, std::vector<std::shared_ptr<Device>>> by_iommu_group;
+};
+
+/**
+ * \brief A lazy initialized cache of the PCI devices of each host.
+ *
+ * The node device descriptions of a host are fetched and parsed once on first access to an inventory
+ * which is shared by attach, detach and reattach.
+ * Afterwards the inventory is updated incrementally by node device lifecycle and update events,
+ * e.g., if a card is hot-plugged or SR-IOV VFs are reconfigured. The connection the events are received on is
+ * kept open. If it dies, the inventory is rebuilt on next access.
+ * Only if events are not supported by the host, a lookup of an unknown PCI-id or address rebuilds the inventory.
+ * Events are dispatched by Libvirt_event_loop.
+ */
 class Device_cache
 {
 public:
-	std::vector<std::shared_ptr<Device>> get_devices(virConnectPtr host_connection, PCI_id pci_id, bool sort_and_shuffle = true) const;
+	Device_cache();
+	~Device_cache();
+	Device_cache(const Device_cache &) = delete;
+	Device_cache & operator=(const Device_cache &) = delete;
+
+	/**
+	 * \brief Get devices of a certain type.
+	 */
+	std::vector<std::shared_ptr<Device>> get_devices(virConnectPtr host_connection, PCI_id pci_id) const;
+	/**
+	 * \brief Get device by PCI address or nullptr if the host has no such device.
+	 */
+	std::shared_ptr<Device> get_device(virConnectPtr host_connection, const PCI_address &address) const;
+	/**
+	 * \brief Get all devices in an IOMMU group.
+	 */
+	std::vector<std::shared_ptr<Device>> get_iommu_group(virConnectPtr host_connection, int iommu_group) const;
+	/**
+	 * \brief Rebuild the inventory of a host, e.g., after changing the number of SR-IOV virtual functions.
+	 */
+	void rescan(virConnectPtr host_connection) const;
 private:
-	// (hosturi : (pci_id : xml_desc))
-	mutable std::unordered_map<std::string, std::unordered_map<PCI_id, std::vector<std::shared_ptr<Device>>>> devices;
+	// The cache as seen by event callbacks. It is reset on destruction, since callbacks may still be dispatched.
+	struct Event_target
+	{
+		std::mutex mutex;
+		const Device_cache *cache;
+	};
+	// Opaque data of a registered event callback, owned and freed by libvirt.
+	struct Callback_data
+	{
+		std::shared_ptr<Event_target> target;
+		std::string host_uri;
+	};
+	// Subscription to the node device events of a host.
+	struct Subscription
+	{
+		bool is_registered() const;
+		bool is_active() const;
+
+		std::shared_ptr<virConnect> connection;
+		int lifecycle_callback_id = -1;
+		int update_callback_id = -1;
+	};
+
+	static void lifecycle_callback(virConnectPtr connection, virNodeDevicePtr device, int event, int detail, void *opaque);
+	static void update_callback(virConnectPtr connection, virNodeDevicePtr device, void *opaque);
+	static void free_callback_data(void *opaque);
+
+	std::shared_ptr<const Device_inventory> get_inventory(virConnectPtr host_connection, bool rebuild = false) const;
+	// Expects devices_mutex to be locked.
+	std::unique_ptr<Subscription> subscribe(virConnectPtr host_connection, const std::string &host_uri) const;
+	void update_device(const std::string &host_uri, virNodeDevicePtr device) const;
+	void remove_device(const std::string &host_uri, virNodeDevicePtr device) const;
+
+	// (hosturi : inventory)
+	mutable std::unordered_map<std::string, std::shared_ptr<const Device_inventory>> inventories;
+	// (hosturi : subscription)
+	mutable std::unordered_map<std::string, std::unique_ptr<Subscription>> subscriptions;
 	mutable std::mutex devices_mutex;
+	std::shared_ptr<Event_target> event_target;
 };
 
+class Device_ledger;
+class VF_pool;
+struct Domain_inventory;
+struct VF_pool_config;
+
 // Provides methods to attach, detach and handle those during migration.
 // TODO: Improve use of PCI device vendor and type id 
 class PCI_device_handler
 {
 public:
-	PCI_device_handler();
 	/**
-	 * \brief Attach device of certain type to domain.
+	 * \brief Constructor for PCI_device_handler.
+	 *
+	 * \param max_parallel_operations Attach/detach operations of a domain run concurrently (0: unlimited).
+	 */
+	explicit PCI_device_handler(unsigned int max_parallel_operations = 0);
+	/**
+	 * \brief Constructor for PCI_device_handler managing pools of SR-IOV virtual functions.
+	 *
+	 * Devices of the virtual function types of the pools are attached through VF_pool.
+	 */
+	PCI_device_handler(unsigned int max_parallel_operations, const std::vector<VF_pool_config> &vf_pools);
+	~PCI_device_handler();
+	/**
+	 * \brief Attach a free device of certain type to domain.
+	 *
+	 * The device is reserved in the ledger before attaching, so concurrent attaches never try the same device.
 	 */
 	void attach_by_id(virDomainPtr domain, PCI_id pci_id);
-	bool attach_device(virDomainPtr domain, std::shared_ptr<Device> device);
 	/**
-	 * \brief Detach device of certain type to domain.
+	 * \brief Attach device at a certain PCI address to domain.
+	 */
+	void attach_by_address(virDomainPtr domain, const PCI_address &address);
+	/**
+	 * \brief Attach prepared devices and free devices of certain types to domain concurrently.
 	 *
+	 * All devices are attached even if some fail. Afterwards the first error is rethrown.
+	 * \param time_measurement Optional measurement of each attach tagged "attach-pci-dev-<address><tag_postfix>".
+	 */
+	void attach(virDomainPtr domain, const std::vector<std::shared_ptr<Device>> &prepared, const std::unordered_map<PCI_id, size_t> &types_counts,
+			Time_measurement *time_measurement = nullptr, const std::string &tag_postfix = "");
+	/**
+	 * \brief Detach all devices from domain concurrently.
+	 *
+	 * If a device cannot be detached, the devices which were detached are reattached and the error is rethrown.
+	 * \param inventory Optional snapshot of the domain's devices, so that its xml description need not be parsed again.
+	 * \param time_measurement Optional measurement of each detach tagged "detach-pci-dev-<address><tag_postfix>".
 	 * \returns A map with type id as key and the number of detached devices of that type as value.
 	 */
-	std::unordered_map<PCI_id, size_t> detach(virDomainPtr domain);
+	std::unordered_map<PCI_id, size_t> detach(virDomainPtr domain, const Domain_inventory *inventory = nullptr, Time_measurement *time_measurement = nullptr, const std::string &tag_postfix = "");
+	/**
+	 * \brief Reserve free devices of the given types on a host for domain and bind them to vfio ahead of attaching.
+	 *
+	 * Types without enough free devices are prepared partially, so that the rest is attached by id later.
+	 * The reservations are pending, so that they are not released as stale before the domain arrived.
+	 * \returns The prepared devices.
+	 */
+	std::vector<std::shared_ptr<Device>> prepare(virConnectPtr host_connection, const std::string &domain_name, const std::unordered_map<PCI_id, size_t> &types_counts);
+	/**
+	 * \brief Release devices which were prepared but will not be attached and rebind them to their host driver.
+	 */
+	void release_prepared(virConnectPtr host_connection, const std::vector<std::shared_ptr<Device>> &devices);
+	/**
+	 * \brief Shrink idle SR-IOV physical functions of a host to their spare number of virtual functions.
+	 */
+	void trim_vf_pools(virConnectPtr host_connection);
 private:
+	// Reserve a free device of type for domain.
+	std::shared_ptr<Device> reserve_by_id(virDomainPtr domain, const std::string &host_uri, PCI_id pci_id);
+	// Run operations by at most max_parallel_operations threads and rethrow the first error after all finished.
+	void run_operations(const std::vector<std::function<void()>> &operations) const;
+	// Attach device which has to be reserved for domain. Releases the reservation on failure.
+	void attach_device(virDomainPtr domain, const std::string &host_uri, std::shared_ptr<Device> device);
+	// Load reservations of host from its active domains if not done yet.
+	void load_ledger(virConnectPtr connection, const std::string &host_uri);
+
 	std::unique_ptr<const Device_cache> device_cache;	
+	std::unique_ptr<Device_ledger> device_ledger;
+	std::unique_ptr<VF_pool> vf_pool;
+	unsigned int max_parallel_operations;
 };
 
 /**
  * \brief RAII-guard to detach devices in constructor and reattach in destructor.
  * 
  * If no error occures during migration the domain on destination should be set.
+ * Devices on the destination may be prepared while the migration is running, so that reattaching
+ * them on the destination is a single attach. Prepared devices are released if the migration fails.
  */
 class Migrate_devices_guard
 {
 public:
-	Migrate_devices_guard(std::shared_ptr<PCI_device_handler> pci_device_handler, std::shared_ptr<virDomain> domain, Time_measurement &time_measurement, std::string tag_postfix = "");
+	Migrate_devices_guard(std::shared_ptr<PCI_device_handler> pci_device_handler, std::shared_ptr<virDomain> domain, const Domain_inventory &inventory, Time_measurement &time_measurement, std::string tag_postfix = "");
 	~Migrate_devices_guard() noexcept(false);
 
 	void set_destination_domain(std::shared_ptr<virDomain> dest_domain);
+	bool has_detached_devices() const;
+	/**
+	 * \brief Reserve and pre-bind devices of the detached types on the destination.
+	 */
+	void prepare_destination(virConnectPtr dest_connection);
 private:
 	void reattach();
 
 	std::shared_ptr<PCI_device_handler> pci_device_handler;
 	std::shared_ptr<virDomain> domain;
+	// Name of the domain, since domain is replaced while devices are prepared concurrently.
+	std::string domain_name;
+	bool migrated = false;
 	std::unordered_map<PCI_id, size_t> detached_types_counts;
+	std::shared_ptr<virConnect> dest_connection;
+	std::vector<std::shared_ptr<Device>> prepared_devices;
 	Time_measurement &time_measurement;
 	std::string tag_postfix;
 };
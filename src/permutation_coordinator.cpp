@@ -0,0 +1,186 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "permutation_coordinator.hpp"
+
+#include <fast-lib/log.hpp>
+
+#include <stdexcept>
+
+FASTLIB_LOG_INIT(permutation_coordinator_log, "Permutation_coordinator")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(permutation_coordinator_log, trace);
+
+Permutation_coordinator::Permutation_coordinator(std::vector<std::string> hosts, std::vector<unsigned long long> memory, std::unordered_map<std::string, long long> free_memory) :
+	hosts(std::move(hosts)),
+	memory(std::move(memory)),
+	free_memory(std::move(free_memory)),
+	members(this->hosts.size()),
+	pending(this->hosts.size())
+{
+	if (this->hosts.size() != this->memory.size())
+		throw std::logic_error("Number of hosts and domains of permutation differ.");
+}
+
+const std::string & Permutation_coordinator::get_destination(size_t i) const
+{
+	return hosts[(i + 1) % hosts.size()];
+}
+
+bool Permutation_coordinator::is_feasible() const
+{
+	for (size_t i = 0; i != hosts.size(); ++i) {
+		auto occupant = (i + 1) % hosts.size();
+		auto it = free_memory.find(get_destination(i));
+		auto free = it != free_memory.end() ? it->second : 0;
+		if (free + static_cast<long long>(memory[occupant]) < static_cast<long long>(memory[i]))
+			return false;
+	}
+	return true;
+}
+
+bool Permutation_coordinator::try_reserve(size_t i)
+{
+	auto &free = free_memory[get_destination(i)];
+	if (free < static_cast<long long>(memory[i]))
+		return false;
+	free -= memory[i];
+	members[i].reserved = true;
+	members[i].active = true;
+	++active;
+	return true;
+}
+
+bool Permutation_coordinator::resolve_blocking()
+{
+	// Only resolve if nothing is in progress and all other pending domains wait
+	if (active != 0 || waiting + 1 != pending)
+		return false;
+	// A domain which may move was not yet woken up
+	for (size_t i = 0; i != members.size(); ++i) {
+		if (members[i].pending && !members[i].active && free_memory[get_destination(i)] >= static_cast<long long>(memory[i]))
+			return false;
+	}
+	// Prefer the smallest domain which makes room for its predecessor
+	int candidate = -1;
+	bool candidate_unblocks = false;
+	for (size_t i = 0; i != members.size(); ++i) {
+		if (!members[i].pending || members[i].staged || members[i].left)
+			continue;
+		auto predecessor = (i + members.size() - 1) % members.size();
+		bool unblocks = members[predecessor].pending && !members[predecessor].left &&
+			free_memory[hosts[i]] + static_cast<long long>(memory[i]) >= static_cast<long long>(memory[predecessor]);
+		if (candidate == -1 || (unblocks && !candidate_unblocks) ||
+				(unblocks == candidate_unblocks && memory[i] < memory[candidate])) {
+			candidate = i;
+			candidate_unblocks = unblocks;
+		}
+	}
+	if (candidate == -1) {
+		FASTLIB_LOG(permutation_coordinator_log, warn) << "Remaining domains of permutation are blocked.";
+		infeasible = true;
+	} else {
+		FASTLIB_LOG(permutation_coordinator_log, trace) << "Stage domain " << candidate << " on " << hosts[candidate] << ".";
+		members[candidate].staged = true;
+	}
+	cv.notify_all();
+	return true;
+}
+
+void Permutation_coordinator::wait(std::unique_lock<std::mutex> &lock)
+{
+	++waiting;
+	cv.wait(lock);
+	--waiting;
+}
+
+bool Permutation_coordinator::wait_for_turn(size_t i)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		if (infeasible)
+			throw std::runtime_error("Not enough memory to move the remaining domains of the cycle.");
+		if (try_reserve(i))
+			return true;
+		if (members[i].staged) {
+			// Halting the domain is in progress
+			members[i].active = true;
+			++active;
+			return false;
+		}
+		if (!resolve_blocking())
+			wait(lock);
+	}
+}
+
+void Permutation_coordinator::left_source(size_t i)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	free_memory[hosts[i]] += memory[i];
+	members[i].left = true;
+	if (members[i].active) {
+		members[i].active = false;
+		--active;
+	}
+	cv.notify_all();
+}
+
+void Permutation_coordinator::wait_for_room(size_t i)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		if (infeasible)
+			throw std::runtime_error("Not enough memory to restore staged domain on its destination.");
+		if (try_reserve(i))
+			return;
+		if (!resolve_blocking())
+			wait(lock);
+	}
+}
+
+void Permutation_coordinator::arrived(size_t i)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	members[i].arrived = true;
+}
+
+void Permutation_coordinator::finish(size_t i)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!members[i].arrived) {
+		// Give back the room on the destination if the domain did not move there
+		if (members[i].reserved) {
+			free_memory[get_destination(i)] += memory[i];
+			members[i].reserved = false;
+		}
+		// A domain staged in vain is restored on its source
+		if (members[i].left) {
+			free_memory[hosts[i]] -= memory[i];
+			members[i].left = false;
+		}
+	}
+	if (members[i].active) {
+		members[i].active = false;
+		--active;
+	}
+	if (members[i].pending) {
+		members[i].pending = false;
+		--pending;
+	}
+	cv.notify_all();
+}
+
+Permutation_member::Permutation_member(Permutation_coordinator &coordinator, size_t index) :
+	coordinator(coordinator),
+	index(index)
+{
+}
+
+Permutation_member::~Permutation_member()
+{
+	coordinator.finish(index);
+}
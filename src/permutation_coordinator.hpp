@@ -0,0 +1,115 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef PERMUTATION_COORDINATOR_HPP
+#define PERMUTATION_COORDINATOR_HPP
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * \brief Decides when the domains of a cycle of hosts may move to the next host.
+ *
+ * Domain i runs on hosts[i] and moves to hosts[i + 1], the last one to hosts[0].
+ * A domain is migrated as soon as its destination has room. If no migration is in progress and all remaining
+ * domains wait for room, one of them is staged, i.e., halted by a snapshot to free its memory and restored on
+ * its destination once its occupant left. Thus, independent moves run in parallel and a fully blocked cycle
+ * degrades to the snapshot-based swap migration.
+ * Memory in KiB.
+ */
+class Permutation_coordinator
+{
+public:
+	/**
+	 * \param hosts The host each domain runs on.
+	 * \param memory The memory of each domain.
+	 * \param free_memory The free memory of each host.
+	 */
+	Permutation_coordinator(std::vector<std::string> hosts, std::vector<unsigned long long> memory, std::unordered_map<std::string, long long> free_memory);
+
+	/**
+	 * \brief Check if the cycle may be executed by staging domains where necessary.
+	 *
+	 * This is the case if every destination has room after its occupant left.
+	 */
+	bool is_feasible() const;
+	/**
+	 * \brief Block until domain i may leave its host.
+	 *
+	 * Throws if the remaining domains cannot be moved anymore.
+	 * \returns True if the room on the destination was reserved, false if the domain has to be staged.
+	 */
+	bool wait_for_turn(size_t i);
+	/**
+	 * \brief Mark domain i as gone from its host, so that its memory is free.
+	 */
+	void left_source(size_t i);
+	/**
+	 * \brief Block until the destination of staged domain i has room and reserve it.
+	 */
+	void wait_for_room(size_t i);
+	/**
+	 * \brief Mark domain i as running on its destination.
+	 */
+	void arrived(size_t i);
+	/**
+	 * \brief Mark domain i as done (successful or not).
+	 *
+	 * Has to be called in any case, so that the domain does not block others.
+	 * If the domain did not arrive, the room reserved on its destination is given back
+	 * and the domain is accounted on its source again.
+	 */
+	void finish(size_t i);
+private:
+	struct Member
+	{
+		bool pending = true;
+		bool active = false;
+		bool staged = false;
+		bool left = false;
+		bool reserved = false;
+		bool arrived = false;
+	};
+
+	const std::string & get_destination(size_t i) const;
+	bool try_reserve(size_t i);
+	// Stage a domain if all pending domains wait. Returns false if nothing changed.
+	bool resolve_blocking();
+	void wait(std::unique_lock<std::mutex> &lock);
+
+	std::vector<std::string> hosts;
+	std::vector<unsigned long long> memory;
+	std::unordered_map<std::string, long long> free_memory;
+	std::vector<Member> members;
+	unsigned int active = 0;
+	unsigned int pending;
+	unsigned int waiting = 0;
+	bool infeasible = false;
+	std::mutex mutex;
+	std::condition_variable cv;
+};
+
+/**
+ * \brief RAII-guard calling Permutation_coordinator::finish.
+ */
+class Permutation_member
+{
+public:
+	Permutation_member(Permutation_coordinator &coordinator, size_t index);
+	~Permutation_member();
+	Permutation_member(const Permutation_member &) = delete;
+	Permutation_member & operator=(const Permutation_member &) = delete;
+private:
+	Permutation_coordinator &coordinator;
+	size_t index;
+};
+
+#endif
@@ -0,0 +1,310 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "placement.hpp"
+
+#include <fast-lib/log.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_set>
+
+FASTLIB_LOG_INIT(placement_log, "Placement")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(placement_log, trace);
+
+size_t Placement::hosts_used() const
+{
+	std::unordered_set<std::string> hosts;
+	for (const auto &domain_host : assignment)
+		hosts.insert(domain_host.second);
+	return hosts.size();
+}
+
+std::string Placement::str() const
+{
+	std::string str;
+	for (const auto &domain_host : assignment)
+		str += (str.empty() ? "" : ", ") + domain_host.first + " -> " + domain_host.second;
+	for (const auto &domain : unplaced)
+		str += (str.empty() ? "" : ", ") + domain + " -> none";
+	return str;
+}
+
+// Returns the index of the NUMA node with the least free memory the domain fits into or -1.
+static int find_numa_node(const Host_resources &host, const Domain_demand &domain)
+{
+	int best = -1;
+	for (size_t i = 0; i != host.numa_free_memory.size(); ++i) {
+		if (host.numa_free_memory[i] >= domain.memory &&
+				(best == -1 || host.numa_free_memory[i] < host.numa_free_memory[best]))
+			best = i;
+	}
+	return best;
+}
+
+Placement place_domains(std::vector<Domain_demand> domains, std::vector<Host_resources> &hosts, const std::string &mode, bool overbooking)
+{
+	if (mode != "pack" && mode != "balance")
+		throw std::invalid_argument("Unknown placement mode: " + mode);
+	bool pack = mode == "pack";
+	std::sort(domains.begin(), domains.end(), [](const Domain_demand &lhs, const Domain_demand &rhs)
+	{
+		return lhs.memory != rhs.memory ? lhs.memory > rhs.memory : lhs.vcpus > rhs.vcpus;
+	});
+	Placement placement;
+	for (const auto &domain : domains) {
+		Host_resources *best = nullptr;
+		bool best_numa_fit = false;
+		for (auto &host : hosts) {
+			if (host.free_memory < domain.memory)
+				continue;
+			if (!overbooking && host.used_cpus + domain.vcpus > host.cpus)
+				continue;
+			bool numa_fit = find_numa_node(host, domain) != -1;
+			if (best && best_numa_fit && !numa_fit)
+				continue;
+			bool better = !best || (numa_fit && !best_numa_fit);
+			if (!better) {
+				// Compare by free cpus first when balancing, since cpus are the scarcer resource for HPC domains.
+				auto free_cpus = static_cast<long long>(host.cpus) - host.used_cpus;
+				auto best_free_cpus = static_cast<long long>(best->cpus) - best->used_cpus;
+				if (pack)
+					better = host.free_memory < best->free_memory ||
+						(host.free_memory == best->free_memory && free_cpus < best_free_cpus);
+				else
+					better = free_cpus > best_free_cpus ||
+						(free_cpus == best_free_cpus && host.free_memory > best->free_memory);
+			}
+			if (better) {
+				best = &host;
+				best_numa_fit = numa_fit;
+			}
+		}
+		if (!best) {
+			FASTLIB_LOG(placement_log, trace) << "Domain " << domain.name << " does not fit on any host.";
+			placement.unplaced.push_back(domain.name);
+			continue;
+		}
+		placement.assignment[domain.name] = best->name;
+		best->free_memory -= domain.memory;
+		best->used_cpus += domain.vcpus;
+		auto numa_node = find_numa_node(*best, domain);
+		if (numa_node != -1)
+			best->numa_free_memory[numa_node] -= domain.memory;
+	}
+	FASTLIB_LOG(placement_log, trace) << "Placement (" << mode << ", " << placement.hosts_used() << " hosts used): " << placement.str();
+	return placement;
+}
+
+std::string Consolidation_plan::str() const
+{
+	std::string str;
+	for (const auto &move : moves)
+		str += (str.empty() ? "" : ", ") + move.domain.name + ": " + move.source + " -> " + move.destination;
+	str += "; freed:";
+	for (const auto &host : freed_hosts)
+		str += " " + host;
+	return str;
+}
+
+Consolidation_plan plan_consolidation(std::vector<Host_resources> hosts, bool overbooking)
+{
+	auto load = [](const Host_resources &host)
+	{
+		unsigned long long memory = 0;
+		for (const auto &domain : host.domains)
+			memory += domain.memory;
+		return memory;
+	};
+	std::sort(hosts.begin(), hosts.end(), [&load](const Host_resources &lhs, const Host_resources &rhs)
+	{
+		auto lhs_load = load(lhs);
+		auto rhs_load = load(rhs);
+		return lhs_load != rhs_load ? lhs_load < rhs_load : lhs.used_cpus < rhs.used_cpus;
+	});
+	Consolidation_plan plan;
+	std::unordered_set<std::string> freed;
+	std::unordered_set<std::string> kept;
+	for (const auto &candidate : hosts) {
+		if (candidate.domains.empty() || kept.count(candidate.name) != 0)
+			continue;
+		// Try to pack all domains of the candidate onto the other remaining hosts.
+		std::vector<Host_resources> targets;
+		for (const auto &host : hosts) {
+			if (host.name != candidate.name && !host.domains.empty() && freed.count(host.name) == 0)
+				targets.push_back(host);
+		}
+		auto placement = place_domains(candidate.domains, targets, "pack", overbooking);
+		if (!placement.unplaced.empty()) {
+			FASTLIB_LOG(placement_log, trace) << "Host " << candidate.name << " cannot be emptied.";
+			continue;
+		}
+		for (const auto &domain : candidate.domains) {
+			Consolidation_move move;
+			move.domain = domain;
+			move.source = candidate.name;
+			move.destination = placement.assignment.at(domain.name);
+			kept.insert(move.destination);
+			plan.moves.push_back(std::move(move));
+		}
+		// Apply the resources used by the moved domains.
+		for (auto &host : hosts) {
+			auto it = std::find_if(targets.begin(), targets.end(),
+					[&host](const Host_resources &target){return target.name == host.name;});
+			if (it != targets.end()) {
+				host.free_memory = it->free_memory;
+				host.used_cpus = it->used_cpus;
+				host.numa_free_memory = it->numa_free_memory;
+			}
+		}
+		freed.insert(candidate.name);
+		plan.freed_hosts.push_back(candidate.name);
+	}
+	FASTLIB_LOG(placement_log, trace) << "Consolidation plan: " << plan.str();
+	return plan;
+}
+
+std::string Rebalance_plan::str() const
+{
+	std::string str;
+	for (const auto &action : actions) {
+		str += (str.empty() ? "" : ", ") + action.domain.name + ": " + action.source + " -> " + action.destination;
+		if (!action.swap_with.name.empty())
+			str += " (swap with " + action.swap_with.name + ")";
+	}
+	str += "; overloaded:";
+	for (const auto &host : overloaded_hosts)
+		str += " " + host;
+	return str;
+}
+
+static double get_cpu_usage(const Host_resources &host)
+{
+	double cpu_usage = 0;
+	for (const auto &domain : host.domains)
+		cpu_usage += domain.cpu_usage;
+	return cpu_usage;
+}
+
+static double get_utilization(const Host_resources &host)
+{
+	return host.cpus == 0 ? 0 : get_cpu_usage(host) / host.cpus;
+}
+
+// Prefer the smallest change which suffices on its own, else the largest one.
+static bool is_better_relief(double relief, double best_relief, double excess)
+{
+	bool sufficient = relief >= excess;
+	bool best_sufficient = best_relief >= excess;
+	if (sufficient != best_sufficient)
+		return sufficient;
+	return sufficient ? relief < best_relief : relief > best_relief;
+}
+
+Rebalance_plan plan_rebalance(std::vector<Host_resources> hosts, double target, bool swap, bool overbooking)
+{
+	if (target <= 0)
+		throw std::invalid_argument("Utilization target must be greater than 0.");
+	Rebalance_plan plan;
+	std::unordered_set<std::string> moved;
+	std::unordered_set<std::string> unresolvable;
+	while (true) {
+		// Find the most utilized host which may be relieved
+		Host_resources *source = nullptr;
+		for (auto &host : hosts) {
+			if (get_utilization(host) > target && unresolvable.count(host.name) == 0 &&
+					(!source || get_utilization(host) > get_utilization(*source)))
+				source = &host;
+		}
+		if (!source)
+			break;
+		auto excess = get_cpu_usage(*source) - target * source->cpus;
+		// Find best migration
+		Host_resources *best_destination = nullptr;
+		size_t best_domain = 0;
+		for (size_t i = 0; i != source->domains.size(); ++i) {
+			const auto &domain = source->domains[i];
+			if (moved.count(domain.name) != 0 || domain.cpu_usage <= 0)
+				continue;
+			for (auto &host : hosts) {
+				if (&host == source || host.free_memory < domain.memory ||
+						get_cpu_usage(host) + domain.cpu_usage > target * host.cpus ||
+						(!overbooking && host.used_cpus + domain.vcpus > host.cpus))
+					continue;
+				const auto &best = best_destination ? source->domains[best_domain] : domain;
+				if (!best_destination || is_better_relief(domain.cpu_usage, best.cpu_usage, excess) ||
+						(domain.cpu_usage == best.cpu_usage && get_utilization(host) < get_utilization(*best_destination))) {
+					best_destination = &host;
+					best_domain = i;
+				}
+			}
+		}
+		if (best_destination) {
+			auto domain = source->domains[best_domain];
+			plan.actions.push_back(Rebalance_action{domain, source->name, best_destination->name, Domain_demand()});
+			moved.insert(domain.name);
+			source->domains.erase(source->domains.begin() + best_domain);
+			source->used_cpus -= std::min(source->used_cpus, domain.vcpus);
+			best_destination->domains.push_back(domain);
+			best_destination->used_cpus += domain.vcpus;
+			best_destination->free_memory -= domain.memory;
+			continue;
+		}
+		// Find best swap with a less busy domain
+		size_t best_swap_domain = 0;
+		double best_relief = 0;
+		for (size_t i = 0; swap && i != source->domains.size(); ++i) {
+			const auto &domain = source->domains[i];
+			if (moved.count(domain.name) != 0)
+				continue;
+			for (auto &host : hosts) {
+				if (&host == source)
+					continue;
+				for (size_t j = 0; j != host.domains.size(); ++j) {
+					const auto &other = host.domains[j];
+					auto relief = domain.cpu_usage - other.cpu_usage;
+					if (moved.count(other.name) != 0 || relief <= 0 ||
+							host.free_memory + other.memory < domain.memory ||
+							source->free_memory + domain.memory < other.memory ||
+							get_cpu_usage(host) + relief > target * host.cpus ||
+							(!overbooking && host.used_cpus + domain.vcpus > host.cpus + other.vcpus))
+						continue;
+					if (!best_destination || is_better_relief(relief, best_relief, excess)) {
+						best_destination = &host;
+						best_domain = i;
+						best_swap_domain = j;
+						best_relief = relief;
+					}
+				}
+			}
+		}
+		if (best_destination) {
+			auto domain = source->domains[best_domain];
+			auto other = best_destination->domains[best_swap_domain];
+			plan.actions.push_back(Rebalance_action{domain, source->name, best_destination->name, other});
+			moved.insert(domain.name);
+			moved.insert(other.name);
+			source->domains[best_domain] = other;
+			source->used_cpus = source->used_cpus - std::min(source->used_cpus, domain.vcpus) + other.vcpus;
+			// Memory freed by the swap is only reused by the swap itself
+			source->free_memory = std::min(source->free_memory, source->free_memory + domain.memory - other.memory);
+			best_destination->domains[best_swap_domain] = domain;
+			best_destination->used_cpus = best_destination->used_cpus - std::min(best_destination->used_cpus, other.vcpus) + domain.vcpus;
+			best_destination->free_memory = std::min(best_destination->free_memory, best_destination->free_memory + other.memory - domain.memory);
+			continue;
+		}
+		FASTLIB_LOG(placement_log, trace) << "Host " << source->name << " cannot be relieved.";
+		unresolvable.insert(source->name);
+	}
+	for (const auto &host : hosts) {
+		if (get_utilization(host) > target)
+			plan.overloaded_hosts.push_back(host.name);
+	}
+	FASTLIB_LOG(placement_log, trace) << "Rebalance plan: " << plan.str();
+	return plan;
+}
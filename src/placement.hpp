@@ -0,0 +1,137 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef PLACEMENT_HPP
+#define PLACEMENT_HPP
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * \brief Resources a domain requires on its destination. Memory in KiB.
+ */
+struct Domain_demand
+{
+	std::string name;
+	unsigned int vcpus = 0;
+	unsigned long long memory = 0;
+	// Measured number of cpus used on average (only set by load probes).
+	double cpu_usage = 0;
+};
+
+/**
+ * \brief Resources of a destination host. Memory in KiB.
+ */
+struct Host_resources
+{
+	std::string name;
+	unsigned int cpus = 0;
+	unsigned int used_cpus = 0;
+	unsigned int active_domains = 0;
+	unsigned long long free_memory = 0;
+	std::vector<unsigned long long> numa_free_memory;
+	// Demands of the active domains on the host.
+	std::vector<Domain_demand> domains;
+};
+
+/**
+ * \brief Assignment of domains to hosts.
+ */
+struct Placement
+{
+	// (domain name : host name)
+	std::unordered_map<std::string, std::string> assignment;
+	// Domains which did not fit on any host.
+	std::vector<std::string> unplaced;
+
+	size_t hosts_used() const;
+	std::string str() const;
+};
+
+/**
+ * \brief Assign domains to hosts using a decreasing bin-packing heuristic.
+ *
+ * Domains are placed in order of decreasing memory and vcpus.
+ * A domain fits on a host if its memory fits into the free memory and, without overbooking,
+ * its vcpus fit into the unused cpus. Hosts on which the domain fits into a single NUMA node are preferred.
+ * \param mode "pack" places each domain on the fullest host it fits on (best-fit) to minimize the hosts used,
+ * "balance" places it on the emptiest host (worst-fit) to balance the load.
+ * \param hosts The resources of the hosts, which are reduced by the placed domains.
+ */
+Placement place_domains(std::vector<Domain_demand> domains, std::vector<Host_resources> &hosts, const std::string &mode, bool overbooking);
+
+/**
+ * \brief Migration of a domain planned by plan_consolidation.
+ */
+struct Consolidation_move
+{
+	Domain_demand domain;
+	std::string source;
+	std::string destination;
+};
+
+/**
+ * \brief Migrations which consolidate the domains of several hosts onto fewer hosts.
+ */
+struct Consolidation_plan
+{
+	std::vector<Consolidation_move> moves;
+	// Hosts without active domains after all moves.
+	std::vector<std::string> freed_hosts;
+
+	std::string str() const;
+};
+
+/**
+ * \brief Plan migrations which empty as many hosts as possible.
+ *
+ * Hosts are tried in order of increasing load. A host is emptied if all of its domains can be packed
+ * onto the remaining hosts (see place_domains), which are thereby kept and not emptied anymore.
+ * Hosts without domains are neither used as destination nor reported as freed.
+ */
+Consolidation_plan plan_consolidation(std::vector<Host_resources> hosts, bool overbooking);
+
+/**
+ * \brief Migration or swap migration planned by plan_rebalance.
+ */
+struct Rebalance_action
+{
+	Domain_demand domain;
+	std::string source;
+	std::string destination;
+	// Domain on the destination to swap with (empty name for a plain migration).
+	Domain_demand swap_with;
+};
+
+/**
+ * \brief Migrations which bring the cpu utilization of hosts under a target.
+ */
+struct Rebalance_plan
+{
+	std::vector<Rebalance_action> actions;
+	// Hosts which remain above the target after all actions.
+	std::vector<std::string> overloaded_hosts;
+
+	std::string str() const;
+};
+
+/**
+ * \brief Plan few migrations which bring the utilization of all hosts under target.
+ *
+ * The utilization of a host is the measured cpu usage of its domains divided by its cpus.
+ * The most utilized host is relieved first, preferably by the smallest domain which suffices
+ * on its own, else by the domain with the largest cpu usage. If no domain fits on another host
+ * and swap is enabled, a domain is swapped with a less busy domain of another host.
+ * Swaps only require the memory which is freed by the swapped domains, since swap migration
+ * falls back to staging through snapshots. Each domain is moved at most once.
+ * Memory freed by migrations is not reused, so that the actions may be executed in any order.
+ */
+Rebalance_plan plan_rebalance(std::vector<Host_resources> hosts, double target, bool swap, bool overbooking);
+
+#endif
@@ -63,15 +63,15 @@ void Ponci_hypervisor::stop(const fast::msg::migfra::Stop &task, fast::msg::migf
 
 }
 
-void Ponci_hypervisor::migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm)
+void Ponci_hypervisor::migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm, Task_report &report)
 {
-	(void) task; (void) time_measurement; (void) comm;
+	(void) task; (void) time_measurement; (void) comm; (void) report;
 	throw std::runtime_error("Ponci_hypervisor has no support for migrations.");
 }
 
-void Ponci_hypervisor::evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm)
+void Ponci_hypervisor::evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm, Task_report &report)
 {
-	(void) task; (void) time_measurement; (void) comm;
+	(void) task; (void) time_measurement; (void) comm; (void) report;
 	throw std::runtime_error("Ponci_hypervisor has no support for evacuation.");
 }
 
@@ -94,6 +94,44 @@ void Ponci_hypervisor::repin(const fast::msg::migfra::Repin &task, fast::msg::mi
 	}
 }
 
+void Ponci_hypervisor::repin_threads(const Repin_threads &task, fast::msg::migfra::Time_measurement &time_measurement)
+{
+	auto cgroup_name = task.vm_name;
+	if (task.emulator_map.is_valid() || task.iothread_map.is_valid())
+		throw std::runtime_error("Ponci_hypervisor has no support for repinning emulator threads or iothreads.");
+
+	// Set cpus if given
+	if (task.vcpu_map.is_valid()) {
+		auto &cpu_map = task.vcpu_map.get();
+
+		// Check if more than one map is provided
+		if (cpu_map.size() != 1)
+			throw std::runtime_error("Ponci_hypervisor only supports one dimensional cpu maps.");
+
+		std::vector<size_t> cpus(cpu_map[0].begin(), cpu_map[0].end());
+		time_measurement.tick("repin-vcpus");
+		try {
+			cgroup_set_cpus(cgroup_name, cpus);
+		} catch (const std::exception &e) {
+			throw std::runtime_error("Exception while setting cpus: " + std::string(e.what()));
+		}
+		time_measurement.tock("repin-vcpus");
+	}
+
+	// Set memory nodes and migrate pages to them if given
+	if (task.memnode_map.is_valid()) {
+		std::vector<size_t> memnodes(task.memnode_map.get().begin(), task.memnode_map.get().end());
+		time_measurement.tick("repin-memory");
+		try {
+			cgroup_set_memory_migrate(cgroup_name, 1);
+			cgroup_set_mems(cgroup_name, memnodes);
+		} catch (const std::exception &e) {
+			throw std::runtime_error("Exception while setting memory nodes: " + std::string(e.what()));
+		}
+		time_measurement.tock("repin-memory");
+	}
+}
+
 void Ponci_hypervisor::suspend(const fast::msg::migfra::Suspend &task, fast::msg::migfra::Time_measurement &time_measurement)
 {
 	(void) time_measurement;
@@ -121,8 +159,27 @@ void Ponci_hypervisor::resume(const fast::msg::migfra::Resume &task, fast::msg::
 	}
 }
 
-std::vector<std::shared_ptr<fast::msg::migfra::Task>> Ponci_hypervisor::get_evacuate_tasks(const fast::msg::migfra::Task_container &task_cont)
+std::vector<std::shared_ptr<fast::msg::migfra::Task>> Ponci_hypervisor::get_evacuate_tasks(const fast::msg::migfra::Task_container &task_cont, std::shared_ptr<fast::Communicator> comm)
 {
 	(void) task_cont;
+	(void) comm;
 	throw std::runtime_error("Ponci_hypervisor has no support for evacuation.");
 }
+
+void Ponci_hypervisor::consolidate(const Consolidate &task, std::shared_ptr<fast::Communicator> comm, Consolidation_result &result)
+{
+	(void) task; (void) comm; (void) result;
+	throw std::runtime_error("Ponci_hypervisor has no support for consolidation.");
+}
+
+void Ponci_hypervisor::rebalance(const Rebalance &task, std::shared_ptr<fast::Communicator> comm, Rebalance_result &result)
+{
+	(void) task; (void) comm; (void) result;
+	throw std::runtime_error("Ponci_hypervisor has no support for rebalancing.");
+}
+
+void Ponci_hypervisor::permute(const Permute &task, std::shared_ptr<fast::Communicator> comm, Permutation_result &result)
+{
+	(void) task; (void) comm; (void) result;
+	throw std::runtime_error("Ponci_hypervisor has no support for permutation.");
+}
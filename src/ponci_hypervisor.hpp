@@ -36,15 +36,22 @@ public:
 	/**
 	 * \brief Method not supported.
 	 */
-	void migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm) override;
+	void migrate(const fast::msg::migfra::Migrate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm, Task_report &report) override;
 	/**
  	 * \brief Method to evacuate a host.
  	 */
-	void evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm) override;
+	void evacuate(const fast::msg::migfra::Evacuate &task, fast::msg::migfra::Time_measurement &time_measurement, std::shared_ptr<fast::Communicator> comm, Task_report &report) override;
 	/**
 	 * \brief Method to set cpus of a cgroup.
 	 */
 	void repin(const fast::msg::migfra::Repin &task, fast::msg::migfra::Time_measurement &time_measurement) override;
+	/**
+	 * \brief Method to set cpus and memory nodes of a cgroup.
+	 *
+	 * Memory is migrated to the new nodes using memory_migrate of the cpuset controller.
+	 * Emulator threads and iothreads are not supported.
+	 */
+	void repin_threads(const Repin_threads &task, fast::msg::migfra::Time_measurement &time_measurement) override;
 	/**
 	 * \brief Method to freeze a cgroup.
 	 */
@@ -56,7 +63,19 @@ public:
 	/**
  	 * \brief Method to generate a task list for Evacuate.
  	 */
-	std::vector<std::shared_ptr<fast::msg::migfra::Task>> get_evacuate_tasks(const fast::msg::migfra::Task_container &task_cont) override;
+	std::vector<std::shared_ptr<fast::msg::migfra::Task>> get_evacuate_tasks(const fast::msg::migfra::Task_container &task_cont, std::shared_ptr<fast::Communicator> comm) override;
+	/**
+	 * \brief Method to consolidate hosts. Not supported.
+	 */
+	void consolidate(const Consolidate &task, std::shared_ptr<fast::Communicator> comm, Consolidation_result &result) override;
+	/**
+	 * \brief Method to rebalance hosts. Not supported.
+	 */
+	void rebalance(const Rebalance &task, std::shared_ptr<fast::Communicator> comm, Rebalance_result &result) override;
+	/**
+	 * \brief Method to permute domains. Not supported.
+	 */
+	void permute(const Permute &task, std::shared_ptr<fast::Communicator> comm, Permutation_result &result) override;
 };
 
 #endif
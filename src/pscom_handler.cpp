@@ -1,5 +1,7 @@
 #include "pscom_handler.hpp"
 
+#include "utility.hpp"
+
 #include <stdexcept>
 #include <regex>
 
@@ -143,14 +145,14 @@ void Pscom_handler::set_qos(int qos)
 void Pscom_handler::suspend()
 {
 	if (messages_expected > 0) {
-		time_measurement.tick("pscom-suspend-" + vm_name);
+		tick_synchronized(time_measurement, "pscom-suspend-" + vm_name);
 		std::string msg = "suspend";
 		// publish suspend request
 		comm->send_message(msg, request_topic, qos);
 		// wait for termination
 		for (answers = 0; answers != messages_expected; ++answers)
 			comm->get_message(response_topic, std::chrono::seconds(10));
-		time_measurement.tock("pscom-suspend-" + vm_name);
+		tock_synchronized(time_measurement, "pscom-suspend-" + vm_name);
 	}
 }
 
@@ -158,7 +160,7 @@ void Pscom_handler::resume()
 {
 	// only try to resume if pscom is suspended
 	if (answers == messages_expected && messages_expected > 0) {
-		time_measurement.tick("pscom-resume-" + vm_name);
+		tick_synchronized(time_measurement, "pscom-resume-" + vm_name);
 		std::string msg = "resume";
 		// publish resume request
 		comm->send_message(msg, request_topic, qos);
@@ -167,6 +169,6 @@ void Pscom_handler::resume()
 			comm->get_message(response_topic, std::chrono::seconds(10));
 		// reset answers counter
 		answers = 0;
-		time_measurement.tock("pscom-resume-" + vm_name);
+		tock_synchronized(time_measurement, "pscom-resume-" + vm_name);
 	}
 }
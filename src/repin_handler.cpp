@@ -51,16 +51,21 @@ void Repin_guard::set_destination_domain(std::shared_ptr<virDomain> dest_domain)
 	domain = dest_domain;
 }
 
+bool Repin_guard::repin_required() const
+{
+	return vcpu_map.is_valid();
+}
+
 void Repin_guard::repin()
 {
 	if (vcpu_map.is_valid()) {
-		time_measurement.tick("repin" + tag_postfix);
+		tick_synchronized(time_measurement, "repin" + tag_postfix);
 		if (!std::uncaught_exception()) {
 			FASTLIB_LOG(repin_guard_log, trace) << "Repin vcpus.";
 			repin_vcpus(domain.get(), vcpu_map.get());
 		}
 		resume_domain(domain.get());
-		time_measurement.tock("repin" + tag_postfix);
+		tock_synchronized(time_measurement, "repin" + tag_postfix);
 	}
 }
 
@@ -31,6 +31,7 @@ public:
 	~Repin_guard() noexcept(false);
 
 	void set_destination_domain(std::shared_ptr<virDomain> dest_domain);
+	bool repin_required() const;
 	void repin();
 private:
 	std::shared_ptr<virDomain> domain;
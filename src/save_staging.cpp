@@ -0,0 +1,158 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "save_staging.hpp"
+
+#include "utility.hpp"
+
+#include <fast-lib/log.hpp>
+#include <libvirt/virterror.h>
+#include <linux/magic.h>
+
+#include <stdexcept>
+
+using namespace fast::msg::migfra;
+
+FASTLIB_LOG_INIT(save_staging_log, "Save_staging_guard")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(save_staging_log, trace);
+
+// Quote argument for the shell. Paths are validated to consist of safe file names only.
+static std::string quote(const std::string &arg)
+{
+	return "'" + arg + "'";
+}
+
+// Check if all components of path are safe file names (see is_safe_file_name).
+static bool is_safe_path(const std::string &path)
+{
+	size_t begin = path.front() == '/' ? 1 : 0;
+	while (begin < path.size()) {
+		auto end = path.find('/', begin);
+		if (end == std::string::npos)
+			end = path.size();
+		if (end != begin && !is_safe_file_name(path.substr(begin, end - begin)))
+			return false;
+		begin = end + 1;
+	}
+	return true;
+}
+
+// Check if path on host is on tmpfs, which does not support O_DIRECT before Linux 6.6.
+// The file system type is read by statfs using stat -f.
+static bool is_tmpfs(const std::string &host, const std::string &path)
+{
+	auto output = execute_remote(host, "stat -f -c %t " + quote(path));
+	try {
+		return std::stoul(output, nullptr, 16) == TMPFS_MAGIC;
+	} catch (const std::exception &) {
+		throw std::runtime_error("Unexpected file system type of " + path + " on " + host + ": " + output);
+	}
+}
+
+// Bypass the page cache unless the image is on tmpfs, i.e., in memory anyway.
+static unsigned int get_cache_flags(const std::string &host, const std::string &path)
+{
+	if (is_tmpfs(host, path)) {
+		FASTLIB_LOG(save_staging_log, trace) << path << " on " << host << " is on tmpfs. Do not bypass cache.";
+		return 0;
+	}
+	return VIR_DOMAIN_SAVE_BYPASS_CACHE;
+}
+
+//
+// Save_staging_guard implementation
+//
+
+Save_staging_guard::Save_staging_guard(std::shared_ptr<virDomain> domain,
+		std::string source_host,
+		std::string staging_path,
+		bool shared_path,
+		Time_measurement &time_measurement,
+		std::string tag_postfix) :
+	domain(domain),
+	source_host(std::move(source_host)),
+	staging_path(std::move(staging_path)),
+	shared_path(shared_path),
+	time_measurement(time_measurement),
+	tag_postfix(std::move(tag_postfix))
+{
+	if (this->tag_postfix != "")
+		this->tag_postfix = "-" + this->tag_postfix;
+	if (this->staging_path.empty() || !is_safe_path(this->staging_path))
+		throw std::invalid_argument("Staging path " + this->staging_path + " must consist of letters, digits, '.', '_', '+' and '-' only.");
+	auto name = virDomainGetName(domain.get());
+	if (!name)
+		throw std::runtime_error(std::string("Error getting domain name: ") + virGetLastErrorMessage());
+	std::string domain_name(name);
+	if (!is_safe_file_name(domain_name))
+		throw std::invalid_argument("Domain name " + domain_name + " is not usable in a staging image path.");
+	image = this->staging_path + "/" + domain_name + ".save";
+	tick_synchronized(time_measurement, "save" + this->tag_postfix);
+	execute_remote(this->source_host, "mkdir -p " + quote(this->staging_path));
+	source_cache_flags = get_cache_flags(this->source_host, this->staging_path);
+	FASTLIB_LOG(save_staging_log, trace) << "Save domain to " << image << " on " << this->source_host << ".";
+	if (virDomainSaveFlags(domain.get(), image.c_str(), nullptr, source_cache_flags) == -1)
+		throw std::runtime_error(std::string("Error saving domain: ") + virGetLastErrorMessage());
+	tock_synchronized(time_measurement, "save" + this->tag_postfix);
+}
+
+Save_staging_guard::~Save_staging_guard() noexcept(false)
+{
+	try {
+		if (!restored) {
+			FASTLIB_LOG(save_staging_log, warn) << "Domain was not restored on destination. Restore on " << source_host << ".";
+			auto conn = virDomainGetConnect(domain.get());
+			if (virDomainRestoreFlags(conn, image.c_str(), nullptr, source_cache_flags | VIR_DOMAIN_SAVE_RUNNING) == -1)
+				throw std::runtime_error(std::string("Error restoring domain on source: ") + virGetLastErrorMessage());
+		}
+		remove_images();
+	} catch (...) {
+		// Only log exception when unwinding stack, else rethrow exception.
+		if (std::uncaught_exception())
+			FASTLIB_LOG(save_staging_log, trace) << "Exception while cleaning up staged domain.";
+		else
+			throw;
+	}
+}
+
+void Save_staging_guard::transfer(const std::string &dest_host)
+{
+	this->dest_host = dest_host;
+	if (shared_path) {
+		FASTLIB_LOG(save_staging_log, trace) << "Staging path is shared. Skip transfer.";
+		return;
+	}
+	tick_synchronized(time_measurement, "transfer" + tag_postfix);
+	FASTLIB_LOG(save_staging_log, trace) << "Stream " << image << " from " << source_host << " to " << dest_host << ".";
+	stream_remote(source_host, "cat " + quote(image), dest_host, "mkdir -p " + quote(staging_path) + " && cat > " + quote(image));
+	tock_synchronized(time_measurement, "transfer" + tag_postfix);
+}
+
+std::shared_ptr<virDomain> Save_staging_guard::restore(virConnectPtr dest_conn, bool paused)
+{
+	if (dest_host == "")
+		throw std::logic_error("Staged domain has to be transferred before restore.");
+	tick_synchronized(time_measurement, "restore" + tag_postfix);
+	unsigned int flags = get_cache_flags(dest_host, staging_path) | (paused ? VIR_DOMAIN_SAVE_PAUSED : VIR_DOMAIN_SAVE_RUNNING);
+	if (virDomainRestoreFlags(dest_conn, image.c_str(), nullptr, flags) == -1)
+		throw std::runtime_error(std::string("Error restoring domain on destination: ") + virGetLastErrorMessage());
+	restored = true;
+	std::shared_ptr<virDomain> dest_domain(virDomainLookupByName(dest_conn, virDomainGetName(domain.get())), Deleter_virDomain());
+	if (!dest_domain)
+		throw std::runtime_error(std::string("Error looking up restored domain: ") + virGetLastErrorMessage());
+	tock_synchronized(time_measurement, "restore" + tag_postfix);
+	return dest_domain;
+}
+
+void Save_staging_guard::remove_images()
+{
+	FASTLIB_LOG(save_staging_log, trace) << "Remove staging images.";
+	execute_remote(source_host, "rm -f " + quote(image));
+	if (!shared_path && dest_host != "" && dest_host != source_host)
+		execute_remote(dest_host, "rm -f " + quote(image));
+}
@@ -0,0 +1,62 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef SAVE_STAGING_HPP
+#define SAVE_STAGING_HPP
+
+#include <fast-lib/message/migfra/time_measurement.hpp>
+
+#include <libvirt/libvirt.h>
+
+#include <memory>
+#include <string>
+
+// RAII-guard to stage a domain through a save image instead of an internal snapshot.
+// The constructor saves the memory of the domain to an image in the staging path on its host (virDomainSaveFlags),
+// which stops the domain and frees its memory. The image is streamed to the destination and restored there.
+// If the domain was not restored on the destination, the destructor restores it on its source host.
+// Images are removed in destructor.
+class Save_staging_guard
+{
+public:
+	/**
+	 * \param source_host The host the domain runs on, used to execute commands with ssh.
+	 * \param staging_path A directory on fast storage, e.g., tmpfs, NVMe or a parallel file system.
+	 * \param shared_path True if the staging path is shared by all hosts, so that no transfer is required.
+	 */
+	Save_staging_guard(std::shared_ptr<virDomain> domain,
+			std::string source_host,
+			std::string staging_path,
+			bool shared_path,
+			fast::msg::migfra::Time_measurement &time_measurement,
+			std::string tag_postfix = "");
+	~Save_staging_guard() noexcept(false);
+	Save_staging_guard(const Save_staging_guard &) = delete;
+	Save_staging_guard & operator=(const Save_staging_guard &) = delete;
+
+	// Stream the image from the source to dest_host (skipped if the staging path is shared).
+	void transfer(const std::string &dest_host);
+	// Restore the domain on the destination. The destination domain is returned.
+	std::shared_ptr<virDomain> restore(virConnectPtr dest_conn, bool paused);
+private:
+	void remove_images();
+
+	std::shared_ptr<virDomain> domain;
+	std::string source_host;
+	std::string dest_host;
+	std::string staging_path;
+	std::string image;
+	bool shared_path;
+	bool restored = false;
+	// Flags to save and restore the image on the source (VIR_DOMAIN_SAVE_BYPASS_CACHE unless on tmpfs)
+	unsigned int source_cache_flags = 0;
+	fast::msg::migfra::Time_measurement &time_measurement;
+	std::string tag_postfix;
+};
+
+#endif
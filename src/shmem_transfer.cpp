@@ -0,0 +1,383 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "shmem_transfer.hpp"
+
+#include "utility.hpp"
+
+#include <fast-lib/log.hpp>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+using namespace fast::msg::migfra;
+
+FASTLIB_LOG_INIT(shmem_transfer_log, "Shmem_transfer")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(shmem_transfer_log, trace);
+
+// Quote argument for the shell. Names are validated to be safe file names.
+static std::string quote(const std::string &arg)
+{
+	return "'" + arg + "'";
+}
+
+std::string errno_str()
+{
+	return std::strerror(errno);
+}
+
+// Read-only file descriptor which is closed on destruction.
+struct Read_only_file
+{
+	explicit Read_only_file(const std::string &path) :
+		fd(open(path.c_str(), O_RDONLY | O_CLOEXEC))
+	{
+		if (fd == -1)
+			throw std::runtime_error("Could not open " + path + ": " + errno_str());
+	}
+	~Read_only_file()
+	{
+		close(fd);
+	}
+	Read_only_file(const Read_only_file &) = delete;
+	Read_only_file & operator=(const Read_only_file &) = delete;
+
+	int fd;
+};
+
+// Ssh process executing a command on a host which reads the data written to fd from its stdin.
+// The process is terminated on destruction if finish() was not called.
+class Ssh_pipe
+{
+public:
+	Ssh_pipe(const std::string &host, const std::string &command)
+	{
+		int fds[2];
+		if (pipe2(fds, O_CLOEXEC) == -1)
+			throw std::runtime_error("Could not create pipe: " + errno_str());
+		// Prepare arguments before fork, since only async-signal-safe functions may be called in the child.
+		std::vector<std::string> args{"ssh", "-o", "BatchMode=yes", host, command};
+		std::vector<char *> argv;
+		for (auto &arg : args)
+			argv.push_back(&arg[0]);
+		argv.push_back(nullptr);
+		pid = fork();
+		if (pid == -1) {
+			auto error = errno_str();
+			close(fds[0]);
+			close(fds[1]);
+			throw std::runtime_error("Could not fork ssh: " + error);
+		}
+		if (pid == 0) {
+			// dup2 clears close-on-exec of stdin only.
+			if (dup2(fds[0], STDIN_FILENO) == -1)
+				_exit(127);
+			execvp(argv[0], argv.data());
+			_exit(127);
+		}
+		close(fds[0]);
+		fd = fds[1];
+	}
+	~Ssh_pipe()
+	{
+		if (fd != -1)
+			close(fd);
+		if (pid != -1) {
+			kill(pid, SIGTERM);
+			waitpid(pid, nullptr, 0);
+		}
+	}
+	Ssh_pipe(const Ssh_pipe &) = delete;
+	Ssh_pipe & operator=(const Ssh_pipe &) = delete;
+
+	// Close stdin of ssh and wait for the command to exit. Throws if it failed.
+	void finish()
+	{
+		close(fd);
+		fd = -1;
+		int status;
+		while (waitpid(pid, &status, 0) == -1) {
+			if (errno != EINTR)
+				throw std::runtime_error("Error waiting for ssh: " + errno_str());
+		}
+		pid = -1;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			throw std::runtime_error("Streaming via ssh failed with status " + std::to_string(WIFEXITED(status) ? WEXITSTATUS(status) : -1) + ".");
+	}
+
+	int fd = -1;
+private:
+	pid_t pid = -1;
+};
+
+// Blocks SIGPIPE in the calling thread, so that writing to a pipe of an exited ssh fails with EPIPE
+// instead of terminating the process. SIGPIPE raised meanwhile is discarded on destruction.
+class Sigpipe_guard
+{
+public:
+	Sigpipe_guard()
+	{
+		sigemptyset(&sigpipe);
+		sigaddset(&sigpipe, SIGPIPE);
+		pthread_sigmask(SIG_BLOCK, &sigpipe, &old_mask);
+	}
+	~Sigpipe_guard()
+	{
+		timespec no_wait{0, 0};
+		while (sigtimedwait(&sigpipe, nullptr, &no_wait) > 0)
+			;
+		pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+	}
+	Sigpipe_guard(const Sigpipe_guard &) = delete;
+	Sigpipe_guard & operator=(const Sigpipe_guard &) = delete;
+private:
+	sigset_t sigpipe;
+	sigset_t old_mask;
+};
+
+void write_all(int fd, const char *data, size_t size)
+{
+	while (size != 0) {
+		auto ret = write(fd, data, size);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error("Error writing to ssh: " + errno_str());
+		}
+		data += ret;
+		size -= ret;
+	}
+}
+
+void read_all(int fd, char *data, size_t size, off_t offset)
+{
+	while (size != 0) {
+		auto ret = pread(fd, data, size, offset);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error("Error reading shared memory region: " + errno_str());
+		}
+		if (ret == 0)
+			throw std::runtime_error("Shared memory region was truncated while reading.");
+		data += ret;
+		size -= ret;
+		offset += ret;
+	}
+}
+
+// Move a range of the file into the pipe without copying it to user space.
+void splice_range(int file_fd, loff_t offset, size_t length, int pipe_fd)
+{
+	while (length != 0) {
+		auto ret = splice(file_fd, &offset, pipe_fd, nullptr, length, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error("Error splicing shared memory region to ssh: " + errno_str());
+		}
+		if (ret == 0)
+			throw std::runtime_error("Shared memory region was truncated while splicing.");
+		length -= ret;
+	}
+}
+
+// Hash to detect changes of a page. Words are mixed by multiplication and rotation.
+uint64_t hash_page(const char *page, size_t size)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t word;
+		std::memcpy(&word, page + i, sizeof(word));
+		hash = (hash ^ word) * 0x100000001b3ULL;
+		hash = (hash << 31) | (hash >> 33);
+	}
+	return hash;
+}
+
+size_t get_page_size()
+{
+	return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// Pages are read and sent in chunks of this size by precopy().
+const size_t precopy_chunk_size = 4 << 20;
+
+//
+// Shmem_transfer implementation
+//
+
+Shmem_transfer::Shmem_transfer(std::string name,
+		std::string source_host,
+		std::string dest_host,
+		bool dirty_tracking,
+		Time_measurement &time_measurement,
+		std::string tag_postfix) :
+	name(std::move(name)),
+	source_host(std::move(source_host)),
+	dest_host(std::move(dest_host)),
+	dirty_tracking(dirty_tracking),
+	time_measurement(time_measurement),
+	tag_postfix(std::move(tag_postfix))
+{
+	if (this->tag_postfix != "")
+		this->tag_postfix = "-" + this->tag_postfix;
+	if (!is_safe_file_name(this->name))
+		throw std::invalid_argument("Invalid name of ivshmem device for transfer: " + this->name);
+	path = "/dev/shm/" + this->name;
+	if (is_local()) {
+		struct stat file_stat;
+		if (stat(path.c_str(), &file_stat) == -1)
+			throw std::runtime_error("Could not find backing file of ivshmem device " + this->name + ": " + errno_str());
+		region_size = file_stat.st_size;
+	} else {
+		region_size = std::stoull(execute_remote(this->source_host, "stat -c %s " + quote(path)));
+	}
+}
+
+bool Shmem_transfer::is_local() const
+{
+	return source_host.empty() || source_host == get_hostname();
+}
+
+void Shmem_transfer::precopy()
+{
+	if (!dirty_tracking)
+		return;
+	auto page_size = get_page_size();
+	if (!is_local() || region_size == 0 || region_size % page_size != 0) {
+		FASTLIB_LOG(shmem_transfer_log, trace) << "Dirty tracking of " << path << " on " << source_host << " is not supported. Skip pre-copy.";
+		return;
+	}
+	const auto tag = "precopy-ivshmem-" + name + tag_postfix;
+	tick_synchronized(time_measurement, tag);
+	FASTLIB_LOG(shmem_transfer_log, trace) << "Pre-copy " << path << " (" << region_size << " bytes) to " << dest_host << ".";
+	Read_only_file file(path);
+	Ssh_pipe ssh(dest_host, "cat > " + quote(path));
+	Sigpipe_guard sigpipe_guard;
+	// The region is still written, so pages are copied once to hash exactly the contents which are sent.
+	std::vector<char> buffer(precopy_chunk_size);
+	std::vector<uint64_t> hashes;
+	hashes.reserve(region_size / page_size);
+	for (unsigned long long offset = 0; offset != region_size;) {
+		auto count = static_cast<size_t>(std::min<unsigned long long>(buffer.size(), region_size - offset));
+		read_all(file.fd, buffer.data(), count, offset);
+		for (size_t page = 0; page < count; page += page_size)
+			hashes.push_back(hash_page(buffer.data() + page, page_size));
+		write_all(ssh.fd, buffer.data(), count);
+		offset += count;
+	}
+	ssh.finish();
+	page_hashes = std::move(hashes);
+	tock_synchronized(time_measurement, tag);
+}
+
+void Shmem_transfer::transfer()
+{
+	const auto tag = "transfer-ivshmem-" + name + tag_postfix;
+	tick_synchronized(time_measurement, tag);
+	auto start = std::chrono::steady_clock::now();
+	if (!is_local()) {
+		transfer_remote();
+	} else if (!page_hashes.empty()) {
+		transfer_dirty_pages();
+	} else {
+		FASTLIB_LOG(shmem_transfer_log, trace) << "Stream " << path << " (" << region_size << " bytes) to " << dest_host << ".";
+		Read_only_file file(path);
+		Ssh_pipe ssh(dest_host, "cat > " + quote(path));
+		{
+			Sigpipe_guard sigpipe_guard;
+			splice_range(file.fd, 0, region_size, ssh.fd);
+		}
+		ssh.finish();
+		bytes_sent = region_size;
+	}
+	std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+	throughput = (bytes_sent != 0 && duration.count() > 0) ? bytes_sent / duration.count() : 0;
+	tock_synchronized(time_measurement, tag);
+	FASTLIB_LOG(shmem_transfer_log, trace) << "Sent " << bytes_sent << " of " << region_size << " bytes of " << path
+		<< " at " << throughput / 1e6 << " MB/s.";
+}
+
+void Shmem_transfer::transfer_remote()
+{
+	FASTLIB_LOG(shmem_transfer_log, trace) << "Stream " << path << " from " << source_host << " to " << dest_host << ".";
+	stream_remote(source_host, "cat " + quote(path), dest_host, "cat > " + quote(path));
+	bytes_sent = region_size;
+}
+
+void Shmem_transfer::transfer_dirty_pages()
+{
+	auto page_size = get_page_size();
+	Read_only_file file(path);
+	// Hash pages in place, since the region is not written anymore.
+	auto mapping = static_cast<const char *>(mmap(nullptr, region_size, PROT_READ, MAP_SHARED, file.fd, 0));
+	if (mapping == MAP_FAILED)
+		throw std::runtime_error("Could not map " + path + ": " + errno_str());
+	// Ranges of consecutive changed pages as first page and page count.
+	std::vector<std::pair<size_t, size_t>> ranges;
+	for (size_t page = 0; page != page_hashes.size(); ++page) {
+		if (hash_page(mapping + page * page_size, page_size) == page_hashes[page])
+			continue;
+		if (!ranges.empty() && ranges.back().first + ranges.back().second == page)
+			++ranges.back().second;
+		else
+			ranges.emplace_back(page, 1);
+	}
+	munmap(const_cast<char *>(mapping), region_size);
+	bytes_sent = 0;
+	if (ranges.empty()) {
+		FASTLIB_LOG(shmem_transfer_log, trace) << "No pages of " << path << " changed since pre-copy.";
+		return;
+	}
+	FASTLIB_LOG(shmem_transfer_log, trace) << "Stream " << ranges.size() << " ranges of changed pages of " << path << " to " << dest_host << ".";
+	// Each range is preceded by a line with its first page and page count, which is read by the shell before dd copies the pages.
+	Ssh_pipe ssh(dest_host, "while read page count; do dd of=" + quote(path) + " bs=" + std::to_string(page_size) +
+			" seek=$page count=$count iflag=fullblock conv=notrunc status=none || exit 1; done");
+	{
+		Sigpipe_guard sigpipe_guard;
+		for (const auto &range : ranges) {
+			auto header = std::to_string(range.first) + " " + std::to_string(range.second) + "\n";
+			write_all(ssh.fd, header.data(), header.size());
+			splice_range(file.fd, range.first * page_size, range.second * page_size, ssh.fd);
+			bytes_sent += range.second * page_size;
+		}
+	}
+	ssh.finish();
+}
+
+const std::string & Shmem_transfer::get_name() const
+{
+	return name;
+}
+
+unsigned long long Shmem_transfer::get_region_size() const
+{
+	return region_size;
+}
+
+unsigned long long Shmem_transfer::get_bytes_sent() const
+{
+	return bytes_sent;
+}
+
+double Shmem_transfer::get_throughput() const
+{
+	return throughput;
+}
@@ -0,0 +1,85 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef SHMEM_TRANSFER_HPP
+#define SHMEM_TRANSFER_HPP
+
+#include <fast-lib/message/migfra/time_measurement.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * \brief Streams the backing file of an ivshmem device, /dev/shm/<name>, to the same path on another host.
+ *
+ * If the region is on the local host, it is spliced into the stdin of ssh without being copied to user space.
+ * Otherwise it is streamed through ssh connections to the source and destination host.
+ * With dirty tracking, precopy() sends the region while it is still in use and remembers a hash of each page.
+ * After the device was detached, transfer() sends only the pages whose contents changed since.
+ * Dirty tracking requires a local region whose size is a multiple of the page size, else the whole region is sent.
+ * A file of the same name on the destination is overwritten. The name has to be a safe file name (see is_safe_file_name).
+ */
+class Shmem_transfer
+{
+public:
+	/**
+	 * \param source_host The host of the region or "" for the local host.
+	 */
+	Shmem_transfer(std::string name,
+			std::string source_host,
+			std::string dest_host,
+			bool dirty_tracking,
+			fast::msg::migfra::Time_measurement &time_measurement,
+			std::string tag_postfix = "");
+	Shmem_transfer(const Shmem_transfer &) = delete;
+	Shmem_transfer & operator=(const Shmem_transfer &) = delete;
+
+	/**
+	 * \brief Send the whole region while it is in use (skipped without dirty tracking).
+	 *
+	 * Measured with the tag "precopy-ivshmem-<name><tag_postfix>".
+	 */
+	void precopy();
+	/**
+	 * \brief Send the region or the pages changed since precopy(). The region must not be written anymore.
+	 *
+	 * Measured with the tag "transfer-ivshmem-<name><tag_postfix>".
+	 */
+	void transfer();
+
+	const std::string & get_name() const;
+	unsigned long long get_region_size() const;
+	/**
+	 * \brief Bytes sent by transfer(), i.e., during switchover.
+	 */
+	unsigned long long get_bytes_sent() const;
+	/**
+	 * \brief Bytes per second achieved by transfer() or 0 if nothing was sent.
+	 */
+	double get_throughput() const;
+private:
+	bool is_local() const;
+	void transfer_remote();
+	void transfer_dirty_pages();
+
+	std::string name;
+	std::string path;
+	std::string source_host;
+	std::string dest_host;
+	bool dirty_tracking;
+	fast::msg::migfra::Time_measurement &time_measurement;
+	std::string tag_postfix;
+	unsigned long long region_size = 0;
+	unsigned long long bytes_sent = 0;
+	double throughput = 0;
+	// Hashes of the pages sent by precopy() (empty if not precopied).
+	std::vector<uint64_t> page_hashes;
+};
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "step_graph.hpp"
+
+#include <fast-lib/log.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+
+FASTLIB_LOG_INIT(step_graph_log, "Step_graph")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(step_graph_log, trace);
+
+void Step_graph::add_step(std::string name, std::vector<std::string> dependencies, std::function<void()> action)
+{
+	for (const auto &step : steps) {
+		if (step.name == name)
+			throw std::logic_error("Step " + name + " is already defined.");
+	}
+	Step step;
+	step.name = std::move(name);
+	step.dependency_names = std::move(dependencies);
+	step.action = std::move(action);
+	steps.push_back(std::move(step));
+}
+
+void Step_graph::resolve_dependencies()
+{
+	for (auto &step : steps) {
+		step.dependencies.clear();
+		for (const auto &dependency_name : step.dependency_names) {
+			auto it = std::find_if(steps.begin(), steps.end(),
+					[&dependency_name](const Step &s){return s.name == dependency_name;});
+			if (it == steps.end())
+				throw std::logic_error("Step " + step.name + " depends on unknown step " + dependency_name + ".");
+			step.dependencies.push_back(it - steps.begin());
+		}
+		step.started = false;
+		step.done = false;
+		step.has_enabler = false;
+	}
+}
+
+bool Step_graph::is_ready(const Step &step) const
+{
+	return std::all_of(step.dependencies.begin(), step.dependencies.end(),
+			[this](size_t dependency){return steps[dependency].done;});
+}
+
+void Step_graph::run()
+{
+	resolve_dependencies();
+	std::mutex steps_mutex;
+	std::condition_variable steps_cv;
+	std::exception_ptr error;
+	size_t running = 0;
+	std::vector<std::future<void>> handles;
+	std::unique_lock<std::mutex> lock(steps_mutex);
+	while (true) {
+		// Start all steps which are ready. Skipped steps are done immediately and may make others ready.
+		bool progress = !error;
+		while (progress) {
+			progress = false;
+			for (size_t i = 0; i != steps.size(); ++i) {
+				auto &step = steps[i];
+				if (step.started || !is_ready(step))
+					continue;
+				step.started = true;
+				for (auto dependency : step.dependencies) {
+					if (!step.has_enabler || steps[dependency].finish > steps[step.enabled_by].finish) {
+						step.enabled_by = dependency;
+						step.has_enabler = true;
+					}
+				}
+				if (!step.action) {
+					FASTLIB_LOG(step_graph_log, trace) << "Skip step " << step.name << ".";
+					step.done = true;
+					step.finish = clock::now();
+					progress = true;
+					continue;
+				}
+				FASTLIB_LOG(step_graph_log, trace) << "Start step " << step.name << ".";
+				++running;
+				handles.push_back(std::async(std::launch::async, [this, i, &steps_mutex, &steps_cv, &error, &running]
+				{
+					std::exception_ptr step_error;
+					try {
+						steps[i].action();
+					} catch (...) {
+						step_error = std::current_exception();
+					}
+					std::lock_guard<std::mutex> lock(steps_mutex);
+					steps[i].finish = clock::now();
+					if (step_error) {
+						FASTLIB_LOG(step_graph_log, trace) << "Step " << steps[i].name << " failed.";
+						if (!error)
+							error = step_error;
+					} else {
+						steps[i].done = true;
+					}
+					--running;
+					steps_cv.notify_one();
+				}));
+			}
+		}
+		if (running == 0)
+			break;
+		steps_cv.wait(lock);
+	}
+	lock.unlock();
+	// Wait for threads to release their futures before evaluating the results.
+	for (auto &handle : handles)
+		handle.get();
+	if (error)
+		std::rethrow_exception(error);
+	for (const auto &step : steps) {
+		if (!step.done)
+			throw std::logic_error("Step " + step.name + " could not be started due to cyclic dependencies.");
+	}
+	FASTLIB_LOG(step_graph_log, trace) << "Critical path: " << critical_path_str() << ".";
+}
+
+std::vector<std::string> Step_graph::get_critical_path() const
+{
+	std::vector<std::string> path;
+	// Find step which was done last.
+	auto last = std::max_element(steps.begin(), steps.end(),
+			[](const Step &lhs, const Step &rhs)
+			{
+				return !lhs.done || (rhs.done && lhs.finish < rhs.finish);
+			});
+	if (last == steps.end() || !last->done)
+		return path;
+	// Follow the dependencies which were done last back to the first step.
+	for (const Step *step = &*last; step != nullptr;
+			step = step->has_enabler ? &steps[step->enabled_by] : nullptr) {
+		if (step->action)
+			path.push_back(step->name);
+	}
+	std::reverse(path.begin(), path.end());
+	return path;
+}
+
+std::string Step_graph::critical_path_str() const
+{
+	std::string str;
+	for (const auto &name : get_critical_path())
+		str += (str.empty() ? "" : " -> ") + name;
+	return str;
+}
@@ -0,0 +1,118 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef STEP_GRAPH_HPP
+#define STEP_GRAPH_HPP
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * \brief Runs a set of interdependent steps, each as soon as all of its dependencies are done.
+ *
+ * Steps without dependencies between each other run concurrently in separate threads.
+ * If a step throws, no further steps are started, running steps are waited for and the exception is rethrown by run().
+ * Rollback is left to RAII-guards created by the steps (see Step_guard), so that their destruction order is
+ * defined by the caller.
+ * After run() the critical path, i.e., the chain of steps which determined the overall duration, is available.
+ */
+class Step_graph
+{
+public:
+	/**
+	 * \brief Add a step.
+	 *
+	 * \param name The unique name of the step.
+	 * \param dependencies The names of the steps which have to be done before this step may start.
+	 * \param action The work of the step. An empty action marks the step as skipped.
+	 */
+	void add_step(std::string name, std::vector<std::string> dependencies, std::function<void()> action);
+	/**
+	 * \brief Run all steps respecting their dependencies.
+	 *
+	 * Blocks until all steps are done or a step failed.
+	 */
+	void run();
+	/**
+	 * \brief Get the names of the steps on the critical path of the last run in execution order.
+	 */
+	std::vector<std::string> get_critical_path() const;
+	/**
+	 * \brief Get the critical path of the last run as string, e.g., "pscom-suspend -> detach-pci-devs -> migrate".
+	 */
+	std::string critical_path_str() const;
+private:
+	using clock = std::chrono::high_resolution_clock;
+
+	struct Step
+	{
+		std::string name;
+		std::vector<std::string> dependency_names;
+		std::vector<size_t> dependencies;
+		std::function<void()> action;
+		bool started = false;
+		bool done = false;
+		clock::time_point finish;
+		// Index of the dependency which was done last and thereby allowed this step to start.
+		size_t enabled_by = 0;
+		bool has_enabler = false;
+	};
+
+	void resolve_dependencies();
+	bool is_ready(const Step &step) const;
+
+	std::vector<Step> steps;
+};
+
+/**
+ * \brief Holds an RAII-guard which is created by a step of a Step_graph.
+ *
+ * Unlike std::unique_ptr this holder forwards exceptions thrown by the destructor of the guard,
+ * since the guards rethrow errors during reattach/resume if the stack is not unwinding.
+ * Holders are declared by the caller in the order the guards would have been declared, so that
+ * rollback happens in reverse order.
+ */
+template<typename T>
+class Step_guard
+{
+public:
+	Step_guard() = default;
+	Step_guard(const Step_guard &) = delete;
+	Step_guard & operator=(const Step_guard &) = delete;
+	~Step_guard() noexcept(false)
+	{
+		T *tmp = guard;
+		guard = nullptr;
+		delete tmp;
+	}
+
+	template<typename... Args>
+	void emplace(Args&&... args)
+	{
+		T *tmp = new T(std::forward<Args>(args)...);
+		delete guard;
+		guard = tmp;
+	}
+
+	explicit operator bool() const
+	{
+		return guard != nullptr;
+	}
+
+	T * operator->() const
+	{
+		return guard;
+	}
+private:
+	T *guard = nullptr;
+};
+
+#endif
@@ -78,6 +78,7 @@ std::future<Result> execute(std::shared_ptr<Task> task,
 	auto func = [task, hypervisor, comm]
 	{
 		Time_measurement time_measurement(task->time_measurement.get_or(false));
+		Task_report report;
 		std::string vm_name;
 		auto start_task = std::dynamic_pointer_cast<Start>(task);
 		auto stop_task = std::dynamic_pointer_cast<Stop>(task);
@@ -115,12 +116,12 @@ std::future<Result> execute(std::shared_ptr<Task> task,
 				hypervisor->stop(*stop_task, time_measurement);
 			} else if (migrate_task) {
 				vm_name = migrate_task->vm_name;
-				hypervisor->migrate(*migrate_task, time_measurement, comm);
+				hypervisor->migrate(*migrate_task, time_measurement, comm, report);
 			} else if (evacuate_task) {
 				if (task->concurrent_execution.get_or(true))
 					FASTLIB_LOG(migfra_task_log, warn) << "Concurrent execution might result in uneven distribution of domains.";
 				vm_name = evacuate_task->vm_name.get();
-				hypervisor->evacuate(*evacuate_task, time_measurement, comm);
+				hypervisor->evacuate(*evacuate_task, time_measurement, comm, report);
 			} else if (repin_task) {
 				vm_name = repin_task->vm_name;
 				hypervisor->repin(*repin_task, time_measurement);
@@ -133,10 +134,15 @@ std::future<Result> execute(std::shared_ptr<Task> task,
 			}
 		} catch (const std::exception &e) {
 			FASTLIB_LOG(migfra_task_log, warn) << "Exception in task: " << e.what();
-			return Result(vm_name, "error", time_measurement, e.what());
+			// Keep the measurements and details gathered before the error
+			time_measurement.tock("overall");
+			std::string details = e.what();
+			if (!report.empty())
+				details += "; " + report.str();
+			return Result(vm_name, "error", time_measurement, details);
 		}
 		time_measurement.tock("overall");
-		return Result(vm_name, "success", time_measurement);
+		return Result(vm_name, "success", time_measurement, report.str());
 	};
 	bool concurrent_execution = task->concurrent_execution.get_or(true);
 	return std::async(concurrent_execution ? std::launch::async : std::launch::deferred, func);
@@ -156,7 +162,7 @@ void execute(const Task_container &task_cont, std::shared_ptr<Hypervisor> hyperv
 		throw std::runtime_error("quit");
 	}
 	// If Evacuate task -> get one task for every local domain
-	auto &tasks = result_type == "node evacuated" ? hypervisor->get_evacuate_tasks(task_cont) : task_cont.tasks;
+	auto &tasks = result_type == "node evacuated" ? hypervisor->get_evacuate_tasks(task_cont, comm) : task_cont.tasks;
 	auto func = [hypervisor, comm, tasks, result_type, id]
 	{
 		std::vector<std::future<Result>> future_results;
@@ -171,3 +177,56 @@ void execute(const Task_container &task_cont, std::shared_ptr<Hypervisor> hyperv
 	concurrent_execution ? std::thread([func] {Thread_counter cnt; func();}).detach() : func();
 }
 
+void execute(const Local_task_container &task_cont, std::shared_ptr<Hypervisor> hypervisor, std::shared_ptr<fast::Communicator> comm)
+{
+	auto id = task_cont.id.get_or("");
+	auto result_type = task_cont.result_type();
+	auto task = task_cont.task;
+	auto func = [hypervisor, comm, task, result_type, id]
+	{
+		std::vector<Result> results;
+		// Lists of hosts extending the result container, e.g., the freed hosts
+		std::vector<std::pair<std::string, std::vector<std::string>>> host_lists;
+		try {
+			if (auto consolidate_task = std::dynamic_pointer_cast<Consolidate>(task)) {
+				Consolidation_result result;
+				hypervisor->consolidate(*consolidate_task, comm, result);
+				results = std::move(result.results);
+				host_lists.emplace_back("freed-hosts", std::move(result.freed_hosts));
+			} else if (auto rebalance_task = std::dynamic_pointer_cast<Rebalance>(task)) {
+				Rebalance_result result;
+				hypervisor->rebalance(*rebalance_task, comm, result);
+				results = std::move(result.results);
+				host_lists.emplace_back("overloaded-hosts", std::move(result.overloaded_hosts));
+			} else if (auto permute_task = std::dynamic_pointer_cast<Permute>(task)) {
+				Permutation_result result;
+				hypervisor->permute(*permute_task, comm, result);
+				results = std::move(result.results);
+			} else if (auto repin_task = std::dynamic_pointer_cast<Repin_threads>(task)) {
+				Time_measurement time_measurement(repin_task->time_measurement.get_or(false));
+				time_measurement.tick("overall");
+				std::string status = "success";
+				std::string details;
+				try {
+					hypervisor->repin_threads(*repin_task, time_measurement);
+				} catch (const std::exception &e) {
+					FASTLIB_LOG(migfra_task_log, warn) << "Exception in task: " << e.what();
+					// Report the domain and the measurements gathered before the error
+					status = "error";
+					details = e.what();
+				}
+				time_measurement.tock("overall");
+				results.push_back(Result(repin_task->vm_name, status, time_measurement, details));
+			}
+		} catch (const std::exception &e) {
+			FASTLIB_LOG(migfra_task_log, warn) << "Exception in task: " << e.what();
+			results.push_back(Result("n/a", "error", std::string(e.what())));
+		}
+		auto node = Result_container(result_type, results, id).emit();
+		for (const auto &host_list : host_lists)
+			node[host_list.first] = host_list.second;
+		comm->send_message(YAML::Dump(node));
+	};
+	bool concurrent_execution = task_cont.concurrent_execution.get_or(true);
+	concurrent_execution ? std::thread([func] {Thread_counter cnt; func();}).detach() : func();
+}
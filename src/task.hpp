@@ -10,6 +10,7 @@
 #define TASK_HPP
 
 #include "hypervisor.hpp"
+#include "local_task.hpp"
 
 #include <fast-lib/communicator.hpp>
 #include <fast-lib/message/migfra/task.hpp>
@@ -62,4 +63,8 @@ void execute(const fast::msg::migfra::Task_container &task_cont,
 		std::shared_ptr<Hypervisor> hypervisor, 
 		std::shared_ptr<fast::Communicator> comm);
 
+void execute(const Local_task_container &task_cont,
+		std::shared_ptr<Hypervisor> hypervisor,
+		std::shared_ptr<fast::Communicator> comm);
+
 #endif
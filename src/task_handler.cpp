@@ -59,9 +59,16 @@ void Task_handler::loop()
 		std::string msg;
 		try {
 			msg = comm->get_message();
-			Task_container task_cont;
-			task_cont.from_string(msg);
-			execute(task_cont, hypervisor, comm);
+			auto node = YAML::Load(msg);
+			if (Local_task_container::is_local_task(node)) {
+				Local_task_container task_cont;
+				task_cont.load(node);
+				execute(task_cont, hypervisor, comm);
+			} else {
+				Task_container task_cont;
+				task_cont.from_string(msg);
+				execute(task_cont, hypervisor, comm);
+			}
 		} catch (const YAML::Exception &e) {
 			send_parse_error_nothrow(comm, std::string("Exception while parsing message: ") + e.what());
 			FASTLIB_LOG(migfra_task_handler_log, trace) << "msg dump: " << msg;
@@ -133,7 +140,58 @@ void Task_handler::load(const YAML::Node &node)
 			unsigned int default_stop_timeout = 60;
 			if (hypervisor_node["stop-timeout"])
 				default_stop_timeout = hypervisor_node["stop-timeout"].as<decltype(default_stop_timeout)>();
-			hypervisor = std::make_shared<Libvirt_hypervisor>(std::move(nodes), default_driver, default_transport, default_start_timeout, default_stop_timeout);
+			Libvirt_hypervisor_settings settings;
+			if (hypervisor_node["migration-path"])
+				settings.migration_path = hypervisor_node["migration-path"].as<decltype(settings.migration_path)>();
+			if (hypervisor_node["pre-copy-threshold"])
+				settings.pre_copy_threshold = hypervisor_node["pre-copy-threshold"].as<decltype(settings.pre_copy_threshold)>();
+			if (hypervisor_node["max-downtime"])
+				settings.max_downtime = hypervisor_node["max-downtime"].as<decltype(settings.max_downtime)>();
+			if (hypervisor_node["default-link-throughput"])
+				settings.default_link_throughput = hypervisor_node["default-link-throughput"].as<decltype(settings.default_link_throughput)>();
+			if (hypervisor_node["dirty-rate-sample-time"])
+				settings.dirty_rate_sample_time = hypervisor_node["dirty-rate-sample-time"].as<decltype(settings.dirty_rate_sample_time)>();
+			if (hypervisor_node["balloon-headroom"])
+				settings.balloon_headroom = hypervisor_node["balloon-headroom"].as<decltype(settings.balloon_headroom)>();
+			if (hypervisor_node["probe-timeout"])
+				settings.probe_timeout = hypervisor_node["probe-timeout"].as<decltype(settings.probe_timeout)>();
+			if (hypervisor_node["probe-cache-ttl"])
+				settings.probe_cache_ttl = hypervisor_node["probe-cache-ttl"].as<decltype(settings.probe_cache_ttl)>();
+			if (hypervisor_node["max-parallel-probes"])
+				settings.max_parallel_probes = hypervisor_node["max-parallel-probes"].as<decltype(settings.max_parallel_probes)>();
+			if (hypervisor_node["evacuation-order"])
+				settings.evacuation_order = hypervisor_node["evacuation-order"].as<decltype(settings.evacuation_order)>();
+			if (hypervisor_node["max-migrations-per-destination"])
+				settings.max_migrations_per_destination = hypervisor_node["max-migrations-per-destination"].as<decltype(settings.max_migrations_per_destination)>();
+			if (hypervisor_node["max-migrations-per-nic"])
+				settings.max_migrations_per_nic = hypervisor_node["max-migrations-per-nic"].as<decltype(settings.max_migrations_per_nic)>();
+			if (hypervisor_node["swap-staging"])
+				settings.swap_staging = hypervisor_node["swap-staging"].as<decltype(settings.swap_staging)>();
+			if (hypervisor_node["staging-path"])
+				settings.staging_path = hypervisor_node["staging-path"].as<decltype(settings.staging_path)>();
+			if (hypervisor_node["staging-shared"])
+				settings.staging_shared = hypervisor_node["staging-shared"].as<decltype(settings.staging_shared)>();
+			if (hypervisor_node["max-parallel-device-ops"])
+				settings.max_parallel_device_ops = hypervisor_node["max-parallel-device-ops"].as<decltype(settings.max_parallel_device_ops)>();
+			if (hypervisor_node["ivshmem-transfer"])
+				settings.ivshmem_transfer = hypervisor_node["ivshmem-transfer"].as<decltype(settings.ivshmem_transfer)>();
+			if (hypervisor_node["vf-pools"]) {
+				for (const auto &pool_node : hypervisor_node["vf-pools"]) {
+					if (!pool_node["pf"] || !pool_node["vf"])
+						throw std::invalid_argument("Defective configuration for vf-pools: pf and vf are required.");
+					VF_pool_config config;
+					config.pf_id.load(pool_node["pf"]);
+					config.vf_id.load(pool_node["vf"]);
+					if (pool_node["grow-step"])
+						config.grow_step = pool_node["grow-step"].as<decltype(config.grow_step)>();
+					if (pool_node["spare"])
+						config.spare = pool_node["spare"].as<decltype(config.spare)>();
+					if (config.grow_step == 0)
+						throw std::invalid_argument("Defective configuration for vf-pools: grow-step must be positive.");
+					settings.vf_pools.push_back(config);
+				}
+			}
+			hypervisor = std::make_shared<Libvirt_hypervisor>(std::move(nodes), default_driver, default_transport, default_start_timeout, default_stop_timeout, std::move(settings));
 		} else if (type == "ponci") {
 			hypervisor = std::make_shared<Ponci_hypervisor>();
 		} else if (type == "dummy") {
@@ -0,0 +1,35 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "task_report.hpp"
+
+void Task_report::add(const std::string &key, const std::string &value)
+{
+	std::lock_guard<std::mutex> lock(entries_mutex);
+	entries.emplace_back(key, value);
+}
+
+void Task_report::add(const std::string &key, const char *value)
+{
+	add(key, std::string(value));
+}
+
+bool Task_report::empty() const
+{
+	std::lock_guard<std::mutex> lock(entries_mutex);
+	return entries.empty();
+}
+
+std::string Task_report::str() const
+{
+	std::lock_guard<std::mutex> lock(entries_mutex);
+	std::string str;
+	for (const auto &entry : entries)
+		str += (str.empty() ? "" : "; ") + entry.first + ": " + entry.second;
+	return str;
+}
@@ -0,0 +1,41 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef TASK_REPORT_HPP
+#define TASK_REPORT_HPP
+
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * \brief Collects information about the execution of a task which is returned in the details of the result.
+ *
+ * Entries may be added by concurrently running threads of the same task.
+ * The entries are returned in the order they were added, formatted as "key: value; key: value".
+ */
+class Task_report
+{
+public:
+	void add(const std::string &key, const std::string &value);
+	void add(const std::string &key, const char *value);
+	template<typename T>
+	void add(const std::string &key, const T &value)
+	{
+		add(key, std::to_string(value));
+	}
+
+	bool empty() const;
+	std::string str() const;
+private:
+	std::vector<std::pair<std::string, std::string>> entries;
+	mutable std::mutex entries_mutex;
+};
+
+#endif
@@ -1,11 +1,18 @@
 #include "utility.hpp"
 
 #include <libvirt/virterror.h>
+#include <libssh/libsshpp.hpp>
 
+#include <algorithm>
 #include <climits>
 #include <cstring>
 #include <unistd.h>
 #include <stdexcept>
+#include <mutex>
+#include <future>
+#include <exception>
+#include <unordered_map>
+#include <map>
 
 // TODO: Consider using utility namespace and splitting the file
 
@@ -81,6 +88,20 @@ void resume_domain(virDomainPtr domain)
 		throw std::runtime_error(std::string("Error resuming domain: ") + virGetLastErrorMessage());
 }
 
+static std::mutex time_measurement_mutex;
+
+void tick_synchronized(fast::msg::migfra::Time_measurement &time_measurement, const std::string &tag)
+{
+	std::lock_guard<std::mutex> lock(time_measurement_mutex);
+	time_measurement.tick(tag);
+}
+
+void tock_synchronized(fast::msg::migfra::Time_measurement &time_measurement, const std::string &tag)
+{
+	std::lock_guard<std::mutex> lock(time_measurement_mutex);
+	time_measurement.tock(tag);
+}
+
 virConnectPtr get_connect_of_domain(virDomainPtr domain)
 {
 	auto ptr = virDomainGetConnect(domain);
@@ -91,27 +112,278 @@ virConnectPtr get_connect_of_domain(virDomainPtr domain)
 
 size_t get_cpumaplen(virConnectPtr conn)
 {
+	// Cache by URI, since connection pointers may be reused after closing while the URI identifies the host.
+	static std::mutex cache_mutex;
+	static std::unordered_map<std::string, size_t> cache;
+	auto uri = convert_and_free_cstr(virConnectGetURI(conn));
+	if (uri == "")
+		throw std::runtime_error(std::string("Error getting URI of connection: ") + virGetLastErrorMessage());
+	{
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		auto it = cache.find(uri);
+		if (it != cache.end())
+			return it->second;
+	}
 	auto cpus = virNodeGetCPUMap(conn, nullptr, nullptr, 0);
 	if (cpus == -1)
 		throw std::runtime_error(std::string("Error getting number of CPUs: ") + virGetLastErrorMessage());
-	return VIR_CPU_MAPLEN(cpus);
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	return cache[uri] = VIR_CPU_MAPLEN(cpus);
 }
 
-void pin_vcpu_to_cpus(virDomainPtr domain, unsigned int vcpu, std::vector<unsigned int> cpus, size_t maplen)
+std::vector<unsigned char> make_cpumap(const std::vector<unsigned int> &cpus, size_t maplen)
 {
 	std::vector<unsigned char> cpumap(maplen, 0);
-	for (auto cpu : cpus)
+	for (auto cpu : cpus) {
+		if (cpu / 8 >= maplen)
+			throw std::invalid_argument("CPU " + std::to_string(cpu) + " does not exist on host.");
 		VIR_USE_CPU(cpumap, cpu);
-	if (virDomainPinVcpuFlags(domain, vcpu, cpumap.data(), maplen, VIR_DOMAIN_AFFECT_CURRENT) == -1)
-		throw std::runtime_error(std::string("Error pinning vcpu: ") + virGetLastErrorMessage());
+	}
+	return cpumap;
+}
+
+// Compare cpumaps of possibly different lengths, missing bytes count as unused CPUs.
+bool equal_cpumaps(const unsigned char *lhs, size_t lhs_len, const unsigned char *rhs, size_t rhs_len)
+{
+	for (size_t i = 0; i != std::max(lhs_len, rhs_len); ++i) {
+		if ((i < lhs_len ? lhs[i] : 0) != (i < rhs_len ? rhs[i] : 0))
+			return false;
+	}
+	return true;
 }
 
-void repin_vcpus(virDomainPtr domain, const std::vector<std::vector<unsigned int>> &vcpu_map)
+unsigned int repin_vcpus(virDomainPtr domain, const std::vector<std::vector<unsigned int>> &vcpu_map)
 {
-	// Get number of CPUs on node
+	if (vcpu_map.empty())
+		return 0;
 	auto maplen = get_cpumaplen(get_connect_of_domain(domain));
-	// Create cpumap and pin for each vcpu
+	// Read the current pinning of all vcpus at once
+	std::vector<unsigned char> cpumaps(vcpu_map.size() * maplen, 0);
+	auto pinned = virDomainGetVcpuPinInfo(domain, vcpu_map.size(), cpumaps.data(), maplen, VIR_DOMAIN_AFFECT_CURRENT);
+	if (pinned == -1)
+		throw std::runtime_error(std::string("Error getting pinning of vcpus: ") + virGetLastErrorMessage());
+	// Pin only vcpus whose cpus changed
+	unsigned int repinned = 0;
 	for (unsigned int vcpu = 0; vcpu != vcpu_map.size(); ++vcpu) {
-		pin_vcpu_to_cpus(domain, vcpu, vcpu_map[vcpu], maplen);
+		auto cpumap = make_cpumap(vcpu_map[vcpu], maplen);
+		if (vcpu < static_cast<unsigned int>(pinned) && equal_cpumaps(cpumap.data(), maplen, VIR_GET_CPUMAP(cpumaps.data(), maplen, vcpu), maplen))
+			continue;
+		if (virDomainPinVcpuFlags(domain, vcpu, cpumap.data(), maplen, VIR_DOMAIN_AFFECT_CURRENT) == -1)
+			throw std::runtime_error(std::string("Error pinning vcpu: ") + virGetLastErrorMessage());
+		++repinned;
+	}
+	return repinned;
+}
+
+bool repin_emulator(virDomainPtr domain, const std::vector<unsigned int> &cpus)
+{
+	auto maplen = get_cpumaplen(get_connect_of_domain(domain));
+	auto cpumap = make_cpumap(cpus, maplen);
+	std::vector<unsigned char> current(maplen, 0);
+	auto ret = virDomainGetEmulatorPinInfo(domain, current.data(), maplen, VIR_DOMAIN_AFFECT_CURRENT);
+	if (ret == -1)
+		throw std::runtime_error(std::string("Error getting pinning of emulator threads: ") + virGetLastErrorMessage());
+	// A return value of 0 means the emulator threads are not pinned at all.
+	if (ret == 1 && current == cpumap)
+		return false;
+	if (virDomainPinEmulator(domain, cpumap.data(), maplen, VIR_DOMAIN_AFFECT_CURRENT) == -1)
+		throw std::runtime_error(std::string("Error pinning emulator threads: ") + virGetLastErrorMessage());
+	return true;
+}
+
+unsigned int repin_iothreads(virDomainPtr domain, const std::vector<std::vector<unsigned int>> &iothread_map)
+{
+	if (iothread_map.empty())
+		return 0;
+	auto maplen = get_cpumaplen(get_connect_of_domain(domain));
+	virDomainIOThreadInfoPtr *info = nullptr;
+	auto count = virDomainGetIOThreadInfo(domain, &info, VIR_DOMAIN_AFFECT_CURRENT);
+	if (count == -1)
+		throw std::runtime_error(std::string("Error getting iothreads: ") + virGetLastErrorMessage());
+	// Current cpumaps ordered by iothread id, since ids are not necessarily contiguous
+	std::map<unsigned int, std::vector<unsigned char>> current;
+	for (int i = 0; i != count; ++i) {
+		current[info[i]->iothread_id].assign(info[i]->cpumap, info[i]->cpumap + info[i]->cpumaplen);
+		virDomainIOThreadInfoFree(info[i]);
+	}
+	free(info);
+	if (iothread_map.size() > current.size())
+		throw std::invalid_argument("Domain has only " + std::to_string(current.size()) + " iothreads.");
+	unsigned int repinned = 0;
+	auto it = current.begin();
+	for (unsigned int i = 0; i != iothread_map.size(); ++i, ++it) {
+		auto iothread_id = it->first;
+		auto cpumap = make_cpumap(iothread_map[i], maplen);
+		if (equal_cpumaps(cpumap.data(), maplen, it->second.data(), it->second.size()))
+			continue;
+		if (virDomainPinIOThread(domain, iothread_id, cpumap.data(), maplen, VIR_DOMAIN_AFFECT_CURRENT) == -1)
+			throw std::runtime_error(std::string("Error pinning iothread: ") + virGetLastErrorMessage());
+		++repinned;
+	}
+	return repinned;
+}
+
+void set_memory_nodes(virDomainPtr domain, const std::vector<unsigned int> &nodes)
+{
+	if (nodes.empty())
+		throw std::invalid_argument("No NUMA nodes to bind memory to.");
+	std::string nodeset;
+	for (auto node : nodes)
+		nodeset += (nodeset.empty() ? "" : ",") + std::to_string(node);
+	virTypedParameterPtr params = nullptr;
+	int nparams = 0;
+	int maxparams = 0;
+	if (virTypedParamsAddString(&params, &nparams, &maxparams, VIR_DOMAIN_NUMA_NODESET, nodeset.c_str()) == -1)
+		throw std::runtime_error(std::string("Error creating NUMA parameters: ") + virGetLastErrorMessage());
+	auto ret = virDomainSetNumaParameters(domain, params, nparams, VIR_DOMAIN_AFFECT_CURRENT);
+	virTypedParamsFree(params, nparams);
+	if (ret == -1)
+		throw std::runtime_error("Error binding memory to NUMA nodes " + nodeset + ": " + virGetLastErrorMessage());
+}
+
+// Connect and authenticate session to host with public key authentication.
+static void connect_session(ssh::Session &session, const std::string &host)
+{
+	session.setOption(SSH_OPTIONS_HOST, host.c_str());
+	session.connect();
+	if (session.userauthPublicKeyAuto() != SSH_AUTH_SUCCESS)
+		throw std::runtime_error("Public key authentication to " + host + " failed.");
+}
+
+// Read the remaining standard error of channel.
+static std::string read_error_output(ssh::Channel &channel)
+{
+	std::string error_output;
+	char buffer[4096];
+	int count;
+	while ((count = channel.read(buffer, sizeof(buffer), true)) > 0)
+		error_output.append(buffer, count);
+	return error_output;
+}
+
+std::string execute_remote(const std::string &host, const std::string &command)
+{
+	std::string output;
+	std::string error_output;
+	int exit_status;
+	try {
+		ssh::Session session;
+		connect_session(session, host);
+		ssh::Channel channel(session);
+		channel.openSession();
+		channel.requestExec(command.c_str());
+		char buffer[4096];
+		int count;
+		while ((count = channel.read(buffer, sizeof(buffer), false)) > 0)
+			output.append(buffer, count);
+		error_output = read_error_output(channel);
+		channel.sendEof();
+		exit_status = channel.getExitStatus();
+		channel.close();
+		session.disconnect();
+	} catch (ssh::SshException &e) {
+		throw std::runtime_error("SSH error while executing command on " + host + ": " + e.getError());
+	}
+	if (exit_status != 0)
+		throw std::runtime_error("Command on " + host + " failed with status " + std::to_string(exit_status) + ": " + error_output);
+	return output;
+}
+
+void stream_remote(const std::string &source_host, const std::string &read_command, const std::string &dest_host, const std::string &write_command)
+{
+	std::string source_error_output;
+	std::string dest_error_output;
+	int source_exit_status;
+	int dest_exit_status;
+	try {
+		ssh::Session source_session;
+		connect_session(source_session, source_host);
+		ssh::Session dest_session;
+		connect_session(dest_session, dest_host);
+		ssh::Channel source_channel(source_session);
+		source_channel.openSession();
+		source_channel.requestExec(read_command.c_str());
+		ssh::Channel dest_channel(dest_session);
+		dest_channel.openSession();
+		dest_channel.requestExec(write_command.c_str());
+		std::vector<char> buffer(1 << 20);
+		int count;
+		while ((count = source_channel.read(buffer.data(), buffer.size(), false)) > 0) {
+			if (dest_channel.write(buffer.data(), count) != count)
+				throw std::runtime_error("Error writing to " + dest_host + ".");
+		}
+		source_error_output = read_error_output(source_channel);
+		source_channel.sendEof();
+		source_exit_status = source_channel.getExitStatus();
+		source_channel.close();
+		dest_channel.sendEof();
+		dest_error_output = read_error_output(dest_channel);
+		dest_exit_status = dest_channel.getExitStatus();
+		dest_channel.close();
+		source_session.disconnect();
+		dest_session.disconnect();
+	} catch (ssh::SshException &e) {
+		throw std::runtime_error("SSH error while streaming from " + source_host + " to " + dest_host + ": " + e.getError());
+	}
+	if (source_exit_status != 0)
+		throw std::runtime_error("Command on " + source_host + " failed with status " + std::to_string(source_exit_status) + ": " + source_error_output);
+	if (dest_exit_status != 0)
+		throw std::runtime_error("Command on " + dest_host + " failed with status " + std::to_string(dest_exit_status) + ": " + dest_error_output);
+}
+
+bool is_safe_file_name(const std::string &name)
+{
+	if (name.empty() || name.front() == '.' || name.front() == '-')
+		return false;
+	return std::all_of(name.begin(), name.end(), [](char c)
+			{
+				return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+					c == '.' || c == '_' || c == '+' || c == '-';
+			});
+}
+
+void run_bounded(const std::vector<std::function<void()>> &jobs, unsigned int max_parallel)
+{
+	std::mutex next_mutex;
+	size_t next = 0;
+	auto worker = [&jobs, &next_mutex, &next]
+	{
+		while (true) {
+			size_t i;
+			{
+				std::lock_guard<std::mutex> lock(next_mutex);
+				if (next == jobs.size())
+					return;
+				i = next++;
+			}
+			jobs[i]();
+		}
+	};
+	std::vector<std::future<void>> workers;
+	for (unsigned int i = 0; (max_parallel == 0 || i != max_parallel) && i != jobs.size(); ++i)
+		workers.push_back(std::async(std::launch::async, worker));
+	for (auto &handle : workers)
+		handle.get();
+}
+
+void run_all_bounded(const std::vector<std::function<void()>> &operations, unsigned int max_parallel)
+{
+	// Collect errors, so that all operations are run before the first error is rethrown.
+	std::vector<std::exception_ptr> errors(operations.size());
+	std::vector<std::function<void()>> jobs;
+	for (size_t i = 0; i != operations.size(); ++i) {
+		jobs.push_back([&operations, &errors, i]
+		{
+			try {
+				operations[i]();
+			} catch (...) {
+				errors[i] = std::current_exception();
+			}
+		});
+	}
+	run_bounded(jobs, max_parallel);
+	for (const auto &error : errors) {
+		if (error)
+			std::rethrow_exception(error);
 	}
 }
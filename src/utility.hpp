@@ -1,8 +1,10 @@
 #ifndef UTILITY_HPP
 #define UTILITY_HPP
 
+#include <fast-lib/message/migfra/time_measurement.hpp>
 #include <libvirt/libvirt.h>
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -70,8 +72,45 @@ void suspend_domain(virDomainPtr domain);
 // Resume domain
 void resume_domain(virDomainPtr domain);
 
-// Repinning the vcpus to cpus
-void repin_vcpus(virDomainPtr domain, const std::vector<std::vector<unsigned int>> &vcpu_map);
+// Time_measurement is not thread-safe.
+// These functions serialize tick/tock on measurements shared by concurrently running threads of a task.
+void tick_synchronized(fast::msg::migfra::Time_measurement &time_measurement, const std::string &tag);
+void tock_synchronized(fast::msg::migfra::Time_measurement &time_measurement, const std::string &tag);
+
+// Repinning the vcpus to cpus.
+// The current pinning is read at once and only vcpus whose cpus changed are repinned. Returns their number.
+unsigned int repin_vcpus(virDomainPtr domain, const std::vector<std::vector<unsigned int>> &vcpu_map);
+
+// Repinning the emulator threads, e.g., for I/O and monitor, to cpus. Returns false if already pinned to them.
+bool repin_emulator(virDomainPtr domain, const std::vector<unsigned int> &cpus);
+
+// Repinning the iothreads to cpus. The iothread with the i-th smallest id is pinned to iothread_map[i].
+// Only iothreads whose cpus changed are repinned. Returns their number.
+unsigned int repin_iothreads(virDomainPtr domain, const std::vector<std::vector<unsigned int>> &iothread_map);
+
+// Bind the memory of a domain to NUMA nodes by updating its numatune nodeset.
+// Pages of a running domain on other nodes are migrated by its cpuset cgroup.
+void set_memory_nodes(virDomainPtr domain, const std::vector<unsigned int> &nodes);
+
+// Execute a shell command on host using ssh with public key authentication.
+// Throws if the command exits with non-zero status. Returns the standard output.
+std::string execute_remote(const std::string &host, const std::string &command);
+
+// Pipe the standard output of read_command on source_host into write_command on dest_host.
+// The data passes through this process, so that no shell is nested and the hosts need no ssh access to each other.
+// Throws if one of the commands exits with non-zero status.
+void stream_remote(const std::string &source_host, const std::string &read_command, const std::string &dest_host, const std::string &write_command);
+
+// Check if name consists of letters, digits, '.', '_', '+' and '-' only and does not start with '.' or '-',
+// so that it can be used as file name in a path and shell command without quoting issues.
+bool is_safe_file_name(const std::string &name);
+
+// Run jobs in the given order by at most max_parallel threads (0: one thread per job).
+// If jobs throw, the remaining jobs of the throwing thread are skipped and the exception is rethrown.
+void run_bounded(const std::vector<std::function<void()>> &jobs, unsigned int max_parallel);
+
+// Run operations like run_bounded, but run all of them even if some throw and rethrow the first error afterwards.
+void run_all_bounded(const std::vector<std::function<void()>> &operations, unsigned int max_parallel);
 
 
 
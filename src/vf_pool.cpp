@@ -0,0 +1,313 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "vf_pool.hpp"
+
+#include "device_ledger.hpp"
+#include "domain_inventory.hpp"
+#include "device_utility.hpp"
+#include "utility.hpp"
+
+#include <fast-lib/log.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+FASTLIB_LOG_INIT(vf_pool_log, "VF_pool")
+FASTLIB_LOG_SET_LEVEL_GLOBAL(vf_pool_log, trace);
+
+// Owner of the VFs reserved while their PF is resized. The reservations are pending, so they are not released as stale.
+static const std::string resize_owner = "vf-pool-resize";
+
+// Parse a list of ids like "0-3,8,^2".
+std::set<unsigned int> parse_id_list(const std::string &list)
+{
+	std::set<unsigned int> ids;
+	std::set<unsigned int> excluded;
+	std::stringstream ss(list);
+	std::string range;
+	while (std::getline(ss, range, ',')) {
+		if (range.empty())
+			continue;
+		auto &target = range[0] == '^' ? excluded : ids;
+		if (range[0] == '^')
+			range.erase(0, 1);
+		auto dash = range.find('-');
+		auto first = std::stoul(range.substr(0, dash));
+		auto last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+		for (auto id = first; id <= last; ++id)
+			target.insert(id);
+	}
+	for (auto id : excluded)
+		ids.erase(id);
+	return ids;
+}
+
+// Map each cpu of a host to its NUMA node using the host capabilities.
+std::unordered_map<unsigned int, int> get_cpu_nodes(virConnectPtr host_connection)
+{
+	auto capabilities = read_xml_from_string(convert_and_free_cstr(virConnectGetCapabilities(host_connection)));
+	std::unordered_map<unsigned int, int> cpu_nodes;
+	auto cells = capabilities.get_child_optional("capabilities.host.topology.cells");
+	if (!cells)
+		return cpu_nodes;
+	for (const auto &cell : *cells) {
+		if (cell.first != "cell")
+			continue;
+		auto node = cell.second.get<int>("<xmlattr>.id");
+		for (const auto &cpu : cell.second.get_child("cpus")) {
+			if (cpu.first == "cpu")
+				cpu_nodes[cpu.second.get<unsigned int>("<xmlattr>.id")] = node;
+		}
+	}
+	return cpu_nodes;
+}
+
+VF_pool::VF_pool(std::vector<VF_pool_config> configs, const Device_cache &device_cache, Device_ledger &device_ledger) :
+	configs(std::move(configs)),
+	device_cache(device_cache),
+	device_ledger(device_ledger)
+{
+}
+
+bool VF_pool::manages(PCI_id vf_id) const
+{
+	return std::any_of(configs.begin(), configs.end(), [&vf_id](const VF_pool_config &config){return config.vf_id == vf_id;});
+}
+
+std::set<int> VF_pool::get_numa_nodes(virDomainPtr domain, const std::string &host_uri)
+{
+	Domain_inventory inventory(get_domain_xml(domain));
+	std::set<int> nodes;
+	// Use the nodes memory is bound to.
+	if (!inventory.memory_nodeset.empty()) {
+		for (auto node : parse_id_list(inventory.memory_nodeset))
+			nodes.insert(node);
+		return nodes;
+	}
+	// Otherwise use the nodes of the cpus the vcpus are pinned to.
+	std::set<unsigned int> cpus;
+	if (!inventory.vcpu_cpuset.empty())
+		cpus = parse_id_list(inventory.vcpu_cpuset);
+	for (const auto &vcpupin : inventory.vcpupins) {
+		auto pinned = parse_id_list(vcpupin.second);
+		cpus.insert(pinned.begin(), pinned.end());
+	}
+	if (cpus.empty())
+		return nodes;
+	std::unique_lock<std::mutex> lock(pool_mutex);
+	if (cpu_nodes.find(host_uri) == cpu_nodes.end()) {
+		lock.unlock();
+		auto host_cpu_nodes = get_cpu_nodes(virDomainGetConnect(domain));
+		lock.lock();
+		cpu_nodes[host_uri] = std::move(host_cpu_nodes);
+	}
+	const auto &host_cpu_nodes = cpu_nodes[host_uri];
+	for (auto cpu : cpus) {
+		auto it = host_cpu_nodes.find(cpu);
+		if (it != host_cpu_nodes.end())
+			nodes.insert(it->second);
+	}
+	return nodes;
+}
+
+std::vector<std::shared_ptr<Device>> VF_pool::order_candidates(virDomainPtr domain, std::vector<std::shared_ptr<Device>> candidates)
+{
+	auto host_uri = convert_and_free_cstr(virConnectGetURI(virDomainGetConnect(domain)));
+	auto nodes = get_numa_nodes(domain, host_uri);
+	std::lock_guard<std::mutex> lock(pool_mutex);
+	const auto &host_quarantined = quarantined[host_uri];
+	const auto &host_prebound = prebound[host_uri];
+	candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&host_quarantined](const std::shared_ptr<Device> &vf)
+			{
+				return host_quarantined.count(vf->address) != 0;
+			}), candidates.end());
+	// Rank: 0 local and pre-bound, 1 local, 2 pre-bound, 3 other
+	auto rank = [&nodes, &host_prebound](const std::shared_ptr<Device> &vf)
+	{
+		bool local = nodes.empty() || nodes.count(vf->numa_node) != 0;
+		bool bound = host_prebound.count(vf->address) != 0;
+		return (local ? 0 : 2) + (bound ? 0 : 1);
+	};
+	std::stable_sort(candidates.begin(), candidates.end(), [&rank](const std::shared_ptr<Device> &lhs, const std::shared_ptr<Device> &rhs)
+			{
+				return rank(lhs) < rank(rhs);
+			});
+	return candidates;
+}
+
+bool VF_pool::reserve_idle(virConnectPtr host_connection, const std::string &host_uri, const Device &pf)
+{
+	for (auto it = pf.virtual_functions.begin(); it != pf.virtual_functions.end(); ++it) {
+		if (!device_ledger.reserve(host_uri, *it, resize_owner, true)) {
+			for (auto reserved = pf.virtual_functions.begin(); reserved != it; ++reserved)
+				device_ledger.release(host_uri, *reserved);
+			return false;
+		}
+	}
+	// Check the domains after reserving, so that no VF is attached by migfra in between.
+	std::unordered_map<PCI_address, std::string> attached;
+	try {
+		for (const auto &address_domain : get_attached_devices(host_connection)) {
+			if (std::find(pf.virtual_functions.begin(), pf.virtual_functions.end(), address_domain.first) != pf.virtual_functions.end())
+				attached.insert(address_domain);
+		}
+	} catch (...) {
+		release(host_uri, pf);
+		throw;
+	}
+	if (attached.empty())
+		return true;
+	release(host_uri, pf);
+	// Record the missing reservations, so that the VFs are not handed out either.
+	for (const auto &address_domain : attached) {
+		FASTLIB_LOG(vf_pool_log, warn) << "VF " << address_domain.first.str() << " on " << host_uri << " is attached to "
+			<< address_domain.second << " without reservation.";
+		device_ledger.reserve(host_uri, address_domain.first, address_domain.second);
+	}
+	return false;
+}
+
+void VF_pool::release(const std::string &host_uri, const Device &pf)
+{
+	for (const auto &address : pf.virtual_functions)
+		device_ledger.release(host_uri, address);
+}
+
+void VF_pool::set_num_vfs(virConnectPtr host_connection, const std::string &host_uri, const Device &pf, unsigned int num_vfs)
+{
+	FASTLIB_LOG(vf_pool_log, trace) << "Set number of VFs of " << pf.address.str() << " on " << host_uri << " to " << num_vfs << ".";
+	// The number of VFs can only be changed after removing all VFs.
+	const std::string path = "/sys/bus/pci/devices/" + pf.address.str() + "/sriov_numvfs";
+	auto host = convert_and_free_cstr(virConnectGetHostname(host_connection));
+	if (host == get_hostname()) {
+		for (auto count : {0u, num_vfs}) {
+			if (count == 0 && pf.virtual_functions.empty())
+				continue;
+			std::ofstream sriov_numvfs(path);
+			if (!(sriov_numvfs << count << std::flush))
+				throw std::runtime_error("Failed writing " + std::to_string(count) + " to " + path + ".");
+		}
+	} else {
+		execute_remote(host, "echo 0 > " + path + " && echo " + std::to_string(num_vfs) + " > " + path);
+	}
+	{
+		std::lock_guard<std::mutex> lock(pool_mutex);
+		for (const auto &address : pf.virtual_functions) {
+			prebound[host_uri].erase(address);
+			quarantined[host_uri].erase(address);
+		}
+	}
+	// Wait for the node devices of the VFs to appear.
+	std::shared_ptr<Device> resized_pf;
+	for (auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);;) {
+		device_cache.rescan(host_connection);
+		resized_pf = device_cache.get_device(host_connection, pf.address);
+		if (resized_pf && resized_pf->virtual_functions.size() == num_vfs)
+			break;
+		if (std::chrono::steady_clock::now() > deadline)
+			throw std::runtime_error("Timeout waiting for VFs of " + pf.address.str() + " on " + host_uri + ".");
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	}
+	// Pre-bind VFs to vfio-pci.
+	for (const auto &address : resized_pf->virtual_functions) {
+		std::unique_ptr<virNodeDevice, Deleter_virNodeDevice> nodedev(
+				virNodeDeviceLookupByName(host_connection, address.to_name_fmt().c_str()));
+		if (!nodedev || virNodeDeviceDetachFlags(nodedev.get(), "vfio", 0) != 0) {
+			FASTLIB_LOG(vf_pool_log, warn) << "Could not pre-bind VF " << address.str() << " on " << host_uri << ".";
+			continue;
+		}
+		std::lock_guard<std::mutex> lock(pool_mutex);
+		prebound[host_uri].insert(address);
+	}
+}
+
+bool VF_pool::grow(virDomainPtr domain, PCI_id vf_id)
+{
+	auto connection = virDomainGetConnect(domain);
+	auto host_uri = convert_and_free_cstr(virConnectGetURI(connection));
+	auto nodes = get_numa_nodes(domain, host_uri);
+	std::lock_guard<std::mutex> resize_lock(resize_mutex);
+	// Find PFs which can grow, local ones first.
+	std::vector<std::pair<std::shared_ptr<Device>, const VF_pool_config *>> pfs;
+	for (const auto &config : configs) {
+		if (!(config.vf_id == vf_id))
+			continue;
+		for (const auto &pf : device_cache.get_devices(connection, config.pf_id)) {
+			if (pf->virtual_functions.size() < pf->max_virtual_functions)
+				pfs.emplace_back(pf, &config);
+		}
+	}
+	std::stable_sort(pfs.begin(), pfs.end(), [&nodes](const decltype(pfs)::value_type &lhs, const decltype(pfs)::value_type &rhs)
+			{
+				return nodes.count(lhs.first->numa_node) > nodes.count(rhs.first->numa_node);
+			});
+	for (const auto &pf_config : pfs) {
+		const auto &pf = *pf_config.first;
+		if (!reserve_idle(connection, host_uri, pf)) {
+			FASTLIB_LOG(vf_pool_log, trace) << "PF " << pf.address.str() << " has VFs in use and cannot grow.";
+			continue;
+		}
+		auto num_vfs = std::min<unsigned int>(pf.max_virtual_functions, pf.virtual_functions.size() + pf_config.second->grow_step);
+		try {
+			set_num_vfs(connection, host_uri, pf, num_vfs);
+		} catch (...) {
+			release(host_uri, pf);
+			throw;
+		}
+		release(host_uri, pf);
+		return true;
+	}
+	return false;
+}
+
+void VF_pool::trim(virConnectPtr host_connection)
+{
+	auto host_uri = convert_and_free_cstr(virConnectGetURI(host_connection));
+	std::lock_guard<std::mutex> resize_lock(resize_mutex);
+	for (const auto &config : configs) {
+		for (const auto &pf : device_cache.get_devices(host_connection, config.pf_id)) {
+			bool has_quarantined = false;
+			{
+				std::lock_guard<std::mutex> lock(pool_mutex);
+				for (const auto &address : pf->virtual_functions)
+					has_quarantined = has_quarantined || quarantined[host_uri].count(address) != 0;
+			}
+			auto num_vfs = std::min<size_t>(pf->virtual_functions.size(), config.spare);
+			if (num_vfs == pf->virtual_functions.size() && !has_quarantined)
+				continue;
+			if (!reserve_idle(host_connection, host_uri, *pf))
+				continue;
+			try {
+				set_num_vfs(host_connection, host_uri, *pf, num_vfs);
+			} catch (const std::exception &e) {
+				FASTLIB_LOG(vf_pool_log, warn) << "Error trimming VFs of " << pf->address.str() << ": " << e.what();
+			}
+			release(host_uri, *pf);
+		}
+	}
+}
+
+bool VF_pool::is_prebound(const std::string &host_uri, const PCI_address &address) const
+{
+	std::lock_guard<std::mutex> lock(pool_mutex);
+	auto it = prebound.find(host_uri);
+	return it != prebound.end() && it->second.count(address) != 0;
+}
+
+void VF_pool::quarantine(const std::string &host_uri, const PCI_address &address)
+{
+	FASTLIB_LOG(vf_pool_log, warn) << "Quarantine VF " << address.str() << " on " << host_uri << ".";
+	std::lock_guard<std::mutex> lock(pool_mutex);
+	quarantined[host_uri].insert(address);
+	prebound[host_uri].erase(address);
+}
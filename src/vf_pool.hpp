@@ -0,0 +1,104 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef VF_POOL_HPP
+#define VF_POOL_HPP
+
+#include "pci_device_handler.hpp"
+
+#include <libvirt/libvirt.h>
+
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class Device_ledger;
+
+// Physical functions of a type whose virtual functions are managed by VF_pool.
+struct VF_pool_config
+{
+	PCI_id pf_id;
+	PCI_id vf_id;
+	// Number of virtual functions added to a physical function if no free one is left.
+	unsigned int grow_step = 4;
+	// Number of virtual functions an idle physical function is shrunk to.
+	unsigned int spare = 4;
+};
+
+/**
+ * \brief Manages SR-IOV virtual functions (VFs) of the configured physical functions (PFs).
+ *
+ * If no free VF of a type is left on a host, the number of VFs of an idle PF is grown through sysfs (sriov_numvfs).
+ * Since the kernel recreates all VFs of a PF when changing their number, only PFs without reserved VFs are resized.
+ * New VFs are pre-bound to vfio-pci, so that they can be attached unmanaged and stay bound after detaching.
+ * VFs local to the NUMA nodes of a domain are preferred. VFs which failed to attach are quarantined until their PF
+ * is resized.
+ */
+class VF_pool
+{
+public:
+	VF_pool(std::vector<VF_pool_config> configs, const Device_cache &device_cache, Device_ledger &device_ledger);
+
+	/**
+	 * \brief Check if VFs of a type are managed by the pool.
+	 */
+	bool manages(PCI_id vf_id) const;
+	/**
+	 * \brief Order candidate VFs for domain.
+	 *
+	 * Quarantined VFs are removed. VFs on the NUMA nodes of the domain come first, pre-bound ones before others.
+	 */
+	std::vector<std::shared_ptr<Device>> order_candidates(virDomainPtr domain, std::vector<std::shared_ptr<Device>> candidates);
+	/**
+	 * \brief Add VFs of a type on the host of domain preferring PFs on the NUMA nodes of the domain.
+	 *
+	 * The reservations of the host have to be loaded into the ledger.
+	 * \returns False if no PF could grow.
+	 */
+	bool grow(virDomainPtr domain, PCI_id vf_id);
+	/**
+	 * \brief Shrink idle PFs of a host to their spare number of VFs. This also recreates quarantined VFs.
+	 *
+	 * The reservations of the host have to be loaded into the ledger.
+	 */
+	void trim(virConnectPtr host_connection);
+	/**
+	 * \brief Check if a VF is bound to vfio-pci by the pool, so that it can be attached unmanaged.
+	 */
+	bool is_prebound(const std::string &host_uri, const PCI_address &address) const;
+	/**
+	 * \brief Quarantine a VF which failed to attach until its PF is resized.
+	 */
+	void quarantine(const std::string &host_uri, const PCI_address &address);
+private:
+	// Reserve all VFs of an idle PF, so that they are not attached while the PF is resized.
+	// PFs with VFs attached to active domains are not idle, even if the ledger lacks their reservations.
+	bool reserve_idle(virConnectPtr host_connection, const std::string &host_uri, const Device &pf);
+	void release(const std::string &host_uri, const Device &pf);
+	// Set the number of VFs of a reserved PF, wait for the VFs to appear and pre-bind them.
+	void set_num_vfs(virConnectPtr host_connection, const std::string &host_uri, const Device &pf, unsigned int num_vfs);
+	std::set<int> get_numa_nodes(virDomainPtr domain, const std::string &host_uri);
+
+	std::vector<VF_pool_config> configs;
+	const Device_cache &device_cache;
+	Device_ledger &device_ledger;
+	// (hosturi : addresses)
+	std::unordered_map<std::string, std::unordered_set<PCI_address>> prebound;
+	std::unordered_map<std::string, std::unordered_set<PCI_address>> quarantined;
+	// (hosturi : (cpu : NUMA node))
+	std::unordered_map<std::string, std::unordered_map<unsigned int, int>> cpu_nodes;
+	mutable std::mutex pool_mutex;
+	// Serializes resizing of PFs.
+	std::mutex resize_mutex;
+};
+
+#endif
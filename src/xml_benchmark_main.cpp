@@ -0,0 +1,275 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+// Microbenchmark comparing boost.property_tree with Xml_scanner and direct formatting
+// for the xml handled around migrations.
+
+#include "xml_scanner.hpp"
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+// Build a domain xml with many devices similar to the ones libvirt returns.
+std::string make_domain_xml(unsigned int devices)
+{
+	std::stringstream ss;
+	ss << "<domain type='kvm' id='1'>\n"
+		"  <name>vm1</name>\n"
+		"  <uuid>4dea22b3-1d52-d8f3-2516-782e98ab3fa0</uuid>\n"
+		"  <memory unit='KiB'>8388608</memory>\n"
+		"  <vcpu placement='static' cpuset='0-7'>8</vcpu>\n"
+		"  <cputune>\n";
+	for (unsigned int vcpu = 0; vcpu != 8; ++vcpu)
+		ss << "    <vcpupin vcpu='" << vcpu << "' cpuset='" << vcpu << "'/>\n";
+	ss << "  </cputune>\n"
+		"  <numatune>\n"
+		"    <memory mode='strict' nodeset='0'/>\n"
+		"  </numatune>\n"
+		"  <os>\n"
+		"    <type arch='x86_64' machine='pc-i440fx-2.5'>hvm</type>\n"
+		"  </os>\n"
+		"  <devices>\n"
+		"    <emulator>/usr/bin/qemu-system-x86_64</emulator>\n";
+	for (unsigned int i = 0; i != devices; ++i) {
+		ss << "    <disk type='file' device='disk'>\n"
+			"      <driver name='qemu' type='qcow2'/>\n"
+			"      <source file='/var/lib/libvirt/images/vm1-" << i << ".qcow2'/>\n"
+			"      <target dev='vd" << static_cast<char>('a' + i % 26) << "' bus='virtio'/>\n"
+			"      <alias name='virtio-disk" << i << "'/>\n"
+			"    </disk>\n"
+			"    <interface type='bridge'>\n"
+			"      <mac address='52:54:00:00:00:" << std::hex << std::setw(2) << std::setfill('0') << (i % 256) << std::dec << "'/>\n"
+			"      <source bridge='br0'/>\n"
+			"      <model type='virtio'/>\n"
+			"    </interface>\n"
+			"    <hostdev mode='subsystem' type='pci' managed='yes'>\n"
+			"      <driver name='vfio'/>\n"
+			"      <source>\n"
+			"        <address domain='0x0000' bus='0x82' slot='0x" << std::hex << std::setw(2) << std::setfill('0') << (i % 32) << std::dec << "' function='0x1'/>\n"
+			"      </source>\n"
+			"      <alias name='hostdev" << i << "'/>\n"
+			"    </hostdev>\n";
+	}
+	ss << "    <shmem name='ivshmem'>\n"
+		"      <model type='ivshmem-plain'/>\n"
+		"      <size unit='M'>64</size>\n"
+		"      <alias name='shmem0'/>\n"
+		"      <address type='pci' domain='0x0000' bus='0x00' slot='0x0a' function='0x0'/>\n"
+		"    </shmem>\n"
+		"  </devices>\n"
+		"</domain>\n";
+	return ss.str();
+}
+
+const std::string node_device_xml =
+	"<device>\n"
+	"  <name>pci_0000_82_00_1</name>\n"
+	"  <path>/sys/devices/pci0000:80/0000:80:02.0/0000:82:00.1</path>\n"
+	"  <parent>pci_0000_80_02_0</parent>\n"
+	"  <driver>\n"
+	"    <name>mlx4_core</name>\n"
+	"  </driver>\n"
+	"  <capability type='pci'>\n"
+	"    <domain>0</domain>\n"
+	"    <bus>130</bus>\n"
+	"    <slot>0</slot>\n"
+	"    <function>1</function>\n"
+	"    <product id='0x1004'>MT27500/MT27520 Family [ConnectX-3/ConnectX-3 Pro Virtual Function]</product>\n"
+	"    <vendor id='0x15b3'>Mellanox Technologies</vendor>\n"
+	"    <capability type='phys_function'>\n"
+	"      <address domain='0x0000' bus='0x82' slot='0x00' function='0x0'/>\n"
+	"    </capability>\n"
+	"    <iommuGroup number='45'>\n"
+	"      <address domain='0x0000' bus='0x82' slot='0x00' function='0x1'/>\n"
+	"    </iommuGroup>\n"
+	"    <numa node='1'/>\n"
+	"  </capability>\n"
+	"</device>\n";
+
+// Run func n times and return the average duration in nanoseconds.
+double measure(unsigned int n, const std::function<size_t()> &func, size_t &checksum)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i != n; ++i)
+		checksum += func();
+	auto duration = std::chrono::high_resolution_clock::now() - start;
+	return std::chrono::duration<double, std::nano>(duration).count() / n;
+}
+
+void report(const std::string &name, double ptree_ns, double scanner_ns)
+{
+	std::cout << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(0)
+		<< std::setw(12) << ptree_ns << " ns" << std::setw(12) << scanner_ns << " ns"
+		<< std::setprecision(1) << std::setw(9) << ptree_ns / scanner_ns << "x" << std::endl;
+}
+
+boost::property_tree::ptree read_ptree(const std::string &xml)
+{
+	boost::property_tree::ptree pt;
+	std::stringstream ss(xml);
+	read_xml(ss, pt, boost::property_tree::xml_parser::trim_whitespace);
+	return pt;
+}
+
+std::string write_ptree(const boost::property_tree::ptree &pt)
+{
+	std::stringstream ss;
+	boost::property_tree::xml_parser::xml_writer_settings<std::string> settings('\t', 1);
+	write_xml(ss, pt, settings);
+	return ss.str();
+}
+
+// Extract hostdev addresses, shmem devices and interfaces like the former ptree based code.
+size_t scan_domain_ptree(const std::string &xml)
+{
+	auto pt = read_ptree(xml);
+	size_t found = 0;
+	for (const auto &device : pt.get_child("domain.devices")) {
+		if (device.first == "hostdev") {
+			const auto &address = device.second.get_child("source.address.<xmlattr>");
+			found += std::stoul(address.get<std::string>("bus"), nullptr, 0) + std::stoul(address.get<std::string>("slot"), nullptr, 0);
+		} else if (device.first == "shmem") {
+			found += write_ptree(device.second).size();
+		} else if (device.first == "interface") {
+			found += device.second.get<std::string>("mac.<xmlattr>.address").size();
+		}
+	}
+	return found + pt.get<std::string>("domain.numatune.memory.<xmlattr>.nodeset", "").size();
+}
+
+size_t scan_domain_scanner(const std::string &xml)
+{
+	Xml_scanner scanner(xml);
+	size_t found = 0;
+	for (auto token = scanner.next(); token != Xml_scanner::Token::end_of_document; token = scanner.next()) {
+		if (token != Xml_scanner::Token::start_element)
+			continue;
+		if (scanner.path_is("domain/devices/hostdev/source/address")) {
+			found += scanner.attribute("bus").to_ulong() + scanner.attribute("slot").to_ulong();
+		} else if (scanner.path_is("domain/devices/shmem")) {
+			found += scanner.read_element().size;
+		} else if (scanner.path_is("domain/devices/interface/mac")) {
+			found += scanner.attribute("address").str().size();
+		} else if (scanner.path_is("domain/numatune/memory")) {
+			found += scanner.attribute("nodeset").str().size();
+		}
+	}
+	return found;
+}
+
+size_t scan_node_device_ptree(const std::string &xml)
+{
+	auto pt = read_ptree(xml);
+	return std::stoul(pt.get<std::string>("device.capability.vendor.<xmlattr>.id"), nullptr, 0)
+		+ std::stoul(pt.get<std::string>("device.capability.product.<xmlattr>.id"), nullptr, 0)
+		+ pt.get<unsigned int>("device.capability.bus")
+		+ pt.get<int>("device.capability.iommuGroup.<xmlattr>.number", -1);
+}
+
+size_t scan_node_device_scanner(const std::string &xml)
+{
+	Xml_scanner scanner(xml);
+	size_t found = 0;
+	for (auto token = scanner.next(); token != Xml_scanner::Token::end_of_document; token = scanner.next()) {
+		if (token != Xml_scanner::Token::start_element)
+			continue;
+		if (scanner.path_is("device/capability/vendor") || scanner.path_is("device/capability/product"))
+			found += scanner.attribute("id").to_ulong();
+		else if (scanner.path_is("device/capability/bus"))
+			found += scanner.read_text().to_ulong();
+		else if (scanner.path_is("device/capability/iommuGroup"))
+			found += scanner.attribute("number").to_long();
+	}
+	return found;
+}
+
+std::string to_hex_stream(unsigned int value, int digits)
+{
+	std::stringstream ss;
+	ss << "0x" << std::hex << std::setfill('0') << std::setw(digits) << value;
+	return ss.str();
+}
+
+std::string to_hex_direct(unsigned int value, int digits)
+{
+	static const char hex_digits[] = "0123456789abcdef";
+	char buffer[2 * sizeof(value)];
+	int length = 0;
+	do {
+		buffer[length++] = hex_digits[value & 0xf];
+		value >>= 4;
+	} while (value != 0);
+	std::string str("0x");
+	if (digits > length)
+		str.append(digits - length, '0');
+	while (length != 0)
+		str += buffer[--length];
+	return str;
+}
+
+size_t format_hostdev_ptree()
+{
+	boost::property_tree::ptree pt;
+	pt.put("hostdev.<xmlattr>.mode", "subsystem");
+	pt.put("hostdev.<xmlattr>.type", "pci");
+	pt.put("hostdev.<xmlattr>.managed", "yes");
+	pt.put("hostdev.source.address.<xmlattr>.domain", to_hex_stream(0, 4));
+	pt.put("hostdev.source.address.<xmlattr>.bus", to_hex_stream(0x82, 2));
+	pt.put("hostdev.source.address.<xmlattr>.slot", to_hex_stream(0, 2));
+	pt.put("hostdev.source.address.<xmlattr>.function", to_hex_stream(1, 1));
+	return write_ptree(pt).size();
+}
+
+size_t format_hostdev_direct()
+{
+	return (std::string("<hostdev mode='subsystem' type='pci' managed='yes'>\n"
+		"\t<source>\n"
+		"\t\t<address domain='") + to_hex_direct(0, 4) + "' bus='" + to_hex_direct(0x82, 2)
+		+ "' slot='" + to_hex_direct(0, 2) + "' function='" + to_hex_direct(1, 1) + "'/>\n"
+		"\t</source>\n"
+		"</hostdev>\n").size();
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+		unsigned int n = argc > 1 ? std::stoul(argv[1]) : 1000;
+		unsigned int devices = argc > 2 ? std::stoul(argv[2]) : 16;
+		if (n == 0)
+			throw std::invalid_argument("Number of iterations must be positive.");
+		auto domain_xml = make_domain_xml(devices);
+		std::cout << "Iterations: " << n << ", devices: " << devices << ", domain xml: " << domain_xml.size() << " bytes" << std::endl;
+		std::cout << std::left << std::setw(24) << "" << std::right << std::setw(15) << "ptree" << std::setw(15) << "scanner" << std::setw(10) << "speedup" << std::endl;
+		size_t checksum_ptree = 0;
+		size_t checksum_scanner = 0;
+		report("domain xml",
+				measure(n, [&]{return scan_domain_ptree(domain_xml);}, checksum_ptree),
+				measure(n, [&]{return scan_domain_scanner(domain_xml);}, checksum_scanner));
+		report("node device xml",
+				measure(n, []{return scan_node_device_ptree(node_device_xml);}, checksum_ptree),
+				measure(n, []{return scan_node_device_scanner(node_device_xml);}, checksum_scanner));
+		report("hostdev formatting",
+				measure(n, format_hostdev_ptree, checksum_ptree),
+				measure(n, format_hostdev_direct, checksum_scanner));
+		// Print checksums, so that the work cannot be optimized away.
+		std::cout << "Checksums: " << checksum_ptree << " " << checksum_scanner << std::endl;
+	} catch (const std::exception &e) {
+		std::cerr << "Exception: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
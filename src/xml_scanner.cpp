@@ -0,0 +1,381 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#include "xml_scanner.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+//
+// Xml_ref implementation
+//
+
+Xml_ref::Xml_ref(const char *data, size_t size) :
+	data(data), size(size)
+{
+}
+
+bool Xml_ref::empty() const
+{
+	return size == 0;
+}
+
+bool Xml_ref::operator==(const char *rhs) const
+{
+	return data != nullptr && std::strlen(rhs) == size && std::memcmp(data, rhs, size) == 0;
+}
+
+bool Xml_ref::operator!=(const char *rhs) const
+{
+	return !(*this == rhs);
+}
+
+// Append a code point encoded as UTF-8.
+void append_utf8(std::string &str, unsigned long code_point)
+{
+	if (code_point < 0x80) {
+		str += static_cast<char>(code_point);
+	} else if (code_point < 0x800) {
+		str += static_cast<char>(0xc0 | (code_point >> 6));
+		str += static_cast<char>(0x80 | (code_point & 0x3f));
+	} else if (code_point < 0x10000) {
+		str += static_cast<char>(0xe0 | (code_point >> 12));
+		str += static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+		str += static_cast<char>(0x80 | (code_point & 0x3f));
+	} else {
+		str += static_cast<char>(0xf0 | (code_point >> 18));
+		str += static_cast<char>(0x80 | ((code_point >> 12) & 0x3f));
+		str += static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+		str += static_cast<char>(0x80 | (code_point & 0x3f));
+	}
+}
+
+std::string Xml_ref::str() const
+{
+	std::string str;
+	str.reserve(size);
+	const char *last = data + size;
+	for (const char *c = data; c != last; ++c) {
+		if (*c != '&') {
+			str += *c;
+			continue;
+		}
+		auto semicolon = static_cast<const char *>(std::memchr(c, ';', last - c));
+		if (!semicolon)
+			throw std::runtime_error("Unterminated entity in xml.");
+		Xml_ref entity(c + 1, semicolon - c - 1);
+		if (entity == "lt")
+			str += '<';
+		else if (entity == "gt")
+			str += '>';
+		else if (entity == "amp")
+			str += '&';
+		else if (entity == "quot")
+			str += '"';
+		else if (entity == "apos")
+			str += '\'';
+		else if (entity.size > 2 && entity.data[0] == '#' && entity.data[1] == 'x')
+			append_utf8(str, Xml_ref(entity.data + 2, entity.size - 2).to_ulong(16));
+		else if (entity.size > 1 && entity.data[0] == '#')
+			append_utf8(str, Xml_ref(entity.data + 1, entity.size - 1).to_ulong(10));
+		else
+			throw std::runtime_error("Unknown entity in xml: " + std::string(entity.data, entity.size));
+		c = semicolon;
+	}
+	return str;
+}
+
+unsigned long Xml_ref::to_ulong(int base) const
+{
+	if (size == 0)
+		throw std::invalid_argument("Empty number in xml.");
+	// The referenced characters are followed by a quote or tag, both of which end the number.
+	char *number_end = nullptr;
+	errno = 0;
+	auto value = std::strtoul(data, &number_end, base);
+	if (number_end != data + size || errno != 0)
+		throw std::invalid_argument("Invalid number in xml: " + std::string(data, size));
+	return value;
+}
+
+long Xml_ref::to_long(int base) const
+{
+	if (size == 0)
+		throw std::invalid_argument("Empty number in xml.");
+	char *number_end = nullptr;
+	errno = 0;
+	auto value = std::strtol(data, &number_end, base);
+	if (number_end != data + size || errno != 0)
+		throw std::invalid_argument("Invalid number in xml: " + std::string(data, size));
+	return value;
+}
+
+std::string xml_escape(const std::string &str)
+{
+	std::string escaped;
+	escaped.reserve(str.size());
+	for (auto c : str) {
+		switch (c) {
+		case '<': escaped += "&lt;"; break;
+		case '>': escaped += "&gt;"; break;
+		case '&': escaped += "&amp;"; break;
+		case '"': escaped += "&quot;"; break;
+		case '\'': escaped += "&apos;"; break;
+		default: escaped += c;
+		}
+	}
+	return escaped;
+}
+
+//
+// Xml_scanner implementation
+//
+
+bool is_xml_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool is_name_end(char c)
+{
+	return is_xml_space(c) || c == '>' || c == '/' || c == '=';
+}
+
+Xml_scanner::Xml_scanner(const std::string &xml) :
+	Xml_scanner(xml.data(), xml.data() + xml.size())
+{
+}
+
+Xml_scanner::Xml_scanner(const char *begin, const char *end) :
+	begin(begin),
+	pos(begin),
+	end(end)
+{
+}
+
+void Xml_scanner::fail(const std::string &what) const
+{
+	throw std::runtime_error("Malformed xml at offset " + std::to_string(pos - begin) + ": " + what);
+}
+
+// Find str in [pos, end) or return end.
+const char * find_str(const char *pos, const char *end, const char *str)
+{
+	auto length = std::strlen(str);
+	for (; end - pos >= static_cast<ptrdiff_t>(length); ++pos) {
+		if (std::memcmp(pos, str, length) == 0)
+			return pos;
+	}
+	return end;
+}
+
+bool starts_with(const char *pos, const char *end, const char *str)
+{
+	auto length = std::strlen(str);
+	return end - pos >= static_cast<ptrdiff_t>(length) && std::memcmp(pos, str, length) == 0;
+}
+
+void Xml_scanner::parse_start_tag()
+{
+	tag_begin = pos;
+	const char *name_begin = ++pos;
+	while (pos != end && !is_name_end(*pos))
+		++pos;
+	if (pos == name_begin)
+		fail("Missing element name.");
+	current_name = Xml_ref(name_begin, pos - name_begin);
+	attributes.clear();
+	while (true) {
+		while (pos != end && is_xml_space(*pos))
+			++pos;
+		if (pos == end)
+			fail("Unterminated start tag.");
+		if (*pos == '>') {
+			++pos;
+			empty_element = false;
+			break;
+		}
+		if (*pos == '/') {
+			if (++pos == end || *pos != '>')
+				fail("Expected '>' after '/'.");
+			++pos;
+			empty_element = true;
+			break;
+		}
+		const char *attribute_begin = pos;
+		while (pos != end && !is_name_end(*pos))
+			++pos;
+		Xml_ref attribute_name(attribute_begin, pos - attribute_begin);
+		while (pos != end && is_xml_space(*pos))
+			++pos;
+		if (pos == end || *pos != '=' || attribute_name.empty())
+			fail("Expected attribute.");
+		++pos;
+		while (pos != end && is_xml_space(*pos))
+			++pos;
+		if (pos == end || (*pos != '"' && *pos != '\''))
+			fail("Expected quoted attribute value.");
+		auto quote = *pos++;
+		const char *value_begin = pos;
+		pos = static_cast<const char *>(std::memchr(pos, quote, end - pos));
+		if (!pos) {
+			pos = end;
+			fail("Unterminated attribute value.");
+		}
+		attributes.emplace_back(attribute_name, Xml_ref(value_begin, pos - value_begin));
+		++pos;
+	}
+	path.push_back(current_name);
+}
+
+Xml_scanner::Token Xml_scanner::next()
+{
+	if (pop_pending) {
+		path.pop_back();
+		pop_pending = false;
+	}
+	if (empty_element) {
+		empty_element = false;
+		pop_pending = true;
+		current_name = path.back();
+		return Token::end_element;
+	}
+	while (pos != end) {
+		if (*pos != '<') {
+			// Text up to the next tag without surrounding whitespace.
+			auto text_end = static_cast<const char *>(std::memchr(pos, '<', end - pos));
+			if (!text_end)
+				text_end = end;
+			const char *text_begin = pos;
+			pos = text_end;
+			while (text_begin != text_end && is_xml_space(*text_begin))
+				++text_begin;
+			while (text_end != text_begin && is_xml_space(*(text_end - 1)))
+				--text_end;
+			if (text_begin == text_end)
+				continue;
+			if (path.empty())
+				fail("Text outside of root element.");
+			current_text = Xml_ref(text_begin, text_end - text_begin);
+			return Token::text;
+		}
+		if (starts_with(pos, end, "<!--")) {
+			pos = find_str(pos + 4, end, "-->");
+			if (pos == end)
+				fail("Unterminated comment.");
+			pos += 3;
+		} else if (starts_with(pos, end, "<![CDATA[")) {
+			const char *text_begin = pos + 9;
+			pos = find_str(text_begin, end, "]]>");
+			if (pos == end)
+				fail("Unterminated CDATA section.");
+			current_text = Xml_ref(text_begin, pos - text_begin);
+			pos += 3;
+			return Token::text;
+		} else if (starts_with(pos, end, "<?")) {
+			pos = find_str(pos + 2, end, "?>");
+			if (pos == end)
+				fail("Unterminated processing instruction.");
+			pos += 2;
+		} else if (starts_with(pos, end, "<!")) {
+			pos = static_cast<const char *>(std::memchr(pos, '>', end - pos));
+			if (!pos) {
+				pos = end;
+				fail("Unterminated declaration.");
+			}
+			++pos;
+		} else if (starts_with(pos, end, "</")) {
+			const char *name_begin = pos + 2;
+			pos = name_begin;
+			while (pos != end && !is_name_end(*pos))
+				++pos;
+			current_name = Xml_ref(name_begin, pos - name_begin);
+			while (pos != end && is_xml_space(*pos))
+				++pos;
+			if (pos == end || *pos != '>')
+				fail("Unterminated end tag.");
+			++pos;
+			if (path.empty() || path.back().size != current_name.size ||
+					std::memcmp(path.back().data, current_name.data, current_name.size) != 0)
+				fail("Unexpected end tag " + std::string(current_name.data, current_name.size) + ".");
+			pop_pending = true;
+			return Token::end_element;
+		} else {
+			parse_start_tag();
+			return Token::start_element;
+		}
+	}
+	if (!path.empty())
+		fail("Unexpected end of document.");
+	return Token::end_of_document;
+}
+
+Xml_ref Xml_scanner::name() const
+{
+	return current_name;
+}
+
+Xml_ref Xml_scanner::text() const
+{
+	return current_text;
+}
+
+Xml_ref Xml_scanner::attribute(const char *name) const
+{
+	for (const auto &attribute : attributes) {
+		if (attribute.first == name)
+			return attribute.second;
+	}
+	return Xml_ref();
+}
+
+bool Xml_scanner::path_is(const char *path_str) const
+{
+	const char *component = path_str;
+	for (const auto &element : path) {
+		auto separator = std::strchr(component, '/');
+		size_t length = separator ? separator - component : std::strlen(component);
+		if (length != element.size || std::memcmp(component, element.data, length) != 0)
+			return false;
+		if (!separator)
+			return &element == &path.back();
+		component = separator + 1;
+	}
+	return false;
+}
+
+void Xml_scanner::skip_element()
+{
+	auto depth = path.size();
+	while (true) {
+		if (next() == Token::end_element && path.size() == depth)
+			return;
+	}
+}
+
+Xml_ref Xml_scanner::read_text()
+{
+	auto depth = path.size();
+	Xml_ref first_text;
+	while (true) {
+		auto token = next();
+		if (token == Token::text && first_text.data == nullptr && path.size() == depth)
+			first_text = current_text;
+		else if (token == Token::end_element && path.size() == depth)
+			return first_text;
+	}
+}
+
+Xml_ref Xml_scanner::read_element()
+{
+	const char *element_begin = tag_begin;
+	skip_element();
+	return Xml_ref(element_begin, pos - element_begin);
+}
@@ -0,0 +1,127 @@
+/*
+ * This file is part of migration-framework.
+ * Copyright (C) 2015 RWTH Aachen University - ACS
+ *
+ * This file is licensed under the GNU Lesser General Public License Version 3
+ * Version 3, 29 June 2007. For details see 'LICENSE.md' in the root directory.
+ */
+
+#ifndef XML_SCANNER_HPP
+#define XML_SCANNER_HPP
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * \brief Non-owning reference to a range of characters in an xml document.
+ *
+ * Entities are not decoded until the reference is converted by str().
+ */
+struct Xml_ref
+{
+	Xml_ref() = default;
+	Xml_ref(const char *data, size_t size);
+
+	bool empty() const;
+	bool operator==(const char *rhs) const;
+	bool operator!=(const char *rhs) const;
+	/**
+	 * \brief Copy the characters and decode entities.
+	 */
+	std::string str() const;
+	/**
+	 * \brief Convert to an unsigned integer. Base 0 detects hex numbers by their 0x prefix.
+	 *
+	 * Throws std::invalid_argument if not all characters belong to the number.
+	 */
+	unsigned long to_ulong(int base = 0) const;
+	/**
+	 * \brief Convert to an integer like to_ulong.
+	 */
+	long to_long(int base = 0) const;
+
+	const char *data = nullptr;
+	size_t size = 0;
+};
+
+/**
+ * \brief Escape the characters of str which must not appear literally in attribute values or text.
+ */
+std::string xml_escape(const std::string &str);
+
+/**
+ * \brief Pull scanner over an xml document which does not copy or build a tree.
+ *
+ * Each call of next() advances to the next start tag, end tag or non-whitespace text.
+ * Empty elements, e.g., <address/>, yield a start and an end token.
+ * Comments, processing instructions and doctype declarations are skipped.
+ * The document has to outlive the scanner and all references returned by it.
+ * Malformed documents make next() throw std::runtime_error.
+ */
+class Xml_scanner
+{
+public:
+	enum class Token {start_element, end_element, text, end_of_document};
+
+	explicit Xml_scanner(const std::string &xml);
+	Xml_scanner(const char *begin, const char *end);
+
+	/**
+	 * \brief Advance to the next token.
+	 */
+	Token next();
+	/**
+	 * \brief Name of the element of the current start or end token.
+	 */
+	Xml_ref name() const;
+	/**
+	 * \brief Text of the current text token with surrounding whitespace removed.
+	 */
+	Xml_ref text() const;
+	/**
+	 * \brief Value of an attribute of the current start element or a reference with data == nullptr if not present.
+	 */
+	Xml_ref attribute(const char *name) const;
+	/**
+	 * \brief Check the names of the open elements, e.g., "domain/devices/hostdev".
+	 *
+	 * At a start token the started element is included, at an end token the ended element is included.
+	 */
+	bool path_is(const char *path) const;
+	/**
+	 * \brief Skip the content of the current start element and advance to its end token.
+	 */
+	void skip_element();
+	/**
+	 * \brief Read the text of the current start element and advance to its end token.
+	 *
+	 * Returns an empty reference if the element has no text.
+	 */
+	Xml_ref read_text();
+	/**
+	 * \brief Get the current start element with its content as written in the document and advance to its end token.
+	 */
+	Xml_ref read_element();
+private:
+	void parse_start_tag();
+	[[noreturn]] void fail(const std::string &what) const;
+
+	const char *begin;
+	const char *pos;
+	const char *end;
+	// Position of the '<' of the current start tag.
+	const char *tag_begin = nullptr;
+	// Names of the open elements.
+	std::vector<Xml_ref> path;
+	std::vector<std::pair<Xml_ref, Xml_ref>> attributes;
+	Xml_ref current_name;
+	Xml_ref current_text;
+	// The current start tag was an empty element, so the next token is its end.
+	bool empty_element = false;
+	// The element of the last end token has to be removed from the path.
+	bool pop_pending = false;
+};
+
+#endif